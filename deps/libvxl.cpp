@@ -5,9 +5,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <assert.h>
 
 #include <libvxl.hpp>
 
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 static struct libvxl_chunk* chunk_fposition(struct libvxl_map* map, size_t x,
                                             size_t y) {
     size_t chunk_cnt = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
@@ -16,10 +21,11 @@ static struct libvxl_chunk* chunk_fposition(struct libvxl_map* map, size_t x,
     return map->chunks + chunk_x + chunk_y * chunk_cnt;
 }
 
+// geometry words are accessed atomically, solid checks may race with a writer
 static bool libvxl_geometry_get(struct libvxl_map* map, size_t x, size_t y,
                                 size_t z) {
     size_t offset = z + (x + y * map->width) * map->depth;
-    return map->geometry[offset / (sizeof(size_t) * 8)]
+    return __atomic_load_n(map->geometry + offset / (sizeof(size_t) * 8), __ATOMIC_RELAXED)
         & ((size_t)1 << (offset % (sizeof(size_t) * 8)));
 }
 
@@ -32,7 +38,28 @@ static void libvxl_geometry_set(struct libvxl_map* map, size_t x, size_t y,
     size_t* val = map->geometry + offset / (sizeof(size_t) * 8);
     size_t bit = offset % (sizeof(size_t) * 8);
 
-    *val = (*val & ~((size_t)1 << bit)) | (state << bit);
+    __atomic_store_n(val, (*val & ~((size_t)1 << bit)) | (state << bit), __ATOMIC_RELAXED);
+}
+
+// clears the solid bits of blocks z0 to z1 - 1 of a column, a word at a time
+static void libvxl_geometry_clear(struct libvxl_map* map, size_t x, size_t y,
+                                  size_t z0, size_t z1) {
+    z1 = min(z1, map->depth);
+    if(z0 >= z1)
+        return;
+
+    size_t bits = sizeof(size_t) * 8;
+    size_t start = z0 + (x + y * map->width) * map->depth;
+    size_t end = start + (z1 - z0);
+
+    while(start < end) {
+        size_t* val = map->geometry + start / bits;
+        size_t first = start % bits;
+        size_t count = min(end - start, bits - first);
+        size_t mask = (count == bits) ? ~(size_t)0 : (((size_t)1 << count) - 1) << first;
+        __atomic_store_n(val, *val & ~mask, __ATOMIC_RELAXED);
+        start += count;
+    }
 }
 
 static int cmp(const void* a, const void* b) {
@@ -53,8 +80,19 @@ static void libvxl_chunk_put(struct libvxl_chunk* chunk, uint32_t pos,
     memcpy(chunk->blocks + (chunk->index++), &block, sizeof(struct libvxl_block));
 }
 
+// gives the chunk its own copy of blocks shared with a snapshot, before it is modified
+static void libvxl_chunk_unshare(struct libvxl_chunk* chunk) {
+    if(!chunk->shared)
+        return;
+    auto blocks = (libvxl_block*) malloc(chunk->length * sizeof(struct libvxl_block));
+    memcpy(blocks, chunk->blocks, chunk->index * sizeof(struct libvxl_block));
+    chunk->blocks = blocks;
+    chunk->shared = false;
+}
+
 static void libvxl_chunk_insert(struct libvxl_chunk* chunk, uint32_t pos,
                                 uint32_t color) {
+    libvxl_chunk_unshare(chunk);
     size_t start = 0;
     size_t end = chunk->index;
     while(end > start) {
@@ -92,11 +130,31 @@ void libvxl_free(libvxl_map* map) {
     size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
     size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
     for(size_t k = 0; k < sx * sy; k++)
-        free(map->chunks[k].blocks);
+        if(!map->chunks[k].shared)
+            free(map->chunks[k].blocks);
     free(map->chunks);
     free(map->geometry);
 }
 
+void libvxl_map_replace(struct libvxl_map* dst, struct libvxl_map* src) {
+    assert(dst->width == src->width && dst->height == src->height && dst->depth == src->depth);
+
+    size_t words = (dst->width * dst->height * dst->depth + sizeof(size_t) * 8 - 1) / (sizeof(size_t) * 8);
+    for(size_t k = 0; k < words; k++)
+        __atomic_store_n(dst->geometry + k, src->geometry[k], __ATOMIC_RELAXED);
+
+    size_t sx = (dst->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (dst->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    for(size_t k = 0; k < sx * sy; k++)
+        if(!dst->chunks[k].shared)
+            free(dst->chunks[k].blocks);
+    free(dst->chunks);
+    free(src->geometry);
+
+    dst->chunks = src->chunks;
+    dst->streamed = src->streamed;
+}
+
 bool libvxl_size(size_t* size, size_t* depth, const uintptr_t data, size_t len) {
     if (!data) return false;
     size_t offset = 0;
@@ -115,9 +173,7 @@ bool libvxl_size(size_t* size, size_t* depth, const uintptr_t data, size_t len)
     return true;
 }
 
-bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
-                   const uintptr_t data, size_t len) {
-    if (!map) return false;
+static void libvxl_alloc(struct libvxl_map* map, size_t w, size_t h, size_t d, bool solid) {
     map->streamed = 0;
     map->width = w;
     map->height = h;
@@ -130,6 +186,7 @@ bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
             map->chunks[x + y * sx].length = LIBVXL_CHUNK_SIZE
                 * LIBVXL_CHUNK_SIZE * 2; // allows for two fully filled layers
             map->chunks[x + y * sx].index = 0;
+            map->chunks[x + y * sx].shared = false;
             map->chunks[x + y * sx].blocks = (libvxl_block*) malloc(map->chunks[x + y * sx].length * sizeof(struct libvxl_block));
         }
     }
@@ -137,64 +194,64 @@ bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
     size_t sg = (w * h * d + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8)
         * sizeof(size_t);
     map->geometry = (size_t*) malloc(sg);
-    if (data) {
-        memset(map->geometry, 0xFF, sg);
-    } else {
-        memset(map->geometry, 0x00, sg);
-        for(size_t y = 0; y < h; y++)
-            for(size_t x = 0; x < w; x++)
-                libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
-        return true;
-    }
+    memset(map->geometry, solid ? 0xFF : 0x00, sg);
+}
 
+// decodes all spans of column x,y, returns the bytes consumed or 0 if the column does not fit into len yet
+static size_t libvxl_column_decode(struct libvxl_map* map, size_t x, size_t y,
+                                   const uintptr_t data, size_t len) {
     size_t offset = 0;
-    for(size_t y = 0; y < map->height; y++) {
-        for(size_t x = 0; x < map->width; x++) {
-            struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
-
-            while(1) {
-                if(offset + sizeof(struct libvxl_span) - 1 >= len)
-                    return false;
-                auto desc = (libvxl_span*)(data + offset);
-                if(offset + libvxl_span_length(desc) - 1 >= len)
-                    return false;
-                uint32_t* color_data
-                    = (uint32_t*)(data + offset + sizeof(struct libvxl_span));
-
-                for(size_t z = desc->air_start; z < desc->color_start; z++)
-                    libvxl_geometry_set(map, x, y, z, 0);
-
-                for(size_t z = desc->color_start; z <= desc->color_end;
-                    z++) // top color run
-                    libvxl_chunk_put(chunk, pos_key(x, y, z),
-                                     color_data[z - desc->color_start]);
+    while(1) {
+        if(offset + sizeof(struct libvxl_span) - 1 >= len)
+            return 0;
+        auto desc = (libvxl_span*)(data + offset);
+        if(offset + libvxl_span_length(desc) - 1 >= len)
+            return 0;
+        offset += libvxl_span_length(desc);
+        if(desc->length == 0)
+            break;
+    }
 
-                size_t top_len = desc->color_end - desc->color_start + 1;
-                size_t bottom_len = desc->length - 1 - top_len;
+    size_t column_len = offset;
+    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
 
-                if(desc->length > 0) {
-                    if(offset + libvxl_span_length(desc)
-                           + sizeof(struct libvxl_span) - 1
-                       >= len)
-                        return false;
-                    struct libvxl_span* desc_next
-                        = (struct libvxl_span*)(data + offset
-                                                + libvxl_span_length(desc));
-                    for(size_t z = desc_next->air_start - bottom_len;
-                        z < desc_next->air_start; z++) // bottom color run
-                        libvxl_chunk_put(
-                            chunk, pos_key(x, y, z),
-                            color_data[z - (desc_next->air_start - bottom_len)
-                                       + top_len]);
-                    offset += libvxl_span_length(desc);
-                } else {
-                    offset += libvxl_span_length(desc);
-                    break;
-                }
-            }
+    offset = 0;
+    while(1) {
+        auto desc = (libvxl_span*)(data + offset);
+        uint32_t* color_data
+            = (uint32_t*)(data + offset + sizeof(struct libvxl_span));
+
+        libvxl_geometry_clear(map, x, y, desc->air_start, desc->color_start);
+
+        for(size_t z = desc->color_start; z <= desc->color_end;
+            z++) // top color run
+            libvxl_chunk_put(chunk, pos_key(x, y, z),
+                             color_data[z - desc->color_start]);
+
+        size_t top_len = desc->color_end - desc->color_start + 1;
+        size_t bottom_len = desc->length - 1 - top_len;
+
+        if(desc->length > 0) {
+            struct libvxl_span* desc_next
+                = (struct libvxl_span*)(data + offset
+                                        + libvxl_span_length(desc));
+            for(size_t z = desc_next->air_start - bottom_len;
+                z < desc_next->air_start; z++) // bottom color run
+                libvxl_chunk_put(
+                    chunk, pos_key(x, y, z),
+                    color_data[z - (desc_next->air_start - bottom_len)
+                               + top_len]);
+            offset += libvxl_span_length(desc);
+        } else {
+            break;
         }
     }
 
+    return column_len;
+}
+
+// blocks at the map borders become visible through the wrapped neighbour column, they need a color too
+static void libvxl_color_edges(struct libvxl_map* map) {
     for(size_t z = 0; z < map->depth; z++) {
         for(size_t x = 0; x < map->width; x++) {
             size_t A = libvxl_geometry_get(map, x, 0, z);
@@ -242,17 +299,323 @@ bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
                                     DEFAULT_COLOR(map->width - 1, y, z));
         }
     }
+}
+
+// expands the spans of a column into per block arrays, colors are optional
+static void libvxl_column_read(const uintptr_t data, size_t d, bool* solid, bool* colored, uint32_t* colors) {
+    for(size_t z = 0; z < d; z++) {
+        solid[z] = true;
+        if(colored)
+            colored[z] = false;
+    }
+
+    size_t offset = 0;
+    while(1) {
+        auto desc = (libvxl_span*)(data + offset);
+        uint32_t* color_data = (uint32_t*)(data + offset + sizeof(struct libvxl_span));
+
+        for(size_t z = desc->air_start; z < desc->color_start && z < d; z++)
+            solid[z] = false;
+
+        size_t top_len = desc->color_end - desc->color_start + 1;
+        size_t bottom_len = desc->length - 1 - top_len;
+
+        if(colored) {
+            for(size_t z = desc->color_start; z <= desc->color_end && z < d; z++) {
+                colored[z] = true;
+                colors[z] = color_data[z - desc->color_start];
+            }
+        }
+
+        if(desc->length == 0)
+            break;
+
+        struct libvxl_span* desc_next = (struct libvxl_span*)(data + offset + libvxl_span_length(desc));
+
+        if(colored) {
+            for(size_t z = desc_next->air_start - bottom_len; z < desc_next->air_start && z < d; z++) {
+                colored[z] = true;
+                colors[z] = color_data[z - (desc_next->air_start - bottom_len) + top_len];
+            }
+        }
+
+        offset += libvxl_span_length(desc);
+    }
+}
+
+// columns on the map border also get a color where the wrapped neighbour column exposes them,
+// this is the same what libvxl_color_edges() does afterwards for a map decoded in sequence
+static void libvxl_column_read_edge(const uintptr_t data, const size_t* offsets, size_t w, size_t h, size_t d,
+                                    size_t x, size_t y, bool* solid, bool* colored, uint32_t* colors,
+                                    bool* exposed) {
+    bool opposite[d];
+
+    libvxl_column_read(data + offsets[x + y * w], d, solid, colored, colors);
+
+    for(size_t z = 0; z < d; z++)
+        exposed[z] = false;
+
+    if(y == 0 || y == h - 1) {
+        libvxl_column_read(data + offsets[x + (y == 0 ? h - 1 : 0) * w], d, opposite, NULL, NULL);
+        for(size_t z = 0; z < d; z++)
+            exposed[z] |= !opposite[z];
+    }
+
+    if(x == 0 || x == w - 1) {
+        libvxl_column_read(data + offsets[(x == 0 ? w - 1 : 0) + y * w], d, opposite, NULL, NULL);
+        for(size_t z = 0; z < d; z++)
+            exposed[z] |= !opposite[z];
+    }
+}
+
+bool libvxl_decode_scan(struct libvxl_decode* decode, struct libvxl_map* map, size_t w, size_t h,
+                        size_t d, const uintptr_t data, size_t len) {
+    if(!decode || !map || !data)
+        return false;
+
+    size_t sx = (w + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (h + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t* offsets = (size_t*) malloc(w * h * sizeof(size_t));
+    size_t* counts = (size_t*) calloc(sx * sy, sizeof(size_t));
+
+    // only span headers are read here, to find each column and the number of colors per chunk
+    size_t offset = 0;
+    bool valid = true;
+    for(size_t y = 0; y < h && valid; y++) {
+        for(size_t x = 0; x < w && valid; x++) {
+            size_t* count = counts + x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+            offsets[x + y * w] = offset;
+
+            while(1) {
+                if(offset + sizeof(struct libvxl_span) - 1 >= len) {
+                    valid = false;
+                    break;
+                }
+                auto desc = (libvxl_span*)(data + offset);
+                if(offset + libvxl_span_length(desc) - 1 >= len) {
+                    valid = false;
+                    break;
+                }
+
+                *count += (desc->length > 0) ? desc->length - 1 : desc->color_end - desc->color_start + 1;
+                offset += libvxl_span_length(desc);
+
+                if(desc->length == 0)
+                    break;
+            }
+        }
+    }
+
+    if(!valid) {
+        free(offsets);
+        free(counts);
+        return false;
+    }
+
+    // border columns also hold the default colored blocks exposed by their wrapped neighbours
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) {
+            if(x != 0 && y != 0 && x != w - 1 && y != h - 1)
+                continue;
+
+            bool solid[d], colored[d], exposed[d];
+            uint32_t colors[d];
+            libvxl_column_read_edge(data, offsets, w, h, d, x, y, solid, colored, colors, exposed);
+
+            size_t* count = counts + x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+            for(size_t z = 0; z < d; z++)
+                if(solid[z] && !colored[z] && exposed[z])
+                    (*count)++;
+        }
+    }
+
+    libvxl_alloc(map, w, h, d, true);
+
+    for(size_t k = 0; k < sx * sy; k++) {
+        if(counts[k] > map->chunks[k].length) {
+            map->chunks[k].length = counts[k];
+            map->chunks[k].blocks = (libvxl_block*) realloc(map->chunks[k].blocks, counts[k] * sizeof(struct libvxl_block));
+        }
+    }
 
+    free(counts);
+
+    decode->map = map;
+    decode->data = data;
+    decode->len = len;
+    decode->offsets = offsets;
     return true;
 }
 
+size_t libvxl_decode_regions(struct libvxl_decode* decode) {
+    return ((decode->map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE)
+        * ((decode->map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+}
+
+bool libvxl_decode_concurrent(struct libvxl_decode* decode) {
+    return decode->map->width % LIBVXL_CHUNK_SIZE == 0
+        && (LIBVXL_CHUNK_SIZE * decode->map->depth) % (sizeof(size_t) * 8) == 0;
+}
+
+static void libvxl_column_decode_edge(struct libvxl_decode* decode, size_t x, size_t y) {
+    struct libvxl_map* map = decode->map;
+    size_t d = map->depth;
+
+    bool solid[d], colored[d], exposed[d];
+    uint32_t colors[d];
+
+    libvxl_column_read_edge(decode->data, decode->offsets, map->width, map->height, d, x, y, solid, colored, colors,
+                            exposed);
+
+    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+
+    for(size_t z = 0; z < d; z++) {
+        if(!solid[z])
+            libvxl_geometry_set(map, x, y, z, 0);
+
+        if(colored[z])
+            libvxl_chunk_put(chunk, pos_key(x, y, z), colors[z]);
+        else if(solid[z] && exposed[z])
+            libvxl_chunk_put(chunk, pos_key(x, y, z), DEFAULT_COLOR(x, y, z));
+    }
+}
+
+void libvxl_decode_region(struct libvxl_decode* decode, size_t region) {
+    struct libvxl_map* map = decode->map;
+    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t start_x = region % sx * LIBVXL_CHUNK_SIZE;
+    size_t start_y = region / sx * LIBVXL_CHUNK_SIZE;
+
+    for(size_t y = start_y; y < min(start_y + LIBVXL_CHUNK_SIZE, map->height); y++) {
+        for(size_t x = start_x; x < min(start_x + LIBVXL_CHUNK_SIZE, map->width); x++) {
+            size_t offset = decode->offsets[x + y * map->width];
+
+            if(x == 0 || y == 0 || x == map->width - 1 || y == map->height - 1)
+                libvxl_column_decode_edge(decode, x, y);
+            else
+                libvxl_column_decode(map, x, y, decode->data + offset, decode->len - offset);
+        }
+    }
+}
+
+void libvxl_decode_finish(struct libvxl_decode* decode) {
+    free(decode->offsets);
+}
+
+bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
+                   const uintptr_t data, size_t len) {
+    if (!map) return false;
+
+    if (!data) {
+        libvxl_alloc(map, w, h, d, false);
+        for(size_t y = 0; y < h; y++)
+            for(size_t x = 0; x < w; x++)
+                libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
+        return true;
+    }
+
+    struct libvxl_decode decode;
+    if(!libvxl_decode_scan(&decode, map, w, h, d, data, len))
+        return false;
+
+    for(size_t k = 0; k < libvxl_decode_regions(&decode); k++)
+        libvxl_decode_region(&decode, k);
+
+    libvxl_decode_finish(&decode);
+
+    return true;
+}
+
+bool libvxl_create_reference(struct libvxl_map* map, size_t w, size_t h, size_t d,
+                             const uintptr_t data, size_t len) {
+    if (!map || !data) return false;
+    libvxl_alloc(map, w, h, d, true);
+
+    size_t offset = 0;
+    for(size_t y = 0; y < map->height; y++) {
+        for(size_t x = 0; x < map->width; x++) {
+            size_t column_len = libvxl_column_decode(map, x, y, data + offset, len - offset);
+            if(!column_len) {
+                libvxl_free(map);
+                return false;
+            }
+            offset += column_len;
+        }
+    }
+
+    libvxl_color_edges(map);
+
+    return true;
+}
+
+void libvxl_decoder_create(struct libvxl_decoder* decoder, struct libvxl_map* map,
+                           size_t w, size_t h, size_t d) {
+    libvxl_alloc(map, w, h, d, true);
+    decoder->map = map;
+    decoder->columns = 0;
+    decoder->buffer_length = 0;
+    decoder->buffer_size = 64 * 1024;
+    decoder->buffer = (uint8_t*) malloc(decoder->buffer_size);
+}
+
+size_t libvxl_decoder_write(struct libvxl_decoder* decoder, const void* data, size_t len) {
+    size_t total = decoder->map->width * decoder->map->height;
+    if(decoder->columns >= total)
+        return decoder->columns;
+
+    if(decoder->buffer_length + len > decoder->buffer_size) { // needs to grow
+        while(decoder->buffer_length + len > decoder->buffer_size)
+            decoder->buffer_size *= 2;
+        decoder->buffer = (uint8_t*) realloc(decoder->buffer, decoder->buffer_size);
+    }
+
+    memcpy(decoder->buffer + decoder->buffer_length, data, len);
+    decoder->buffer_length += len;
+
+    size_t offset = 0;
+    while(decoder->columns < total) {
+        size_t column_len = libvxl_column_decode(
+            decoder->map, decoder->columns % decoder->map->width, decoder->columns / decoder->map->width,
+            (uintptr_t)decoder->buffer + offset, decoder->buffer_length - offset);
+        if(!column_len)
+            break;
+        offset += column_len;
+        decoder->columns++;
+    }
+
+    // keep the unfinished column for the next write
+    memmove(decoder->buffer, decoder->buffer + offset, decoder->buffer_length - offset);
+    decoder->buffer_length -= offset;
+
+    return decoder->columns;
+}
+
+bool libvxl_decoder_finish(struct libvxl_decoder* decoder) {
+    free(decoder->buffer);
+
+    if(decoder->columns < decoder->map->width * decoder->map->height) {
+        libvxl_free(decoder->map);
+        return false;
+    }
+
+    libvxl_color_edges(decoder->map);
+    return true;
+}
+
+// a block is colored if it is the next stored block of its column
+static bool libvxl_column_colored(struct libvxl_chunk* chunk, size_t offset, int x, int y, size_t z) {
+    return offset < chunk->index && chunk->blocks[offset].position == (uint32_t)pos_key(x, y, z);
+}
+
+// spans follow the stored colors, so that the output never reads past the blocks of a chunk,
+// even where colors are missing at the map edges of a decoded map
 static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
                                  int x, int y, uintptr_t out, size_t* offset) {
     struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+    size_t* colors = chunk_offsets + (chunk - map->chunks);
 
     bool first_run = true;
-    size_t z
-        = key_getz(chunk->blocks[chunk_offsets[chunk - map->chunks]].position);
+    size_t z = 0;
     while(1) {
         size_t top_start, top_end;
         size_t bottom_start;
@@ -262,13 +625,14 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
             ;
         for(top_end = top_start;
             top_end < map->depth && libvxl_geometry_get(map, x, y, top_end)
-            && libvxl_map_onsurface(map, x, y, top_end);
+            && libvxl_column_colored(chunk, *colors + top_end - top_start, x, y, top_end);
             top_end++)
             ;
 
+        size_t top_colors = *colors + top_end - top_start;
         for(bottom_start = top_end; bottom_start < map->depth
             && libvxl_geometry_get(map, x, y, bottom_start)
-            && !libvxl_map_onsurface(map, x, y, bottom_start);
+            && !libvxl_column_colored(chunk, top_colors, x, y, bottom_start);
             bottom_start++)
             ;
 
@@ -282,9 +646,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
 
         for (size_t k = top_start; k < top_end; k++) {
             *(uint32_t*)(out + *offset)
-                = (chunk->blocks[chunk_offsets[chunk - map->chunks]++].color
-                   & 0xFFFFFF)
-                | 0x7F000000;
+                = (chunk->blocks[(*colors)++].color & 0xFFFFFF) | 0x7F000000;
             *offset += sizeof(uint32_t);
         }
 
@@ -297,7 +659,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
             size_t bottom_end;
             for(bottom_end = bottom_start; bottom_end < map->depth
                 && libvxl_geometry_get(map, x, y, bottom_end)
-                && libvxl_map_onsurface(map, x, y, bottom_end);
+                && libvxl_column_colored(chunk, *colors + bottom_end - bottom_start, x, y, bottom_end);
                 bottom_end++)
                 ;
 
@@ -308,10 +670,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
 
                 for(size_t k = bottom_start; k < bottom_end; k++) {
                     *(uint32_t*)(out + *offset)
-                        = (chunk->blocks[chunk_offsets[chunk - map->chunks]++]
-                               .color
-                           & 0xFFFFFF)
-                        | 0x7F000000;
+                        = (chunk->blocks[(*colors)++].color & 0xFFFFFF) | 0x7F000000;
                     *offset += sizeof(uint32_t);
                 }
 
@@ -349,9 +708,6 @@ void libvxl_stream_free(struct libvxl_stream* stream) {
     free(stream->chunk_offsets);
 }
 
-#ifndef min
-#define min(a, b) ((a) < (b) ? (a) : (b))
-#endif
 
 size_t libvxl_stream_read(struct libvxl_stream* stream, void* out) {
     if(!stream || !out || key_gety(stream->pos) >= stream->map->height)
@@ -396,6 +752,175 @@ void libvxl_write(struct libvxl_map* map, void* out, size_t* size) {
     if (size) *size = offset;
 }
 
+size_t libvxl_write_rows_bound(struct libvxl_map* map, size_t y0, size_t y1) {
+    if(!map || y1 <= y0)
+        return 0;
+    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+    size_t blocks = 0;
+    for(size_t y = y0 / LIBVXL_CHUNK_SIZE; y < (y1 + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE; y++)
+        for(size_t x = 0; x < sx; x++)
+            blocks += map->chunks[x + y * sx].index;
+
+    // every block is stored at most once, every column has at most depth/2+1 span headers
+    return blocks * sizeof(uint32_t) + map->width * (y1 - y0) * (map->depth / 2 + 1) * sizeof(struct libvxl_span);
+}
+
+size_t libvxl_write_rows(struct libvxl_map* map, size_t y0, size_t y1, void* out) {
+    if(!map || !out)
+        return 0;
+    assert(y0 % LIBVXL_CHUNK_SIZE == 0);
+    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+    // blocks are sorted by row, so the first row of a chunk starts at its first block
+    size_t* chunk_offsets = (size_t*) calloc(sx * sy, sizeof(size_t));
+
+    size_t offset = 0;
+    for(size_t y = y0; y < min(y1, map->height); y++)
+        for(size_t x = 0; x < map->width; x++)
+            libvxl_column_encode(map, chunk_offsets, x, y, (uintptr_t) out, &offset);
+
+    free(chunk_offsets);
+    return offset;
+}
+
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* snapshot) {
+    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sg = (map->width * map->height * map->depth + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8)
+        * sizeof(size_t);
+
+    snapshot->width = map->width;
+    snapshot->height = map->height;
+    snapshot->depth = map->depth;
+    snapshot->streamed = 0;
+    snapshot->geometry = (size_t*) malloc(sg);
+    memcpy(snapshot->geometry, map->geometry, sg);
+    snapshot->chunks = (libvxl_chunk*) malloc(sx * sy * sizeof(struct libvxl_chunk));
+    memcpy(snapshot->chunks, map->chunks, sx * sy * sizeof(struct libvxl_chunk));
+
+    for(size_t k = 0; k < sx * sy; k++)
+        map->chunks[k].shared = true;
+}
+
+void libvxl_snapshot_free(struct libvxl_map* map, struct libvxl_map* snapshot) {
+    size_t sx = (snapshot->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (snapshot->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    bool same_size = map->width == snapshot->width && map->height == snapshot->height;
+
+    // shared arrays are never freed, so an equal pointer is still the same array
+    for(size_t k = 0; k < sx * sy; k++) {
+        if(same_size && map->chunks[k].blocks == snapshot->chunks[k].blocks)
+            map->chunks[k].shared = false;
+        else
+            free(snapshot->chunks[k].blocks);
+    }
+
+    free(snapshot->chunks);
+    free(snapshot->geometry);
+}
+
+#define LIBVXL_DECODED_VERSION 1
+#define libvxl_align8(x) (((x) + 7) & ~(size_t)7)
+
+struct __attribute((packed)) libvxl_decoded_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height, depth;
+    uint32_t word_size;
+};
+
+static size_t libvxl_decoded_geometry(size_t w, size_t h, size_t d) {
+    return (w * h * d + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8) * sizeof(size_t);
+}
+
+size_t libvxl_decoded_size(struct libvxl_map* map) {
+    if(!map)
+        return 0;
+    size_t chunks = ((map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE)
+        * ((map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+
+    size_t size = libvxl_align8(sizeof(struct libvxl_decoded_header) + chunks * sizeof(uint32_t))
+        + libvxl_decoded_geometry(map->width, map->height, map->depth);
+    for(size_t k = 0; k < chunks; k++)
+        size += map->chunks[k].index * sizeof(struct libvxl_block);
+    return size;
+}
+
+void libvxl_decoded_write(struct libvxl_map* map, void* out) {
+    if(!map || !out)
+        return;
+    size_t chunks = ((map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE)
+        * ((map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+
+    struct libvxl_decoded_header* header = (struct libvxl_decoded_header*)out;
+    memcpy(header->magic, "VXLD", 4);
+    header->version = LIBVXL_DECODED_VERSION;
+    header->width = map->width;
+    header->height = map->height;
+    header->depth = map->depth;
+    header->word_size = sizeof(size_t);
+
+    uint32_t* counts = (uint32_t*)(header + 1);
+    for(size_t k = 0; k < chunks; k++)
+        counts[k] = map->chunks[k].index;
+
+    uint8_t* ptr = (uint8_t*)out + libvxl_align8(sizeof(struct libvxl_decoded_header) + chunks * sizeof(uint32_t));
+    size_t sg = libvxl_decoded_geometry(map->width, map->height, map->depth);
+    memcpy(ptr, map->geometry, sg);
+    ptr += sg;
+
+    for(size_t k = 0; k < chunks; k++) {
+        memcpy(ptr, map->chunks[k].blocks, map->chunks[k].index * sizeof(struct libvxl_block));
+        ptr += map->chunks[k].index * sizeof(struct libvxl_block);
+    }
+}
+
+bool libvxl_decoded_create(struct libvxl_map* map, const void* data, size_t len) {
+    if(!map || !data || len < sizeof(struct libvxl_decoded_header))
+        return false;
+
+    struct libvxl_decoded_header* header = (struct libvxl_decoded_header*)data;
+    if(memcmp(header->magic, "VXLD", 4) || header->version != LIBVXL_DECODED_VERSION
+       || header->word_size != sizeof(size_t))
+        return false;
+
+    size_t chunks = ((header->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE)
+        * ((header->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+    size_t offset = libvxl_align8(sizeof(struct libvxl_decoded_header) + chunks * sizeof(uint32_t));
+    size_t sg = libvxl_decoded_geometry(header->width, header->height, header->depth);
+
+    if(offset + sg > len)
+        return false;
+
+    uint32_t* counts = (uint32_t*)(header + 1);
+    size_t blocks = 0;
+    for(size_t k = 0; k < chunks; k++)
+        blocks += counts[k];
+
+    if(offset + sg + blocks * sizeof(struct libvxl_block) != len)
+        return false;
+
+    libvxl_alloc(map, header->width, header->height, header->depth, false);
+    memcpy(map->geometry, (uint8_t*)data + offset, sg);
+    offset += sg;
+
+    // blocks are stored sorted already, they only need to be copied
+    for(size_t k = 0; k < chunks; k++) {
+        struct libvxl_chunk* chunk = map->chunks + k;
+        if(counts[k] > chunk->length) {
+            chunk->length = counts[k];
+            chunk->blocks = (libvxl_block*) realloc(chunk->blocks, chunk->length * sizeof(struct libvxl_block));
+        }
+        memcpy(chunk->blocks, (uint8_t*)data + offset, counts[k] * sizeof(struct libvxl_block));
+        chunk->index = counts[k];
+        offset += counts[k] * sizeof(struct libvxl_block);
+    }
+
+    return true;
+}
+
 size_t libvxl_writefile(struct libvxl_map* map, char* name) {
     if(!map || !name)
         return 0;
@@ -560,6 +1085,8 @@ static void libvxl_map_setair_internal(struct libvxl_map* map, int x, int y,
     auto loc = bsearch( &pos, chunk->blocks, chunk->index, sizeof(struct libvxl_block), cmp);
     if(loc) {
         auto i = ((size_t) loc - (size_t)(chunk->blocks)) / sizeof(struct libvxl_block);
+        libvxl_chunk_unshare(chunk);
+        loc = chunk->blocks + i;
         auto dest = (uintptr_t) loc + sizeof(struct libvxl_block);
         memmove(loc, (void*) dest, (chunk->index - i - 1) * sizeof(struct libvxl_block));
         chunk->index--;
@@ -648,36 +1175,91 @@ void libvxl_map_setair(struct libvxl_map* map, int x, int y, int z) {
 
 void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy) {
     free(copy->geometry);
+    free(copy->colors);
     free(copy->blocks_sorted);
 }
 
 uint32_t libvxl_copy_chunk_get_color(struct libvxl_chunk_copy* copy, size_t x,
                                      size_t y, size_t z) {
-    libvxl_block pos {.position = pos_key(x, y, z)};
-    auto loc = (libvxl_block*) bsearch(
-        &pos, copy->blocks_sorted, copy->blocks_sorted_count,
-        sizeof(struct libvxl_block), cmp
-    );
-    return loc ? (loc->color & 0xFFFFFF) : 0;
+    assert(x - copy->chunk_x < LIBVXL_CHUNK_SIZE
+           && y - copy->chunk_y < LIBVXL_CHUNK_SIZE && z < copy->depth);
+    return copy->colors[z + ((x - copy->chunk_x)
+                             + (y - copy->chunk_y) * LIBVXL_CHUNK_SIZE) * copy->depth];
 }
 
 bool libvxl_copy_chunk_is_solid(struct libvxl_chunk_copy* copy, size_t x,
                                 size_t y, size_t z) {
-    size_t offset = z + (x + y * copy->width) * copy->depth;
+    size_t lx = (x % copy->width + copy->width - copy->origin_x) % copy->width;
+    size_t ly = (y % copy->height + copy->height - copy->origin_y) % copy->height;
+    assert(lx < copy->window_x && ly < copy->window_y);
+
+    size_t offset = z + (lx + ly * copy->window_x) * copy->depth;
     return copy->geometry[offset / (sizeof(size_t) * 8)]
         & ((size_t)1 << (offset % (sizeof(size_t) * 8)));
 }
 
-void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
-                       size_t x, size_t y) {
+uint64_t libvxl_copy_chunk_column(struct libvxl_chunk_copy* copy, size_t x,
+                                  size_t y) {
+    assert(copy->depth <= 64);
+    size_t lx = (x % copy->width + copy->width - copy->origin_x) % copy->width;
+    size_t ly = (y % copy->height + copy->height - copy->origin_y) % copy->height;
+    assert(lx < copy->window_x && ly < copy->window_y);
+
+    size_t offset = (lx + ly * copy->window_x) * copy->depth;
+
+    if(sizeof(size_t) == sizeof(uint64_t) && copy->depth == 64)
+        return copy->geometry[offset / 64];
+
+    uint64_t column = 0;
+    for(size_t z = 0; z < copy->depth; z++)
+        if(copy->geometry[(offset + z) / (sizeof(size_t) * 8)]
+           & ((size_t)1 << ((offset + z) % (sizeof(size_t) * 8))))
+            column |= (uint64_t)1 << z;
+    return column;
+}
+
+size_t libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
+                         size_t x, size_t y, size_t border_min_x, size_t border_min_y, size_t border_max) {
     if(!map || !copy)
-        return;
+        return 0;
 
-    size_t sg
-        = (map->width * map->height * map->depth + (sizeof(size_t) * 8 - 1))
+    copy->width = map->width;
+    copy->height = map->height;
+    copy->depth = map->depth;
+    copy->window_x = min(LIBVXL_CHUNK_SIZE + border_min_x + border_max, map->width);
+    copy->window_y = min(LIBVXL_CHUNK_SIZE + border_min_y + border_max, map->height);
+    copy->origin_x = (x + map->width - border_min_x % map->width) % map->width;
+    copy->origin_y = (y + map->height - border_min_y % map->height) % map->height;
+
+    size_t sg = (copy->window_x * copy->window_y * copy->depth
+                 + (sizeof(size_t) * 8 - 1))
         / (sizeof(size_t) * 8) * sizeof(size_t);
     copy->geometry = (size_t*) malloc(sg);
-    memcpy(copy->geometry, map->geometry, sg);
+    memset(copy->geometry, 0, sg);
+
+    // columns start on a word boundary when the depth is a multiple of the word size
+    bool aligned = (map->depth % (sizeof(size_t) * 8)) == 0;
+    size_t column_words = map->depth / (sizeof(size_t) * 8);
+
+    for(size_t ly = 0; ly < copy->window_y; ly++) {
+        for(size_t lx = 0; lx < copy->window_x; lx++) {
+            size_t mx = (copy->origin_x + lx) % map->width;
+            size_t my = (copy->origin_y + ly) % map->height;
+
+            if(aligned) {
+                memcpy(copy->geometry + (lx + ly * copy->window_x) * column_words,
+                       map->geometry + (mx + my * map->width) * column_words,
+                       column_words * sizeof(size_t));
+            } else {
+                for(size_t z = 0; z < map->depth; z++) {
+                    size_t offset = z + (lx + ly * copy->window_x) * copy->depth;
+                    if(libvxl_geometry_get(map, mx, my, z))
+                        copy->geometry[offset / (sizeof(size_t) * 8)]
+                            |= (size_t)1 << (offset % (sizeof(size_t) * 8));
+                }
+            }
+        }
+    }
 
     struct libvxl_chunk* c = chunk_fposition(map, x, y);
     copy->blocks_sorted = (libvxl_block*) malloc(c->index * sizeof(struct libvxl_block));
@@ -685,8 +1267,371 @@ void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
     memcpy(copy->blocks_sorted, c->blocks,
            c->index * sizeof(struct libvxl_block));
 
+    copy->chunk_x = x / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+    copy->chunk_y = y / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+
+    size_t sc = LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE * map->depth * sizeof(uint32_t);
+    copy->colors = (uint32_t*) malloc(sc);
+    memset(copy->colors, 0, sc);
+
+    for(size_t k = 0; k < copy->blocks_sorted_count; k++) {
+        struct libvxl_block* blk = copy->blocks_sorted + k;
+        size_t bx = key_getx(blk->position) - copy->chunk_x;
+        size_t by = key_gety(blk->position) - copy->chunk_y;
+        copy->colors[key_getz(blk->position) + (bx + by * LIBVXL_CHUNK_SIZE) * map->depth]
+            = blk->color & 0xFFFFFF;
+    }
+
+    return sg + c->index * sizeof(struct libvxl_block);
+}
+
+static struct libvxl_column* libvxl_columns_at(struct libvxl_columns* map, size_t x, size_t y) {
+    return map->columns + x + y * map->width;
+}
+
+// position of block z in a column's colors
+static size_t libvxl_column_index(struct libvxl_column* c, size_t z) {
+    return __builtin_popcountll(c->colored & (((uint64_t)1 << z) - 1));
+}
+
+static void libvxl_column_put(struct libvxl_column* c, size_t z, uint32_t color) {
+    uint64_t bit = (uint64_t)1 << z;
+    size_t i = libvxl_column_index(c, z);
+
+    if(c->colored & bit) { // replace color
+        c->colors[i] = color;
+        return;
+    }
+
+    size_t count = __builtin_popcountll(c->colored);
+
+    if(count == c->capacity) { // needs to grow, a column never holds more than 64 colors
+        size_t capacity = min(count < 2 ? 4 : count * 2, 64);
+        uint32_t* colors = (uint32_t*) malloc(capacity * sizeof(uint32_t));
+        if(count)
+            memcpy(colors, c->colors, count * sizeof(uint32_t));
+        if(c->owned)
+            free(c->colors);
+        c->colors = colors;
+        c->capacity = capacity;
+        c->owned = true;
+    }
+
+    memmove(c->colors + i + 1, c->colors + i, (count - i) * sizeof(uint32_t));
+    c->colors[i] = color;
+    c->colored |= bit;
+}
+
+static void libvxl_column_remove(struct libvxl_column* c, size_t z) {
+    uint64_t bit = (uint64_t)1 << z;
+
+    if(!(c->colored & bit))
+        return;
+
+    size_t i = libvxl_column_index(c, z);
+    size_t count = __builtin_popcountll(c->colored);
+
+    memmove(c->colors + i, c->colors + i + 1, (count - i - 1) * sizeof(uint32_t));
+    c->colored &= ~bit;
+}
+
+static bool libvxl_columns_onsurface(struct libvxl_columns* map, int x, int y, int z) {
+    return !libvxl_columns_issolid(map, x, y + 1, z)
+        || !libvxl_columns_issolid(map, x, y - 1, z)
+        || !libvxl_columns_issolid(map, x + 1, y, z)
+        || !libvxl_columns_issolid(map, x - 1, y, z)
+        || !libvxl_columns_issolid(map, x, y, z + 1)
+        || !libvxl_columns_issolid(map, x, y, z - 1);
+}
+
+bool libvxl_columns_create(struct libvxl_columns* map, size_t w, size_t h, size_t d, const uintptr_t data,
+                           size_t len) {
+    if(!map)
+        return false;
+    map->width = (d > 64) ? 0 : w;
+    map->height = (d > 64) ? 0 : h;
+    map->depth = d;
+    map->columns = (d > 64) ? NULL : (libvxl_column*) calloc(w * h, sizeof(struct libvxl_column));
+    map->pool = NULL;
+    if(d > 64)
+        return false;
+
+    if(!data) {
+        for(size_t y = 0; y < h; y++)
+            for(size_t x = 0; x < w; x++)
+                libvxl_columns_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
+        return true;
+    }
+
+    // colors of all columns go into one pool, a column only gets its own array once it grows
+    size_t pool_length = w * h * 4;
+    size_t pool_count = 0;
+    uint32_t* pool = (uint32_t*) malloc(pool_length * sizeof(uint32_t));
+    size_t* starts = (size_t*) malloc(w * h * sizeof(size_t));
+
+    size_t offset = 0;
+    bool valid = true;
+    for(size_t y = 0; y < h && valid; y++) {
+        for(size_t x = 0; x < w && valid; x++) {
+            struct libvxl_column* c = libvxl_columns_at(map, x, y);
+            c->solid = (d == 64) ? ~(uint64_t)0 : (((uint64_t)1 << d) - 1);
+            starts[x + y * w] = pool_count;
+
+            while(1) {
+                if(offset + sizeof(struct libvxl_span) - 1 >= len) {
+                    valid = false;
+                    break;
+                }
+                auto desc = (libvxl_span*)(data + offset);
+                if(offset + libvxl_span_length(desc) - 1 >= len) {
+                    valid = false;
+                    break;
+                }
+                uint32_t* color_data = (uint32_t*)(data + offset + sizeof(struct libvxl_span));
+
+                for(size_t z = desc->air_start; z < desc->color_start && z < d; z++)
+                    c->solid &= ~((uint64_t)1 << z);
+
+                size_t top_len = desc->color_end - desc->color_start + 1;
+                size_t bottom_len = desc->length - 1 - top_len;
+                uint32_t* colors[2] = {color_data, color_data + top_len};
+                size_t runs[2][2] = {{desc->color_start, top_len}, {0, 0}};
+
+                if(desc->length > 0) {
+                    if(offset + libvxl_span_length(desc) + sizeof(struct libvxl_span) - 1 >= len) {
+                        valid = false;
+                        break;
+                    }
+                    struct libvxl_span* desc_next = (struct libvxl_span*)(data + offset + libvxl_span_length(desc));
+                    runs[1][0] = desc_next->air_start - bottom_len;
+                    runs[1][1] = bottom_len;
+                }
+
+                // top color run, then bottom color run
+                for(size_t r = 0; r < 2; r++) {
+                    for(size_t k = 0; k < runs[r][1]; k++) {
+                        size_t z = runs[r][0] + k;
+                        if(z >= d || (c->colored & ((uint64_t)1 << z)))
+                            continue;
+
+                        if(pool_count == pool_length) {
+                            pool_length *= 2;
+                            pool = (uint32_t*) realloc(pool, pool_length * sizeof(uint32_t));
+                        }
+
+                        pool[pool_count++] = colors[r][k];
+                        c->colored |= (uint64_t)1 << z;
+                    }
+                }
+
+                offset += libvxl_span_length(desc);
+
+                if(desc->length == 0)
+                    break;
+            }
+        }
+    }
+
+    for(size_t k = 0; k < w * h; k++) {
+        map->columns[k].colors = pool + starts[k];
+        map->columns[k].capacity = __builtin_popcountll(map->columns[k].colored);
+    }
+
+    free(starts);
+    map->pool = pool;
+
+    if(!valid)
+        return false;
+
+    for(size_t z = 0; z < d; z++) {
+        for(size_t x = 0; x < w; x++) {
+            bool A = libvxl_columns_issolid(map, x, 0, z);
+            bool B = libvxl_columns_issolid(map, x, h - 1, z);
+            struct libvxl_column* c1 = libvxl_columns_at(map, x, 0);
+            struct libvxl_column* c2 = libvxl_columns_at(map, x, h - 1);
+
+            if(A && !B && !(c1->colored & ((uint64_t)1 << z)))
+                libvxl_column_put(c1, z, DEFAULT_COLOR(x, 0, z));
+            if(!A && B && !(c2->colored & ((uint64_t)1 << z)))
+                libvxl_column_put(c2, z, DEFAULT_COLOR(x, h - 1, z));
+        }
+
+        for(size_t y = 0; y < h; y++) {
+            bool A = libvxl_columns_issolid(map, 0, y, z);
+            bool B = libvxl_columns_issolid(map, w - 1, y, z);
+            struct libvxl_column* c1 = libvxl_columns_at(map, 0, y);
+            struct libvxl_column* c2 = libvxl_columns_at(map, w - 1, y);
+
+            if(A && !B && !(c1->colored & ((uint64_t)1 << z)))
+                libvxl_column_put(c1, z, DEFAULT_COLOR(0, y, z));
+            if(!A && B && !(c2->colored & ((uint64_t)1 << z)))
+                libvxl_column_put(c2, z, DEFAULT_COLOR(w - 1, y, z));
+        }
+    }
+
+    return true;
+}
+
+void libvxl_columns_free(struct libvxl_columns* map) {
+    if(!map)
+        return;
+    for(size_t k = 0; k < map->width * map->height; k++)
+        if(map->columns[k].owned)
+            free(map->columns[k].colors);
+    free(map->columns);
+    free(map->pool);
+}
+
+bool libvxl_columns_issolid(struct libvxl_columns* map, int x, int y, int z) {
+    if(z < 0)
+        return false;
+    if(!map || z >= (int)map->depth)
+        return true;
+    return (libvxl_columns_at(map, (size_t)x % map->width, (size_t)y % map->height)->solid >> z) & 1;
+}
+
+uint32_t libvxl_columns_get(struct libvxl_columns* map, int x, int y, int z) {
+    if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width || y >= (int)map->height || z >= (int)map->depth)
+        return 0;
+    struct libvxl_column* c = libvxl_columns_at(map, x, y);
+    if(!((c->solid >> z) & 1))
+        return 0;
+    return ((c->colored >> z) & 1) ? c->colors[libvxl_column_index(c, z)] : DEFAULT_COLOR(x, y, z);
+}
+
+static void libvxl_columns_set_internal(struct libvxl_columns* map, int x, int y, int z, uint32_t color) {
+    if(x < 0 || y < 0 || z < 0 || x >= (int)map->width || y >= (int)map->height || z >= (int)map->depth)
+        return;
+    if(libvxl_columns_issolid(map, x, y, z) && !libvxl_columns_onsurface(map, x, y, z))
+        return;
+    libvxl_column_put(libvxl_columns_at(map, x, y), z, color);
+}
+
+static void libvxl_columns_setair_internal(struct libvxl_columns* map, int x, int y, int z) {
+    if(x < 0 || y < 0 || z < 0 || x >= (int)map->width || y >= (int)map->height || z >= (int)map->depth)
+        return;
+    libvxl_column_remove(libvxl_columns_at(map, x, y), z);
+}
+
+static const int libvxl_columns_neighbours[6][3] = {
+    {0, 1, 0}, {0, -1, 0}, {1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1},
+};
+
+void libvxl_columns_set(struct libvxl_columns* map, int x, int y, int z, uint32_t color) {
+    if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width || y >= (int)map->height || z >= (int)map->depth)
+        return;
+
+    libvxl_columns_set_internal(map, x, y, z, color);
+    libvxl_columns_at(map, x, y)->solid |= (uint64_t)1 << z;
+
+    for(size_t k = 0; k < 6; k++) {
+        int nx = x + libvxl_columns_neighbours[k][0];
+        int ny = y + libvxl_columns_neighbours[k][1];
+        int nz = z + libvxl_columns_neighbours[k][2];
+
+        if(libvxl_columns_issolid(map, nx, ny, nz) && !libvxl_columns_onsurface(map, nx, ny, nz))
+            libvxl_columns_setair_internal(map, nx, ny, nz);
+    }
+}
+
+void libvxl_columns_setair(struct libvxl_columns* map, int x, int y, int z) {
+    if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width || y >= (int)map->height || z >= (int)map->depth)
+        return;
+
+    bool surface_prev[6];
+    for(size_t k = 0; k < 6; k++) {
+        int nx = x + libvxl_columns_neighbours[k][0];
+        int ny = y + libvxl_columns_neighbours[k][1];
+        int nz = z + libvxl_columns_neighbours[k][2];
+
+        surface_prev[k]
+            = libvxl_columns_issolid(map, nx, ny, nz) ? libvxl_columns_onsurface(map, nx, ny, nz) : true;
+    }
+
+    libvxl_columns_setair_internal(map, x, y, z);
+    libvxl_columns_at(map, x, y)->solid &= ~((uint64_t)1 << z);
+
+    for(size_t k = 0; k < 6; k++) {
+        int nx = x + libvxl_columns_neighbours[k][0];
+        int ny = y + libvxl_columns_neighbours[k][1];
+        int nz = z + libvxl_columns_neighbours[k][2];
+
+        if(!surface_prev[k] && libvxl_columns_onsurface(map, nx, ny, nz))
+            libvxl_columns_set_internal(map, nx, ny, nz, DEFAULT_COLOR(nx, ny, nz));
+    }
+}
+
+size_t libvxl_columns_copy_chunk(struct libvxl_columns* map, struct libvxl_chunk_copy* copy, size_t x, size_t y,
+                                 size_t border_min_x, size_t border_min_y, size_t border_max) {
+    if(!map || !copy)
+        return 0;
+
     copy->width = map->width;
+    copy->height = map->height;
     copy->depth = map->depth;
+    copy->window_x = min(LIBVXL_CHUNK_SIZE + border_min_x + border_max, map->width);
+    copy->window_y = min(LIBVXL_CHUNK_SIZE + border_min_y + border_max, map->height);
+    copy->origin_x = (x + map->width - border_min_x % map->width) % map->width;
+    copy->origin_y = (y + map->height - border_min_y % map->height) % map->height;
+
+    size_t sg = (copy->window_x * copy->window_y * copy->depth + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8)
+        * sizeof(size_t);
+    copy->geometry = (size_t*) malloc(sg);
+    memset(copy->geometry, 0, sg);
+
+    for(size_t ly = 0; ly < copy->window_y; ly++) {
+        for(size_t lx = 0; lx < copy->window_x; lx++) {
+            uint64_t solid = libvxl_columns_at(map, (copy->origin_x + lx) % map->width,
+                                               (copy->origin_y + ly) % map->height)->solid;
+
+            if(sizeof(size_t) == sizeof(uint64_t) && map->depth == 64) {
+                copy->geometry[lx + ly * copy->window_x] = solid;
+            } else {
+                for(size_t z = 0; z < map->depth; z++) {
+                    size_t offset = z + (lx + ly * copy->window_x) * copy->depth;
+                    if((solid >> z) & 1)
+                        copy->geometry[offset / (sizeof(size_t) * 8)] |= (size_t)1
+                            << (offset % (sizeof(size_t) * 8));
+                }
+            }
+        }
+    }
+
+    copy->chunk_x = x / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+    copy->chunk_y = y / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+
+    size_t count = 0;
+    for(size_t by = copy->chunk_y; by < min(copy->chunk_y + LIBVXL_CHUNK_SIZE, map->height); by++)
+        for(size_t bx = copy->chunk_x; bx < min(copy->chunk_x + LIBVXL_CHUNK_SIZE, map->width); bx++)
+            count += __builtin_popcountll(libvxl_columns_at(map, bx, by)->colored);
+
+    copy->blocks_sorted = (libvxl_block*) malloc(count * sizeof(struct libvxl_block));
+    copy->blocks_sorted_count = count;
+
+    size_t sc = LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE * map->depth * sizeof(uint32_t);
+    copy->colors = (uint32_t*) malloc(sc);
+    memset(copy->colors, 0, sc);
+
+    // same order as the sorted blocks of a libvxl_chunk: by y, then x, then z
+    struct libvxl_block* blk = copy->blocks_sorted;
+    for(size_t by = copy->chunk_y; by < min(copy->chunk_y + LIBVXL_CHUNK_SIZE, map->height); by++) {
+        for(size_t bx = copy->chunk_x; bx < min(copy->chunk_x + LIBVXL_CHUNK_SIZE, map->width); bx++) {
+            struct libvxl_column* c = libvxl_columns_at(map, bx, by);
+            uint32_t* color = c->colors;
+
+            for(uint64_t bits = c->colored; bits; bits &= bits - 1) {
+                size_t z = __builtin_ctzll(bits);
+                blk->position = pos_key(bx, by, z);
+                blk->color = *color;
+                copy->colors[z + ((bx - copy->chunk_x) + (by - copy->chunk_y) * LIBVXL_CHUNK_SIZE) * map->depth]
+                    = *color & 0xFFFFFF;
+                blk++;
+                color++;
+            }
+        }
+    }
+
+    return sg + count * sizeof(struct libvxl_block);
 }
 
 /*
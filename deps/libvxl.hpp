@@ -51,6 +51,7 @@ struct libvxl_block {
 struct libvxl_chunk {
     struct libvxl_block* blocks;
     size_t length, index;
+    bool shared; // blocks are also referenced by a snapshot, copied before modification
 };
 
 struct libvxl_map {
@@ -69,6 +70,22 @@ struct libvxl_stream {
     size_t pos;
 };
 
+//! @brief Decodes a map whose data arrives in pieces
+struct libvxl_decoder {
+    struct libvxl_map* map;
+    size_t columns;
+    uint8_t* buffer;
+    size_t buffer_length, buffer_size;
+};
+
+//! @brief Decodes a map whose data is complete in independent regions
+struct libvxl_decode {
+    struct libvxl_map* map;
+    uintptr_t data;
+    size_t len;
+    size_t* offsets;
+};
+
 struct __attribute((packed)) libvxl_kv6 {
     char magic[4];
     int width, height, depth;
@@ -83,23 +100,50 @@ struct __attribute((packed)) libvxl_kv6_block {
     unsigned char normal;
 };
 
+//! @brief Snapshot of a single chunk and the columns around it
+//!
+//! Only the geometry of a window of columns around the chunk is copied, which
+//! wraps around the map edges just like libvxl_map_issolid() does. Colors of
+//! the chunk itself are expanded into a dense grid for constant time lookups.
 struct libvxl_chunk_copy {
-    size_t width, depth;
+    size_t width, height, depth;
+    size_t origin_x, origin_y;
+    size_t window_x, window_y;
+    size_t chunk_x, chunk_y;
     size_t* geometry;
+    uint32_t* colors;
     struct libvxl_block* blocks_sorted;
     size_t blocks_sorted_count;
 };
 
 void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy);
 
+//! @brief Get color of a block inside the copied chunk
+//! @returns color without alpha, or 0 if the block is not on the surface
 uint32_t libvxl_copy_chunk_get_color(struct libvxl_chunk_copy* copy, size_t x,
                                      size_t y, size_t z);
 
+//! @brief Tells if a block inside the copied window is solid
+//! @note x and y must lie inside the window given to libvxl_copy_chunk()
 bool libvxl_copy_chunk_is_solid(struct libvxl_chunk_copy* copy, size_t x,
                                 size_t y, size_t z);
 
-void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
-                       size_t x, size_t y);
+//! @brief Get the solid bits of a whole column inside the copied window
+//! @note bit z is set if block z is solid, only valid for a depth of up to 64
+uint64_t libvxl_copy_chunk_column(struct libvxl_chunk_copy* copy, size_t x,
+                                  size_t y);
+
+//! @brief Copy a chunk's blocks and the geometry of the columns surrounding it
+//! @param map Map to copy from
+//! @param copy Snapshot to fill, free with libvxl_copy_chunk_destroy()
+//! @param x x-coordinate of the chunk's first column
+//! @param y y-coordinate of the chunk's first column
+//! @param border_min_x columns to include before the chunk on the x axis
+//! @param border_min_y columns to include before the chunk on the y axis
+//! @param border_max columns to include after the chunk on both axes
+//! @returns total bytes copied
+size_t libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
+                         size_t x, size_t y, size_t border_min_x, size_t border_min_y, size_t border_max);
 
 //! @brief Load a map from memory or create an empty one
 //!
@@ -118,6 +162,82 @@ void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
 //! @returns 1 on success
 bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d, const uintptr_t data, size_t len);
 
+//! @brief Same as libvxl_create(), but decodes column by column like libvxl_create always did
+//!
+//! Much slower, it is only kept as the reference that the region decoder is checked against.
+//! @returns 1 on success, 0 if the data is truncated in which case nothing needs to be freed
+bool libvxl_create_reference(struct libvxl_map* map, size_t w, size_t h, size_t d, const uintptr_t data,
+                             size_t len);
+
+//! @brief First step of decoding a map in regions, that can run in parallel
+//!
+//! Finds the start of every column and allocates the chunks for the number of colors they are
+//! going to hold. Then every region has to be decoded with libvxl_decode_region(), the result is
+//! the same as with libvxl_create().
+//! @param decode Decode state to initialize
+//! @param map Map to decode into
+//! @param w Width of map (x-coord)
+//! @param h Height of map (y-coord)
+//! @param d Depth of map (z-coord)
+//! @param data Pointer to valid map data, must stay valid until libvxl_decode_finish()
+//! @param len map data size in bytes
+//! @returns 1 on success, 0 if the data is truncated in which case nothing needs to be freed
+bool libvxl_decode_scan(struct libvxl_decode* decode, struct libvxl_map* map, size_t w, size_t h,
+                        size_t d, const uintptr_t data, size_t len);
+
+//! @brief Number of regions to decode, there is one for every internal chunk
+size_t libvxl_decode_regions(struct libvxl_decode* decode);
+
+//! @brief Tells if regions can be decoded by different threads at the same time
+//! @note This is the case when no two regions share a word of the geometry bitmap, e.g. for 512x512x64
+bool libvxl_decode_concurrent(struct libvxl_decode* decode);
+
+//! @brief Decode all columns of one region
+void libvxl_decode_region(struct libvxl_decode* decode, size_t region);
+
+//! @brief Free the decode state once all regions are decoded
+void libvxl_decode_finish(struct libvxl_decode* decode);
+
+//! @brief Start decoding a map piece by piece
+//!
+//! The map is filled column by column as its data comes in through libvxl_decoder_write(),
+//! e.g. straight from a decompressor. The result is the same as with libvxl_create().
+//! @param decoder Decoder state to initialize
+//! @param map Map to decode into, must not be accessed until libvxl_decoder_finish()
+//! @param w Width of map (x-coord)
+//! @param h Height of map (y-coord)
+//! @param d Depth of map (z-coord)
+void libvxl_decoder_create(struct libvxl_decoder* decoder, struct libvxl_map* map,
+                           size_t w, size_t h, size_t d);
+
+//! @brief Decode the next piece of map data
+//! @note A column split between two pieces is kept until it is complete
+//! @returns number of columns decoded so far
+size_t libvxl_decoder_write(struct libvxl_decoder* decoder, const void* data, size_t len);
+
+//! @brief Finish decoding and free the decoder's buffers
+//! @returns 1 on success, 0 if data ended early in which case the map is freed too
+bool libvxl_decoder_finish(struct libvxl_decoder* decoder);
+
+//! @brief Size of a map in decoded format, see libvxl_decoded_write()
+size_t libvxl_decoded_size(struct libvxl_map* map);
+
+//! @brief Store a map in libvxl's own decoded format
+//!
+//! Unlike vxl, this format is a plain dump of the sorted blocks of every chunk and the geometry
+//! bitmap. Loading it with libvxl_decoded_create() needs no parsing, only copies. It depends on the
+//! machine's word size and byte order, so it is only suitable for local caches.
+//! @param map Map to store
+//! @param out Memory of at least libvxl_decoded_size() bytes
+void libvxl_decoded_write(struct libvxl_map* map, void* out);
+
+//! @brief Load a map from libvxl's decoded format
+//! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
+//! @param data Pointer to data written by libvxl_decoded_write(), e.g. a memory mapped file
+//! @param len data size in bytes
+//! @returns 1 on success, 0 if the data is malformed or from an incompatible machine
+bool libvxl_decoded_create(struct libvxl_map* map, const void* data, size_t len);
+
 //! @brief Write a map to disk, uses the libvxl_stream API internally
 //! @param map Map to be written
 //! @param name Filename of output file
@@ -130,6 +250,37 @@ size_t libvxl_writefile(struct libvxl_map* map, char* name);
 //! @param size pointer to an int, total byte size
 void libvxl_write(struct libvxl_map* map, void* out, size_t* size);
 
+//! @brief Upper bound of the vxl size of rows [y0,y1) as written by libvxl_write_rows()
+//! @param map Map to measure
+//! @param y0 first row, must be a multiple of LIBVXL_CHUNK_SIZE
+//! @param y1 row after the last one
+//! @returns size in bytes
+size_t libvxl_write_rows_bound(struct libvxl_map* map, size_t y0, size_t y1);
+
+//! @brief Compress rows [y0,y1) of the map to vxl format
+//!
+//! Concatenating the output of consecutive row ranges gives the same result as libvxl_write(),
+//! so that ranges can be encoded in parallel.
+//! @param map Map to compress
+//! @param y0 first row, must be a multiple of LIBVXL_CHUNK_SIZE
+//! @param y1 row after the last one
+//! @param out memory of at least libvxl_write_rows_bound() bytes
+//! @returns size written in bytes
+size_t libvxl_write_rows(struct libvxl_map* map, size_t y0, size_t y1, void* out);
+
+//! @brief Take a read-only copy of a map that shares its blocks with the original
+//!
+//! Only the geometry is copied. Block arrays are shared and get copied by the original
+//! the first time it modifies them, so the snapshot stays unchanged.
+//! @param map Map to take the snapshot of, must not be modified during the call
+//! @param snapshot Pointer to a struct of type libvxl_map that stores the snapshot
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* snapshot);
+
+//! @brief Free a snapshot taken by libvxl_snapshot()
+//! @param map Map the snapshot was taken of, must not be accessed during the call
+//! @param snapshot Snapshot to free
+void libvxl_snapshot_free(struct libvxl_map* map, struct libvxl_map* snapshot);
+
 //! @brief Tells if a block is solid at location [x,y,z]
 //! @param map Map to use
 //! @param x x-coordinate of block
@@ -197,6 +348,14 @@ void libvxl_map_setair(struct libvxl_map* map, int x, int y, int z);
 //! @param map Map to free
 void libvxl_free(struct libvxl_map* map);
 
+//! @brief Replace a map with another one of the same size
+//!
+//! The geometry of src is copied into the geometry buffer of dst, which keeps
+//! its address, so that lock-free readers of dst never touch freed memory.
+//! @param dst Map to replace, its previous blocks are freed
+//! @param src Map to take over, must not be used afterwards
+void libvxl_map_replace(struct libvxl_map* dst, struct libvxl_map* src);
+
 //! @brief Tries to guess the size of a map
 //! @note This won't always give accurate results for a map's height
 //! @note It is assumed the map is square.
@@ -231,6 +390,56 @@ size_t libvxl_stream_read(struct libvxl_stream* stream, void* out);
 //! @param z z-coordinate of block
 bool libvxl_map_isinside(struct libvxl_map* map, int x, int y, int z);
 
+//! @brief A single column of a libvxl_columns map
+struct libvxl_column {
+    //! bit z is set if block z is solid
+    uint64_t solid;
+    //! bit z is set if block z has a color
+    uint64_t colored;
+    //! one color for each bit set in colored, ordered by z
+    uint32_t* colors;
+    uint8_t capacity;
+    //! colors was allocated for this column alone instead of being part of the load pool
+    bool owned;
+};
+
+//! @brief Alternative map storage that keeps the runs of each column together
+//!
+//! Instead of one sorted block list per chunk, every column stores its solid
+//! runs as a bitmask and the colors of its surface blocks in z order, just
+//! like the spans of the VXL format do. Edits only move the colors of a single
+//! column and runs can be walked with bit operations. Blocks and colors are
+//! kept exactly like struct libvxl_map does. Limited to a depth of 64.
+struct libvxl_columns {
+    size_t width, height, depth;
+    struct libvxl_column* columns;
+    uint32_t* pool;
+};
+
+//! @brief Load a map from memory or create an empty one, see libvxl_create()
+//! @note Call libvxl_columns_free() afterwards even if this fails
+bool libvxl_columns_create(struct libvxl_columns* map, size_t w, size_t h, size_t d, const uintptr_t data,
+                           size_t len);
+
+//! @brief Free a map created by libvxl_columns_create()
+void libvxl_columns_free(struct libvxl_columns* map);
+
+//! @brief Same as libvxl_map_issolid()
+bool libvxl_columns_issolid(struct libvxl_columns* map, int x, int y, int z);
+
+//! @brief Same as libvxl_map_get()
+uint32_t libvxl_columns_get(struct libvxl_columns* map, int x, int y, int z);
+
+//! @brief Same as libvxl_map_set()
+void libvxl_columns_set(struct libvxl_columns* map, int x, int y, int z, uint32_t color);
+
+//! @brief Same as libvxl_map_setair()
+void libvxl_columns_setair(struct libvxl_columns* map, int x, int y, int z);
+
+//! @brief Same as libvxl_copy_chunk(), the copy is identical
+size_t libvxl_columns_copy_chunk(struct libvxl_columns* map, struct libvxl_chunk_copy* copy, size_t x, size_t y,
+                                 size_t border_min_x, size_t border_min_y, size_t border_max);
+
 /*
 MIT License
 
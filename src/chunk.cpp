@@ -23,6 +23,10 @@
 #include <stdlib.h>
 #include <float.h>
 #include <string.h>
+#include <assert.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include <common.hpp>
 #include <window.hpp>
@@ -36,112 +40,550 @@
 #include <chunk.hpp>
 #include <channel.hpp>
 #include <utils.hpp>
+#include <threadpool.hpp>
+#include <occlusion.hpp>
 
 struct chunk chunks[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
 
 HashTable chunk_block_queue;
-struct channel chunk_work_queue;
 struct channel chunk_result_queue;
 pthread_mutex_t chunk_block_queue_lock;
 
+// bytes of mesh data uploaded per frame, the remaining meshes wait for the next frames. A mesh larger than the budget
+// still gets a frame of its own
+#define CHUNK_UPLOAD_BUDGET (4 * 1024 * 1024)
+
+static struct chunk_upload_stats chunk_uploads;
+static float chunk_upload_worst;
+static float chunk_upload_window;
+
+// the minimap is written to this copy first, each row of chunks uploads the span of chunks that changed in a frame
+#define CHUNK_MINIMAP_SIZE (CHUNKS_PER_DIM * CHUNK_SIZE)
+
+static uint32_t chunk_minimap[CHUNK_MINIMAP_SIZE * CHUNK_MINIMAP_SIZE];
+static int chunk_minimap_start[CHUNKS_PER_DIM];
+static int chunk_minimap_end[CHUNKS_PER_DIM];
+
+// stats of the last full rebuild, see chunk_rebuild_all(). Results of jobs queued by an earlier one carry an older
+// generation and are not counted
+static int chunk_rebuild_pending = 0;
+static unsigned int chunk_rebuild_generation = 0;
+static int chunk_rebuild_count;
+static float chunk_rebuild_start;
+static size_t chunk_rebuild_copied;
+static float chunk_rebuild_meshing;
+static size_t chunk_rebuild_faces;
+static size_t chunk_rebuild_quads;
+
 struct chunk_work_packet {
     size_t chunk_x;
     size_t chunk_y;
     struct chunk* chunk;
+    uint8_t sections;
+    bool rebuild;
+    unsigned int generation;
+    float priority;
 };
 
+// chunks waiting to be meshed, at most one entry per chunk, kept sorted by chunk_work_rank() so that the most
+// important one is taken from the end
+static struct chunk_work_packet chunk_work_queue[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
+static size_t chunk_work_count = 0;
+static pthread_mutex_t chunk_work_lock;
+static struct threadpool_group chunk_work_group;
+
 struct chunk_result_packet {
     struct chunk* chunk;
     int max_height;
-    struct tesselator tesselator;
+    int solid_height;
+    // only the sections set in the mask were meshed
+    uint8_t sections;
+    struct tesselator tesselator[CHUNK_SECTIONS];
     uint32_t* minimap_data;
+    size_t copied_bytes;
+    float mesh_time;
+    size_t face_count;
+    bool rebuild;
+    unsigned int generation;
 };
 
+static size_t chunk_result_quads(struct chunk_result_packet* result) {
+    size_t quads = 0;
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        if(result->sections & (1 << s))
+            quads += result->tesselator[s].quad_count;
+
+    return quads;
+}
+
+static size_t chunk_result_bytes(struct chunk_result_packet* result) {
+    size_t bytes = 0;
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        if(result->sections & (1 << s))
+            bytes += tesselator_bytes(result->tesselator + s);
+
+    return bytes;
+}
+
 struct chunk_render_call {
     struct chunk* chunk;
     int mirror_x;
     int mirror_y;
+    int distance;
 };
 
 void chunk_init() {
     for(size_t x = 0; x < CHUNKS_PER_DIM; x++) {
         for(size_t y = 0; y < CHUNKS_PER_DIM; y++) {
             struct chunk* c = chunks + x + y * CHUNKS_PER_DIM;
+            for(int s = 0; s < CHUNK_SECTIONS; s++)
+                c->sections[s].created = false;
             c->created = false;
+            c->queued = false;
+            c->dirty = 0;
             c->max_height = 1;
+            c->solid_height = 0;
             c->x = x;
             c->y = y;
         }
     }
 
-    channel_create(&chunk_work_queue, sizeof(struct chunk_work_packet), CHUNKS_PER_DIM * CHUNKS_PER_DIM);
+    pthread_mutex_init(&chunk_work_lock, NULL);
+    threadpool_group_create(&chunk_work_group);
     channel_create(&chunk_result_queue, sizeof(struct chunk_result_packet), CHUNKS_PER_DIM * CHUNKS_PER_DIM);
-    ht_setup(&chunk_block_queue, sizeof(struct chunk*), sizeof(struct chunk_result_packet), 64);
+    ht_setup(&chunk_block_queue, sizeof(struct chunk*), sizeof(struct chunk_work_packet), 64);
 
     pthread_mutex_init(&chunk_block_queue_lock, NULL);
+}
+
+// the visibility pass first culls groups of CHUNK_GROUP² chunks, single chunks are only tested in groups that
+// intersect the frustum border
+#define CHUNK_GROUP 4
+#define CHUNK_GROUPS_PER_DIM (CHUNKS_PER_DIM / CHUNK_GROUP)
+
+// mirrored copies of the map are drawn at most one map size away from it
+#define CHUNK_VISIBLE_DIM (CHUNKS_PER_DIM * 3)
+#define CHUNK_VISIBLE_MAX (CHUNK_VISIBLE_DIM * CHUNK_VISIBLE_DIM)
+#define CHUNK_DISTANCE_BUCKETS 4096
+
+// candidate boxes in structure of arrays layout, each reaches from y = 0 up to max_y. Padded, so that
+// chunk_frustum_test4() may always load four of them
+struct chunk_boxes {
+    float min_x[CHUNK_VISIBLE_MAX + 3];
+    float min_z[CHUNK_VISIBLE_MAX + 3];
+    float max_x[CHUNK_VISIBLE_MAX + 3];
+    float max_y[CHUNK_VISIBLE_MAX + 3];
+    float max_z[CHUNK_VISIBLE_MAX + 3];
+    size_t count;
+};
+
+static struct chunk_boxes chunk_visible_groups;
+static struct chunk_boxes chunk_visible_candidates;
+static int chunk_visible_group_pos[CHUNK_VISIBLE_MAX][2];
+static struct chunk_render_call chunk_visible_tested[CHUNK_VISIBLE_MAX];
+static struct chunk_render_call chunk_visible_unsorted[CHUNK_VISIBLE_MAX];
+static struct chunk_render_call chunk_visible_calls[CHUNK_VISIBLE_MAX];
+static int chunk_visible_buckets[CHUNK_DISTANCE_BUCKETS + 1];
+
+static void chunk_boxes_add(struct chunk_boxes* b, float min_x, float min_z, float max_x, float max_y, float max_z) {
+    b->min_x[b->count] = min_x;
+    b->min_z[b->count] = min_z;
+    b->max_x[b->count] = max_x;
+    b->max_y[b->count] = max_y;
+    b->max_z[b->count] = max_z;
+    b->count++;
+}
+
+// tests the four boxes starting at index k against all frustum planes. Returns a mask of the boxes that are at
+// least partially inside, those completely inside are also set in *inside
+static int chunk_frustum_test4(struct chunk_boxes* b, size_t k, int* inside) {
+#ifdef __SSE__
+    __m128 zero = _mm_setzero_ps();
+    __m128 visible = _mm_cmpeq_ps(zero, zero);
+    __m128 contained = visible;
+
+    __m128 min_x = _mm_loadu_ps(b->min_x + k);
+    __m128 min_z = _mm_loadu_ps(b->min_z + k);
+    __m128 max_x = _mm_loadu_ps(b->max_x + k);
+    __m128 max_y = _mm_loadu_ps(b->max_y + k);
+    __m128 max_z = _mm_loadu_ps(b->max_z + k);
+
+    for(int p = 0; p < 6; p++) {
+        __m128 a = _mm_set1_ps(frustum[p][0]);
+        __m128 h = _mm_mul_ps(_mm_set1_ps(frustum[p][1]), max_y);
+        __m128 c = _mm_set1_ps(frustum[p][2]);
+        __m128 d = _mm_set1_ps(frustum[p][3]);
+
+        // the corner furthest along the plane normal decides whether a box is outside, the nearest one whether it
+        // is completely inside
+        __m128 far = _mm_add_ps(_mm_mul_ps(a, (frustum[p][0] > 0) ? max_x : min_x),
+                                _mm_add_ps(_mm_mul_ps(c, (frustum[p][2] > 0) ? max_z : min_z), d));
+        __m128 near = _mm_add_ps(_mm_mul_ps(a, (frustum[p][0] > 0) ? min_x : max_x),
+                                 _mm_add_ps(_mm_mul_ps(c, (frustum[p][2] > 0) ? min_z : max_z), d));
+
+        if(frustum[p][1] > 0)
+            far = _mm_add_ps(far, h);
+        else
+            near = _mm_add_ps(near, h);
 
-    int chunk_enabled_cores = minc(maxc(window_cpucores() / 2, 1), CHUNK_WORKERS_MAX);
-    log_info("%i cores enabled for chunk generation", chunk_enabled_cores);
+        visible = _mm_and_ps(visible, _mm_cmpgt_ps(far, zero));
+        contained = _mm_and_ps(contained, _mm_cmpgt_ps(near, zero));
+    }
 
-    pthread_t threads[chunk_enabled_cores];
+    *inside = _mm_movemask_ps(_mm_and_ps(visible, contained));
+    return _mm_movemask_ps(visible);
+#else
+    int visible = 0;
+    *inside = 0;
+
+    for(int j = 0; j < 4; j++) {
+        bool outside = false;
+        bool contained = true;
+
+        for(int p = 0; p < 6 && !outside; p++) {
+            float h = frustum[p][1] * b->max_y[k + j];
+            float far = frustum[p][0] * ((frustum[p][0] > 0) ? b->max_x[k + j] : b->min_x[k + j])
+                + frustum[p][2] * ((frustum[p][2] > 0) ? b->max_z[k + j] : b->min_z[k + j]) + frustum[p][3];
+            float near = frustum[p][0] * ((frustum[p][0] > 0) ? b->min_x[k + j] : b->max_x[k + j])
+                + frustum[p][2] * ((frustum[p][2] > 0) ? b->min_z[k + j] : b->max_z[k + j]) + frustum[p][3];
+
+            if(frustum[p][1] > 0)
+                far += h;
+            else
+                near += h;
+
+            outside = far <= 0;
+            contained = contained && near > 0;
+        }
 
-    for(size_t k = 0; k < chunk_enabled_cores; k++)
-        pthread_create(threads + k, NULL, chunk_generate, NULL);
+        if(!outside) {
+            visible |= 1 << j;
+            if(contained)
+                *inside |= 1 << j;
+        }
+    }
+
+    return visible;
+#endif
 }
 
-static int chunk_sort(const void* a, const void* b) {
-    struct chunk_render_call* aa = (struct chunk_render_call*)a;
-    struct chunk_render_call* bb = (struct chunk_render_call*)b;
-    return distance2D(aa->chunk->x * CHUNK_SIZE + CHUNK_SIZE / 2, aa->chunk->y * CHUNK_SIZE + CHUNK_SIZE / 2, camera_x,
-                      camera_z)
-        - distance2D(bb->chunk->x * CHUNK_SIZE + CHUNK_SIZE / 2, bb->chunk->y * CHUNK_SIZE + CHUNK_SIZE / 2, camera_x,
-                     camera_z);
+static int chunk_floor_div(int a, int b) {
+    return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+// collects all chunks in render distance and view, sorted front to back; x and y are chunk positions that may lie
+// outside of the map for the mirrored copies around it
+static size_t chunk_visible(struct chunk_render_call** calls) {
+    float reach = settings.render_distance + 1.414F * CHUNK_SIZE;
+    int overshoot = minc((int)(settings.render_distance + CHUNK_SIZE - 1) / CHUNK_SIZE + 1, CHUNKS_PER_DIM);
+
+    int x0 = maxc(-overshoot, (int)floor((camera_x - reach) / CHUNK_SIZE));
+    int x1 = minc(CHUNKS_PER_DIM + overshoot - 1, (int)floor((camera_x + reach) / CHUNK_SIZE));
+    int y0 = maxc(-overshoot, (int)floor((camera_z - reach) / CHUNK_SIZE));
+    int y1 = minc(CHUNKS_PER_DIM + overshoot - 1, (int)floor((camera_z + reach) / CHUNK_SIZE));
+
+    *calls = chunk_visible_calls;
+
+    if(x0 > x1 || y0 > y1)
+        return 0;
+
+    int group_height[CHUNK_GROUPS_PER_DIM * CHUNK_GROUPS_PER_DIM] = {0};
+
+    for(int y = 0; y < CHUNKS_PER_DIM; y++)
+        for(int x = 0; x < CHUNKS_PER_DIM; x++) {
+            int* h = group_height + x / CHUNK_GROUP + y / CHUNK_GROUP * CHUNK_GROUPS_PER_DIM;
+            *h = maxc(*h, chunks[x + y * CHUNKS_PER_DIM].max_height);
+        }
+
+    struct chunk_boxes* groups = &chunk_visible_groups;
+    groups->count = 0;
+
+    for(int gy = chunk_floor_div(y0, CHUNK_GROUP); gy <= chunk_floor_div(y1, CHUNK_GROUP); gy++) {
+        for(int gx = chunk_floor_div(x0, CHUNK_GROUP); gx <= chunk_floor_div(x1, CHUNK_GROUP); gx++) {
+            float min_x = gx * CHUNK_GROUP * CHUNK_SIZE;
+            float min_z = gy * CHUNK_GROUP * CHUNK_SIZE;
+            float max_x = min_x + CHUNK_GROUP * CHUNK_SIZE;
+            float max_z = min_z + CHUNK_GROUP * CHUNK_SIZE;
+
+            float dx = fmax(fmax(min_x - camera_x, camera_x - max_x), 0.0F);
+            float dz = fmax(fmax(min_z - camera_z, camera_z - max_z), 0.0F);
+
+            if(dx * dx + dz * dz > reach * reach)
+                continue;
+
+            uint32_t wrap_x = ((uint32_t)gx) % CHUNK_GROUPS_PER_DIM;
+            uint32_t wrap_y = ((uint32_t)gy) % CHUNK_GROUPS_PER_DIM;
+
+            chunk_visible_group_pos[groups->count][0] = gx;
+            chunk_visible_group_pos[groups->count][1] = gy;
+            chunk_boxes_add(groups, min_x, min_z, max_x, group_height[wrap_x + wrap_y * CHUNK_GROUPS_PER_DIM], max_z);
+        }
+    }
+
+    struct chunk_boxes* candidates = &chunk_visible_candidates;
+    candidates->count = 0;
+    size_t count = 0;
+
+    for(size_t k = 0; k < groups->count; k += 4) {
+        int inside;
+        int visible = chunk_frustum_test4(groups, k, &inside);
+
+        for(size_t j = 0; j < 4 && k + j < groups->count; j++) {
+            if(!(visible & (1 << j)))
+                continue;
+
+            int gx = chunk_visible_group_pos[k + j][0];
+            int gy = chunk_visible_group_pos[k + j][1];
+
+            for(int y = maxc(gy * CHUNK_GROUP, y0); y < minc((gy + 1) * CHUNK_GROUP, y1 + 1); y++) {
+                for(int x = maxc(gx * CHUNK_GROUP, x0); x < minc((gx + 1) * CHUNK_GROUP, x1 + 1); x++) {
+                    float dist = distance2D((x + 0.5F) * CHUNK_SIZE, (y + 0.5F) * CHUNK_SIZE, camera_x, camera_z);
+
+                    if(dist > reach * reach)
+                        continue;
+
+                    uint32_t tmp_x = ((uint32_t)x) % CHUNKS_PER_DIM;
+                    uint32_t tmp_y = ((uint32_t)y) % CHUNKS_PER_DIM;
+                    struct chunk* c = chunks + tmp_x + tmp_y * CHUNKS_PER_DIM;
+
+                    struct chunk_render_call call = {
+                        .chunk = c,
+                        .mirror_x = (x < 0) ? -1 : ((x >= CHUNKS_PER_DIM) ? 1 : 0),
+                        .mirror_y = (y < 0) ? -1 : ((y >= CHUNKS_PER_DIM) ? 1 : 0),
+                        .distance = minc((int)sqrt(dist), CHUNK_DISTANCE_BUCKETS - 1),
+                    };
+
+                    if(inside & (1 << j)) {
+                        chunk_visible_unsorted[count++] = call;
+                    } else {
+                        chunk_visible_tested[candidates->count] = call;
+                        chunk_boxes_add(candidates, x * CHUNK_SIZE, y * CHUNK_SIZE, (x + 1) * CHUNK_SIZE,
+                                        c->max_height, (y + 1) * CHUNK_SIZE);
+                    }
+                }
+            }
+        }
+    }
+
+    for(size_t k = 0; k < candidates->count; k += 4) {
+        int inside;
+        int visible = chunk_frustum_test4(candidates, k, &inside);
+
+        for(size_t j = 0; j < 4 && k + j < candidates->count; j++)
+            if(visible & (1 << j))
+                chunk_visible_unsorted[count++] = chunk_visible_tested[k + j];
+    }
+
+    // counting sort by distance in blocks, to draw those in front first
+    int buckets = minc((int)reach + 2, CHUNK_DISTANCE_BUCKETS);
+    memset(chunk_visible_buckets, 0, (buckets + 1) * sizeof(int));
+
+    for(size_t k = 0; k < count; k++)
+        chunk_visible_buckets[chunk_visible_unsorted[k].distance + 1]++;
+
+    for(int k = 1; k <= buckets; k++)
+        chunk_visible_buckets[k] += chunk_visible_buckets[k - 1];
+
+    for(size_t k = 0; k < count; k++)
+        chunk_visible_calls[chunk_visible_buckets[chunk_visible_unsorted[k].distance]++] = chunk_visible_unsorted[k];
+
+    return count;
+}
+
+static void chunk_render_mirror(int mirror_x, int mirror_y) {
+    mat4 model; matrix_load(model, matrix_model);
+    matrix_translate(model, mirror_x * map_size_x, 0.0F, mirror_y * map_size_z);
+    matrix_upload(matrix_view, model);
 }
 
 void chunk_render(struct chunk_render_call* c) {
     if(c->chunk->created) {
-        mat4 model; matrix_load(model, matrix_model);
-        matrix_translate(model, c->mirror_x * map_size_x, 0.0F, c->mirror_y * map_size_z);
-        matrix_upload(matrix_view, model);
+        chunk_render_mirror(c->mirror_x, c->mirror_y);
 
         // glPolygonMode(GL_FRONT, GL_LINE);
-        glx_displaylist_draw(&c->chunk->display_list, GLX_DISPLAYLIST_NORMAL);
+        for(int s = 0; s < CHUNK_SECTIONS; s++) {
+            struct chunk_section* section = c->chunk->sections + s;
+
+            if(section->created && !section->in_arena && section->display_list.size > 0)
+                glx_displaylist_draw(&section->display_list, GLX_DISPLAYLIST_NORMAL);
+        }
         // glPolygonMode(GL_FRONT, GL_FILL);
     }
 }
 
-void chunk_draw_visible() {
-    struct chunk_render_call chunks_draw[CHUNKS_PER_DIM * CHUNKS_PER_DIM * 2];
-    int index = 0;
+// chunks drawn with the same mirror offset share one model matrix, so each offset becomes a single multi-draw per
+// arena page; the unmirrored map comes first as it is closest, and draws keep their front to back order
+static void chunk_render_arena(struct chunk_render_call* calls, size_t count) {
+    int offsets[] = {0, -1, 1};
 
-    int overshoot = (settings.render_distance + CHUNK_SIZE - 1) / CHUNK_SIZE + 1;
+    glx_arena_begin();
 
-    // go through all possible chunks and store all in range and view
-    for(int y = -overshoot; y < CHUNKS_PER_DIM + overshoot; y++) {
-        for(int x = -overshoot; x < CHUNKS_PER_DIM + overshoot; x++) {
-            if(distance2D((x + 0.5F) * CHUNK_SIZE, (y + 0.5F) * CHUNK_SIZE, camera_x, camera_z)
-               <= pow(settings.render_distance + 1.414F * CHUNK_SIZE, 2)) {
-                uint32_t tmp_x = ((uint32_t)x) % CHUNKS_PER_DIM;
-                uint32_t tmp_y = ((uint32_t)y) % CHUNKS_PER_DIM;
+    for(int m = 0; m < 9; m++) {
+        int mirror_x = offsets[m % 3];
+        int mirror_y = offsets[m / 3];
+        bool queued = false;
 
-                struct chunk* c = chunks + tmp_x + tmp_y * CHUNKS_PER_DIM;
+        for(size_t k = 0; k < count; k++) {
+            struct chunk* c = calls[k].chunk;
 
-                if(camera_CubeInFrustum((x + 0.5F) * CHUNK_SIZE, 0.0F, (y + 0.5F) * CHUNK_SIZE, CHUNK_SIZE / 2,
-                                        c->max_height))
-                    chunks_draw[index++] = (struct chunk_render_call) {
-                        .chunk = c,
-                        .mirror_x = (x < 0) ? -1 : ((x >= CHUNKS_PER_DIM) ? 1 : 0),
-                        .mirror_y = (y < 0) ? -1 : ((y >= CHUNKS_PER_DIM) ? 1 : 0),
-                    };
+            if(c->created && calls[k].mirror_x == mirror_x && calls[k].mirror_y == mirror_y) {
+                for(int s = 0; s < CHUNK_SECTIONS; s++)
+                    if(c->sections[s].created && c->sections[s].in_arena)
+                        glx_arena_queue(&c->sections[s].arena);
+                queued = true;
             }
         }
+
+        if(queued) {
+            chunk_render_mirror(mirror_x, mirror_y);
+            glx_arena_draw();
+        }
     }
+}
 
-    // sort all chunks to draw those in front first
-    qsort(chunks_draw, index, sizeof(struct chunk_render_call), chunk_sort);
+// nearest chunks rasterized into the occlusion buffer, only their solid ground is used
+#define CHUNK_OCCLUDERS 96
+#define CHUNK_OCCLUDER_DISTANCE 160
+#define CHUNK_OCCLUDER_HEIGHT 2
+
+static struct occlusion_buffer chunk_occlusion;
+static struct occlusion_stats chunk_occlusion_last;
+
+static void chunk_call_box(struct chunk_render_call* call, float height, float* min, float* max) {
+    min[0] = (call->chunk->x + call->mirror_x * CHUNKS_PER_DIM) * CHUNK_SIZE;
+    min[1] = 0.0F;
+    min[2] = (call->chunk->y + call->mirror_y * CHUNKS_PER_DIM) * CHUNK_SIZE;
+    max[0] = min[0] + CHUNK_SIZE;
+    max[1] = height;
+    max[2] = min[2] + CHUNK_SIZE;
+}
 
-    for(int k = 0; k < index; k++)
-        chunk_render(chunks_draw + k);
+// removes chunks hidden behind the ground of nearer ones, the remaining calls stay sorted
+static size_t chunk_occlusion_cull(struct chunk_render_call* calls, size_t count, struct occlusion_stats* stats) {
+    double start = window_time_precise();
+
+    mat4 mvp;
+    matrix_load(mvp, matrix_model);
+    matrix_multiply(mvp, matrix_view);
+    matrix_multiply(mvp, matrix_projection);
+    occlusion_clear(&chunk_occlusion, mvp);
+
+    for(size_t k = 0; k < count && calls[k].distance <= CHUNK_OCCLUDER_DISTANCE
+        && chunk_occlusion.occluders < CHUNK_OCCLUDERS;
+        k++) {
+        if(calls[k].chunk->solid_height >= CHUNK_OCCLUDER_HEIGHT) {
+            float min[3], max[3];
+            chunk_call_box(calls + k, calls[k].chunk->solid_height, min, max);
+            occlusion_add_box(&chunk_occlusion, min, max);
+        }
+    }
+
+    occlusion_update_tiles(&chunk_occlusion);
+
+    size_t visible = 0;
+
+    for(size_t k = 0; k < count; k++) {
+        float min[3], max[3];
+        chunk_call_box(calls + k, calls[k].chunk->max_height, min, max);
+
+        if(occlusion_box_visible(&chunk_occlusion, min, max))
+            calls[visible++] = calls[k];
+    }
+
+    stats->tested = count;
+    stats->culled = count - visible;
+    stats->occluders = chunk_occlusion.occluders;
+    stats->time = window_time_precise() - start;
+
+    return visible;
+}
+
+void chunk_occlusion_stats(struct occlusion_stats* stats) {
+    *stats = chunk_occlusion_last;
+}
+
+void chunk_draw_visible() {
+    struct chunk_render_call* calls;
+    size_t count = chunk_visible(&calls);
+
+    if(settings.occlusion_culling)
+        count = chunk_occlusion_cull(calls, count, &chunk_occlusion_last);
+    else
+        chunk_occlusion_last = (struct occlusion_stats) {0};
+
+    if(glx_arena_enabled()) {
+        chunk_render_arena(calls, count);
+    } else {
+        for(size_t k = 0; k < count; k++)
+            chunk_render(calls + k);
+    }
+}
+
+// views per render distance, each one is culled several times to get measurable times
+#define CHUNK_BENCHMARK_VIEWS 256
+#define CHUNK_BENCHMARK_REPEAT 16
+
+void chunk_benchmark_visibility() {
+    float distances[] = {64.0F, 128.0F, 192.0F, 256.0F, 384.0F, 512.0F};
+    float render_distance = settings.render_distance;
+
+    // at eye height above the ground, where terrain hides the most
+    camera_x = map_size_x / 2.0F;
+    camera_z = map_size_z / 2.0F;
+    camera_y = map_height_at(camera_x, camera_z) + 3.0F;
+
+    for(size_t d = 0; d < sizeof(distances) / sizeof(*distances); d++) {
+        settings.render_distance = distances[d];
+
+        matrix_identity(matrix_projection);
+        matrix_perspective(matrix_projection, CAMERA_DEFAULT_FOV,
+                           ((float)settings.window_width) / ((float)settings.window_height), 0.1F,
+                           settings.render_distance + CHUNK_SIZE * 4.0F);
+        matrix_identity(matrix_model);
+
+        double elapsed = 0.0;
+        size_t visible = 0;
+        struct occlusion_stats occlusion = {0};
+
+        // turn around once while looking slightly down, then up
+        for(int k = 0; k < CHUNK_BENCHMARK_VIEWS; k++) {
+            camera_rot_x = k * 2.0F * PI / CHUNK_BENCHMARK_VIEWS;
+            camera_rot_y = PI / 2.0F + ((k & 1) ? 0.4F : -0.2F);
+
+            matrix_identity(matrix_view);
+            matrix_lookAt(matrix_view, camera_x, camera_y, camera_z, camera_x + sin(camera_rot_x) * sin(camera_rot_y),
+                          camera_y + cos(camera_rot_y), camera_z + cos(camera_rot_x) * sin(camera_rot_y), 0.0F, 1.0F,
+                          0.0F);
+            camera_ExtractFrustum();
+
+            double start = window_time_precise();
+            for(int r = 0; r < CHUNK_BENCHMARK_REPEAT; r++) {
+                struct chunk_render_call* calls;
+                visible += chunk_visible(&calls);
+            }
+            elapsed += window_time_precise() - start;
+
+            struct chunk_render_call* calls;
+            size_t count = chunk_visible(&calls);
+
+            struct occlusion_stats stats;
+            chunk_occlusion_cull(calls, count, &stats);
+            occlusion.culled += stats.culled;
+            occlusion.occluders += stats.occluders;
+            occlusion.time += stats.time;
+        }
+
+        size_t passes = CHUNK_BENCHMARK_VIEWS * CHUNK_BENCHMARK_REPEAT;
+        log_info("visibility at %3.0f blocks: %0.2fus per pass, %zu chunks visible", settings.render_distance,
+                 elapsed * 1000000.0 / passes, visible / passes);
+        log_info("  occlusion: %0.2fus per pass, %zu chunks culled by %zu occluders",
+                 occlusion.time * 1000000.0F / CHUNK_BENCHMARK_VIEWS, occlusion.culled / CHUNK_BENCHMARK_VIEWS,
+                 occlusion.occluders / CHUNK_BENCHMARK_VIEWS);
+    }
+
+    settings.render_distance = render_distance;
 }
 
 static __attribute__((always_inline)) inline bool solid_array_isair(struct libvxl_chunk_copy* blocks, uint32_t x,
@@ -168,59 +610,106 @@ static __attribute__((always_inline)) inline float solid_sunblock(struct libvxl_
     return (float)i / 127.0F;
 }
 
-void* chunk_generate(void* data) {
-    pthread_detach(pthread_self());
+// lowest height of air in any column of the chunk
+static int chunk_solid_height(struct libvxl_chunk_copy* blocks, size_t chunk_x, size_t chunk_y) {
+    int height = map_size_y;
 
-    while(1) {
-        struct chunk_work_packet work;
-        channel_await(&chunk_work_queue, &work);
+    for(size_t z = chunk_y; z < chunk_y + CHUNK_SIZE; z++) {
+        for(size_t x = chunk_x; x < chunk_x + CHUNK_SIZE; x++) {
+            int y = 0;
+            while(y < height && !solid_array_isair(blocks, x, y, z))
+                y++;
+            height = y;
+        }
+    }
 
-        if(!work.chunk)
-            break;
+    return height;
+}
 
-        struct chunk_result_packet result;
-        result.chunk = work.chunk;
-        result.minimap_data = (uint32_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(uint32_t));
-        tesselator_create(&result.tesselator, VERTEX_INT, 0);
+void chunk_generate(void* data) {
+    // each queued chunk has one task, but always build the best ranked chunk first
+    pthread_mutex_lock(&chunk_work_lock);
 
-        struct libvxl_chunk_copy blocks;
-        map_copy_blocks(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE);
+    if(!chunk_work_count) {
+        pthread_mutex_unlock(&chunk_work_lock);
+        return;
+    }
 
-        if(settings.greedy_meshing)
-            chunk_generate_greedy(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE, &result.tesselator,
-                                  &result.max_height);
+    struct chunk_work_packet work = chunk_work_queue[--chunk_work_count];
+    work.chunk->queued = false;
+    // take every section marked until now, later edits queue the chunk again
+    work.sections = work.chunk->dirty;
+    work.chunk->dirty = 0;
+
+    pthread_mutex_unlock(&chunk_work_lock);
+
+    // the fallback meshers don't know about sections, their whole mesh goes into the lowest one
+    bool sectioned = map_size_y == 64;
+
+    struct chunk_result_packet result;
+    result.chunk = work.chunk;
+    result.rebuild = work.rebuild;
+    result.generation = work.generation;
+    result.sections = sectioned ? work.sections : CHUNK_SECTIONS_ALL;
+    result.minimap_data = (uint32_t*) malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(uint32_t));
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        if(result.sections & (1 << s))
+            tesselator_create(result.tesselator + s, VERTEX_INT, 0);
+
+    struct libvxl_chunk_copy blocks;
+    result.copied_bytes = map_copy_blocks(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE,
+                                          CHUNK_COPY_BORDER_MIN_X,
+                                          CHUNK_COPY_BORDER_MIN_Z, CHUNK_COPY_BORDER_MAX);
+
+    float mesh_start = window_time();
+
+    if(sectioned && settings.greedy_meshing) {
+        chunk_generate_greedy_bitmask(&blocks, result.tesselator, &result.max_height, settings.ambient_occlusion,
+                                      result.sections, &result.face_count);
+    } else {
+        if(sectioned)
+            chunk_generate_bitmask(&blocks, result.tesselator, &result.max_height, settings.ambient_occlusion,
+                                   result.sections);
+        else if(settings.greedy_meshing)
+            chunk_generate_greedy(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE,
+                                  result.tesselator, &result.max_height);
         else
-            chunk_generate_naive(&blocks, &result.tesselator, &result.max_height, settings.ambient_occlusion);
+            chunk_generate_naive(&blocks, result.tesselator, &result.max_height, settings.ambient_occlusion);
 
-        // use the fact that libvxl orders libvxl_blocks by top-down coordinate first in its data structure
-        size_t chunk_x = work.chunk_x * CHUNK_SIZE;
-        size_t chunk_y = work.chunk_y * CHUNK_SIZE;
-        uint32_t last_position = 0;
-        for(int k = blocks.blocks_sorted_count - 1; k >= 0; k--) {
-            struct libvxl_block* blk = blocks.blocks_sorted + k;
+        result.face_count = chunk_result_quads(&result);
+    }
 
-            if(blk->position != last_position || k == blocks.blocks_sorted_count - 1) {
-                last_position = blk->position;
+    result.mesh_time = window_time() - mesh_start;
 
-                int x = key_getx(blk->position);
-                int z = key_gety(blk->position);
+    // use the fact that libvxl orders libvxl_blocks by top-down coordinate first in its data structure
+    size_t chunk_x = work.chunk_x * CHUNK_SIZE;
+    size_t chunk_y = work.chunk_y * CHUNK_SIZE;
+    result.solid_height = chunk_solid_height(&blocks, chunk_x, chunk_y);
 
-                uint32_t* out = result.minimap_data + (x - chunk_x + (z - chunk_y) * CHUNK_SIZE);
+    uint32_t last_position = 0;
+    for(int k = blocks.blocks_sorted_count - 1; k >= 0; k--) {
+        struct libvxl_block* blk = blocks.blocks_sorted + k;
 
-                if((x % 64) > 0 && (z % 64) > 0) {
-                    *out = rgb2bgr(blk->color) | 0xFF000000;
-                } else {
-                    *out = rgba(255, 255, 255, 255);
-                }
-            }
-        }
+        if(blk->position != last_position || k == blocks.blocks_sorted_count - 1) {
+            last_position = blk->position;
 
-        libvxl_copy_chunk_destroy(&blocks);
+            int x = key_getx(blk->position);
+            int z = key_gety(blk->position);
 
-        channel_put(&chunk_result_queue, &result);
+            uint32_t* out = result.minimap_data + (x - chunk_x + (z - chunk_y) * CHUNK_SIZE);
+
+            if((x % 64) > 0 && (z % 64) > 0) {
+                *out = rgb2bgr(blk->color) | 0xFF000000;
+            } else {
+                *out = rgba(255, 255, 255, 255);
+            }
+        }
     }
 
-    return NULL;
+    libvxl_copy_chunk_destroy(&blocks);
+
+    channel_put(&chunk_result_queue, &result);
 }
 
 void chunk_generate_greedy(struct libvxl_chunk_copy* blocks, size_t start_x, size_t start_z, struct tesselator* tess,
@@ -767,92 +1256,859 @@ void chunk_generate_naive(struct libvxl_chunk_copy* blocks, struct tesselator* t
     (*max_height)++;
 }
 
-void chunk_update_all() {
-    size_t drain = channel_size(&chunk_result_queue);
+#define CHUNK_MASK_WINDOW_X (CHUNK_SIZE + CHUNK_COPY_BORDER_MIN_X + CHUNK_COPY_BORDER_MAX)
+#define CHUNK_MASK_WINDOW_Z (CHUNK_SIZE + CHUNK_COPY_BORDER_MIN_Z + CHUNK_COPY_BORDER_MAX)
+
+// corner offsets of each cube face in the order the naive mesher emits them, each with the
+// offsets of the two side and one corner block that darken it in vertexAO()
+static const struct chunk_face {
+    enum tesselator_cube_face face;
+    float shade;
+    int8_t corners[4][3];
+    int8_t ao[4][3][3];
+} chunk_faces[6] = {
+    {CUBE_FACE_Z_N, 0.875F,
+     {{0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}},
+     {{{-1, 0, -1}, {0, -1, -1}, {-1, -1, -1}},
+      {{-1, 0, -1}, {0, 1, -1}, {-1, 1, -1}},
+      {{1, 0, -1}, {0, 1, -1}, {1, 1, -1}},
+      {{1, 0, -1}, {0, -1, -1}, {1, -1, -1}}}},
+    {CUBE_FACE_Z_P, 0.625F,
+     {{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}},
+     {{{-1, 0, 1}, {0, -1, 1}, {-1, -1, 1}},
+      {{1, 0, 1}, {0, -1, 1}, {1, -1, 1}},
+      {{1, 0, 1}, {0, 1, 1}, {1, 1, 1}},
+      {{-1, 0, 1}, {0, 1, 1}, {-1, 1, 1}}}},
+    {CUBE_FACE_X_N, 0.75F,
+     {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}},
+     {{{-1, -1, 0}, {-1, 0, -1}, {-1, -1, -1}},
+      {{-1, -1, 0}, {-1, 0, 1}, {-1, -1, 1}},
+      {{-1, 1, 0}, {-1, 0, 1}, {-1, 1, 1}},
+      {{-1, 1, 0}, {-1, 0, -1}, {-1, 1, -1}}}},
+    {CUBE_FACE_X_P, 0.75F,
+     {{1, 0, 0}, {1, 1, 0}, {1, 1, 1}, {1, 0, 1}},
+     {{{1, -1, 0}, {1, 0, -1}, {1, -1, -1}},
+      {{1, 1, 0}, {1, 0, -1}, {1, 1, -1}},
+      {{1, 1, 0}, {1, 0, 1}, {1, 1, 1}},
+      {{1, -1, 0}, {1, 0, 1}, {1, -1, 1}}}},
+    {CUBE_FACE_Y_P, 1.0F,
+     {{0, 1, 0}, {0, 1, 1}, {1, 1, 1}, {1, 1, 0}},
+     {{{-1, 1, 0}, {0, 1, -1}, {-1, 1, -1}},
+      {{-1, 1, 0}, {0, 1, 1}, {-1, 1, 1}},
+      {{1, 1, 0}, {0, 1, 1}, {1, 1, 1}},
+      {{1, 1, 0}, {0, 1, -1}, {1, 1, -1}}}},
+    {CUBE_FACE_Y_N, 0.5F,
+     {{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}},
+     {{{-1, -1, 0}, {0, -1, -1}, {-1, -1, -1}},
+      {{1, -1, 0}, {0, -1, -1}, {1, -1, -1}},
+      {{1, -1, 0}, {0, -1, 1}, {1, -1, 1}},
+      {{-1, -1, 0}, {0, -1, 1}, {-1, -1, 1}}}},
+};
+
+// x and z are relative to the column window, bit (map_size_y - 1 - y) of a column is set if y is solid
+static __attribute__((always_inline)) inline bool column_isair(uint64_t* columns, int x, int y, int z) {
+    if(y < 0)
+        return false;
+    if(y >= map_size_y)
+        return true;
+
+    return !((columns[x + z * CHUNK_MASK_WINDOW_X] >> (map_size_y - 1 - y)) & 1);
+}
+
+static void chunk_load_columns(struct libvxl_chunk_copy* blocks, uint64_t* columns) {
+    for(int z = 0; z < CHUNK_MASK_WINDOW_Z; z++)
+        for(int x = 0; x < CHUNK_MASK_WINDOW_X; x++)
+            columns[x + z * CHUNK_MASK_WINDOW_X] = libvxl_copy_chunk_column(
+                blocks, blocks->chunk_x + x - CHUNK_COPY_BORDER_MIN_X, blocks->chunk_y + z - CHUNK_COPY_BORDER_MIN_Z);
+}
+
+// bits of a column that belong to the given sections, see column_isair()
+static uint64_t chunk_section_bits(uint8_t sections) {
+    uint64_t bits = 0;
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        if(sections & (1 << s))
+            bits |= (((uint64_t)1 << CHUNK_SIZE) - 1) << (map_size_y - (s + 1) * CHUNK_SIZE);
+
+    return bits;
+}
+
+// find exposed faces of whole columns at once, in the same order as chunk_faces, limited to the blocks in mask
+static void chunk_exposed_faces(uint64_t* columns, uint64_t faces[6][CHUNK_SIZE * CHUNK_SIZE], uint64_t mask) {
+    for(int z = 0; z < CHUNK_SIZE; z++) {
+        for(int x = 0; x < CHUNK_SIZE; x++) {
+            uint64_t* c
+                = columns + (x + CHUNK_COPY_BORDER_MIN_X) + (z + CHUNK_COPY_BORDER_MIN_Z) * CHUNK_MASK_WINDOW_X;
+            uint64_t solid = *c & mask;
+            size_t k = x + z * CHUNK_SIZE;
+
+            faces[0][k] = solid & ~c[-CHUNK_MASK_WINDOW_X];
+            faces[1][k] = solid & ~c[CHUNK_MASK_WINDOW_X];
+            faces[2][k] = solid & ~c[-1];
+            faces[3][k] = solid & ~c[1];
+            faces[4][k] = solid & ~(*c << 1);
+            // the block below the lowest layer counts as solid
+            faces[5][k] = solid & ~(*c >> 1) & ~((uint64_t)1 << (map_size_y - 1));
+        }
+    }
+}
+
+// same as solid_sunblock()
+static float column_sunblock(uint64_t* columns, int x, int y, int z) {
+    int i = 127;
+
+    for(int d = 1, dec = 18; dec && y + d < map_size_y; d++, dec -= 2) {
+        if(!column_isair(columns, x, y + d, z - d))
+            i -= dec;
+    }
+
+    return (float)i / 127.0F;
+}
+
+static void chunk_face_colors(uint64_t* columns, const struct chunk_face* face, int x, int y, int z, int r, int g,
+                              int b, int ao, uint32_t* colors) {
+    for(int v = 0; v < 4; v++) {
+        if(ao) {
+            const int8_t(*o)[3] = face->ao[v];
+            float A = vertexAO(column_isair(columns, x + o[0][0], y + o[0][1], z + o[0][2]),
+                               column_isair(columns, x + o[1][0], y + o[1][1], z + o[1][2]),
+                               column_isair(columns, x + o[2][0], y + o[2][1], z + o[2][2]));
+
+            colors[v] = rgba(r * face->shade * A, g * face->shade * A, b * face->shade * A, 255);
+        } else {
+            colors[v] = rgba(r * face->shade, g * face->shade, b * face->shade, 255);
+        }
+    }
+}
+
+void chunk_generate_bitmask(struct libvxl_chunk_copy* blocks, struct tesselator* tess, int* max_height, int ao,
+                            uint8_t sections) {
+    assert(map_size_y == 64);
+
+    *max_height = 0;
+
+    uint64_t columns[CHUNK_MASK_WINDOW_X * CHUNK_MASK_WINDOW_Z];
+    uint64_t faces[6][CHUNK_SIZE * CHUNK_SIZE];
+
+    chunk_load_columns(blocks, columns);
+    chunk_exposed_faces(columns, faces, chunk_section_bits(sections));
+
+    for(size_t k = 0; k < blocks->blocks_sorted_count; k++) {
+        struct libvxl_block* blk = blocks->blocks_sorted + k;
+
+        int x = key_getx(blk->position);
+        int y = map_size_y - 1 - key_getz(blk->position);
+        int z = key_gety(blk->position);
+
+        *max_height = maxc(*max_height, y);
+
+        uint64_t bit = (uint64_t)1 << key_getz(blk->position);
+        size_t column = (x - blocks->chunk_x) + (z - blocks->chunk_y) * CHUNK_SIZE;
+
+        if(!((faces[0][column] | faces[1][column] | faces[2][column] | faces[3][column] | faces[4][column]
+              | faces[5][column])
+             & bit))
+            continue;
+
+        int wx = x - blocks->chunk_x + CHUNK_COPY_BORDER_MIN_X;
+        int wz = z - blocks->chunk_y + CHUNK_COPY_BORDER_MIN_Z;
+
+        float shade = column_sunblock(columns, wx, y, wz);
+
+        uint32_t col = blk->color;
+        int r = blue(col) * shade;
+        int g = green(col) * shade;
+        int b = red(col) * shade;
+
+        struct tesselator* t = tess + y / CHUNK_SIZE;
+
+        for(int f = 0; f < 6; f++) {
+            if(!(faces[f][column] & bit))
+                continue;
+
+            const struct chunk_face* face = chunk_faces + f;
+
+            if(ao) {
+                int16_t coords[12];
+                uint32_t colors[4];
+
+                chunk_face_colors(columns, face, wx, y, wz, r, g, b, ao, colors);
+
+                for(int v = 0; v < 4; v++) {
+                    coords[v * 3 + 0] = x + face->corners[v][0];
+                    coords[v * 3 + 1] = y + face->corners[v][1];
+                    coords[v * 3 + 2] = z + face->corners[v][2];
+                }
+
+                tesselator_addi(t, coords, colors, NULL);
+            } else {
+                tesselator_set_color(t, rgba(r * face->shade, g * face->shade, b * face->shade, 255));
+                tesselator_addi_cube_face(t, face->face, x, y, z);
+            }
+        }
+    }
+
+    (*max_height)++;
+}
+
+#ifdef TESSELATE_QUADS
+#define CHUNK_QUAD_VERTICES 4
+#endif
+
+#ifdef TESSELATE_TRIANGLES
+#define CHUNK_QUAD_VERTICES 6
+#endif
+
+// section chunk_generate_bitmask() puts a quad into, a face on top of a block lies one above the block itself
+static int chunk_quad_section(int16_t* v) {
+    int normal_y = (v[5] - v[2]) * (v[6] - v[0]) - (v[3] - v[0]) * (v[8] - v[2]);
+    int y = minc(v[1], minc(v[4], v[7]));
+
+    return (y - (normal_y > 0 ? 1 : 0)) / CHUNK_SIZE;
+}
+
+// both meshers emit the faces of a block in the same order, so every section must match the reference in order
+static bool chunk_mesh_equal(struct tesselator* reference, struct tesselator* sections) {
+    uint32_t next[CHUNK_SECTIONS] = {0};
+
+    for(uint32_t q = 0; q < reference->quad_count; q++) {
+        int16_t* v = (int16_t*)reference->vertices + q * CHUNK_QUAD_VERTICES * 3;
+        int s = chunk_quad_section(v);
+
+        if(s < 0 || s >= CHUNK_SECTIONS || next[s] >= sections[s].quad_count)
+            return false;
+
+        uint32_t k = next[s]++;
+
+        if(memcmp(v, (int16_t*)sections[s].vertices + k * CHUNK_QUAD_VERTICES * 3,
+                  sizeof(int16_t) * CHUNK_QUAD_VERTICES * 3)
+           || memcmp(reference->colors + q * CHUNK_QUAD_VERTICES, sections[s].colors + k * CHUNK_QUAD_VERTICES,
+                     sizeof(uint32_t) * CHUNK_QUAD_VERTICES))
+            return false;
+    }
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        if(next[s] != sections[s].quad_count)
+            return false;
+
+    return true;
+}
+
+void chunk_benchmark_mesh() {
+    if(map_size_y != 64) {
+        log_error("the bitmask mesher needs a map height of 64, this map is %i high", map_size_y);
+        return;
+    }
+
+    for(int ao = 0; ao < 2; ao++) {
+        double naive_time = 0.0;
+        double bitmask_time = 0.0;
+        size_t quads = 0;
+        bool identical = true;
+
+        for(int z = 0; z < map_size_z / CHUNK_SIZE; z++) {
+            for(int x = 0; x < map_size_x / CHUNK_SIZE; x++) {
+                struct libvxl_chunk_copy blocks;
+                map_copy_blocks(&blocks, x * CHUNK_SIZE, z * CHUNK_SIZE, CHUNK_COPY_BORDER_MIN_X,
+                                CHUNK_COPY_BORDER_MIN_Z, CHUNK_COPY_BORDER_MAX);
+
+                struct tesselator reference;
+                struct tesselator sections[CHUNK_SECTIONS];
+                tesselator_create(&reference, VERTEX_INT, 0);
+                for(int s = 0; s < CHUNK_SECTIONS; s++)
+                    tesselator_create(sections + s, VERTEX_INT, 0);
+
+                int reference_height, height;
+
+                double start = window_time_precise();
+                chunk_generate_naive(&blocks, &reference, &reference_height, ao);
+                naive_time += window_time_precise() - start;
+
+                start = window_time_precise();
+                chunk_generate_bitmask(&blocks, sections, &height, ao, CHUNK_SECTIONS_ALL);
+                bitmask_time += window_time_precise() - start;
+
+                if(height != reference_height || !chunk_mesh_equal(&reference, sections)) {
+                    if(identical)
+                        log_warn("chunk %i, %i is meshed differently", x, z);
+                    identical = false;
+                }
 
-    if(drain > 0) {
-        struct chunk_result_packet results[drain];
+                quads += reference.quad_count;
 
-        for(size_t k = 0; k < drain; k++) {
-            channel_await(&chunk_result_queue, results + k);
-            results[k].chunk->updated = false;
+                tesselator_free(&reference);
+                for(int s = 0; s < CHUNK_SECTIONS; s++)
+                    tesselator_free(sections + s);
+                libvxl_copy_chunk_destroy(&blocks);
+            }
         }
 
+        log_info("meshing %s AO: %0.1fms naive, %0.1fms bitmask, %zu quads, %s", ao ? "with" : "without",
+                 naive_time * 1000.0, bitmask_time * 1000.0, quads, identical ? "identical" : "OUTPUT DIFFERS");
+    }
+}
+
+// merges the faces of one slice, bit u of rows[v] marks a face whose vertex colors are at cells[u * su + v * sv]
+static void chunk_merge_slice(struct tesselator* tess, struct libvxl_chunk_copy* blocks, int f, int slice,
+                              uint64_t* rows, int size_u, int size_v, uint32_t (*cells)[4], size_t su, size_t sv) {
+    const struct chunk_face* face = chunk_faces + f;
+
+    for(int v = 0; v < size_v; v++) {
+        while(rows[v]) {
+            int u = __builtin_ctzll(rows[v]);
+            uint32_t* c = cells[u * su + v * sv];
+
+            int len_u = 1;
+            int len_v = 1;
+
+            // faces with shading that differs between corners would look different when stretched
+            if(c[0] == c[1] && c[1] == c[2] && c[2] == c[3]) {
+                while(u + len_u < size_u && ((rows[v] >> (u + len_u)) & 1)
+                      && !memcmp(cells[(u + len_u) * su + v * sv], c, sizeof(uint32_t) * 4))
+                    len_u++;
+
+                uint64_t run = ((len_u == 64) ? ~(uint64_t)0 : (((uint64_t)1 << len_u) - 1)) << u;
+
+                while(v + len_v < size_v && (rows[v + len_v] & run) == run) {
+                    int a = 0;
+                    while(a < len_u && !memcmp(cells[(u + a) * su + (v + len_v) * sv], c, sizeof(uint32_t) * 4))
+                        a++;
+
+                    if(a < len_u)
+                        break;
+
+                    len_v++;
+                }
+
+                for(int a = 0; a < len_v; a++)
+                    rows[v + a] &= ~run;
+            } else {
+                rows[v] &= ~((uint64_t)1 << u);
+            }
+
+            int x, y, z, sx, sy, sz;
+
+            switch(f) {
+                case 0:
+                case 1:
+                    x = blocks->chunk_x + v, sx = len_v;
+                    y = map_size_y - u - len_u, sy = len_u;
+                    z = blocks->chunk_y + slice, sz = 1;
+                    break;
+                case 2:
+                case 3:
+                    x = blocks->chunk_x + slice, sx = 1;
+                    y = map_size_y - u - len_u, sy = len_u;
+                    z = blocks->chunk_y + v, sz = len_v;
+                    break;
+                default:
+                    x = blocks->chunk_x + u, sx = len_u;
+                    y = map_size_y - 1 - slice, sy = 1;
+                    z = blocks->chunk_y + v, sz = len_v;
+                    break;
+            }
+
+            int16_t coords[12];
+            for(int k = 0; k < 4; k++) {
+                coords[k * 3 + 0] = x + face->corners[k][0] * sx;
+                coords[k * 3 + 1] = y + face->corners[k][1] * sy;
+                coords[k * 3 + 2] = z + face->corners[k][2] * sz;
+            }
+
+            tesselator_addi(tess, coords, c, NULL);
+        }
+    }
+}
+
+// face colors of the greedy bitmask mesher, about 1.5 MB allocated once by each worker thread
+static __thread uint32_t (*chunk_cells)[4] = NULL;
+
+void chunk_generate_greedy_bitmask(struct libvxl_chunk_copy* blocks, struct tesselator* tess, int* max_height,
+                                   int ao, uint8_t sections, size_t* face_count) {
+    assert(map_size_y == 64);
+
+    *max_height = 0;
+    *face_count = 0;
+
+    uint64_t columns[CHUNK_MASK_WINDOW_X * CHUNK_MASK_WINDOW_Z];
+    uint64_t faces[6][CHUNK_SIZE * CHUNK_SIZE];
+    uint64_t visible[6][CHUNK_SIZE * CHUNK_SIZE];
+
+    chunk_load_columns(blocks, columns);
+    chunk_exposed_faces(columns, faces, chunk_section_bits(sections));
+    memset(visible, 0, sizeof(visible));
+
+    // vertex colors of every visible face, indexed like visible[][] with one entry per bit,
+    // only entries of visible bits are read so the buffer is reused without clearing
+    if(!chunk_cells) {
+        chunk_cells = (uint32_t(*)[4]) malloc(6 * CHUNK_SIZE * CHUNK_SIZE * 64 * sizeof(uint32_t[4]));
+        CHECK_ALLOCATION_ERROR(chunk_cells)
+    }
+
+    uint32_t(*cells)[4] = chunk_cells;
+
+    for(size_t k = 0; k < blocks->blocks_sorted_count; k++) {
+        struct libvxl_block* blk = blocks->blocks_sorted + k;
+
+        int x = key_getx(blk->position);
+        int y = map_size_y - 1 - key_getz(blk->position);
+        int z = key_gety(blk->position);
+
+        *max_height = maxc(*max_height, y);
+
+        uint64_t bit = (uint64_t)1 << key_getz(blk->position);
+        size_t column = (x - blocks->chunk_x) + (z - blocks->chunk_y) * CHUNK_SIZE;
+
+        if(!((faces[0][column] | faces[1][column] | faces[2][column] | faces[3][column] | faces[4][column]
+              | faces[5][column])
+             & bit))
+            continue;
+
+        int wx = x - blocks->chunk_x + CHUNK_COPY_BORDER_MIN_X;
+        int wz = z - blocks->chunk_y + CHUNK_COPY_BORDER_MIN_Z;
+
+        float shade = column_sunblock(columns, wx, y, wz);
+
+        uint32_t col = blk->color;
+        int r = blue(col) * shade;
+        int g = green(col) * shade;
+        int b = red(col) * shade;
+
+        for(int f = 0; f < 6; f++) {
+            if(faces[f][column] & bit) {
+                visible[f][column] |= bit;
+                chunk_face_colors(columns, chunk_faces + f, wx, y, wz, r, g, b, ao,
+                                  cells[(f * CHUNK_SIZE * CHUNK_SIZE + column) * 64 + key_getz(blk->position)]);
+                (*face_count)++;
+            }
+        }
+    }
+
+    uint64_t rows[CHUNK_SIZE];
+
+    for(int f = 0; f < 6; f++) {
+        uint32_t(*face_cells)[4] = cells + f * CHUNK_SIZE * CHUNK_SIZE * 64;
+
+        if(f < 4) {
+            // sides: rows run along the column's height, one slice per z (faces 0, 1) or x (faces 2, 3),
+            // merged separately for each section so that no quad crosses into another one
+            for(int s = 0; s < CHUNK_SECTIONS; s++) {
+                if(!(sections & (1 << s)))
+                    continue;
+
+                uint64_t section_bits = chunk_section_bits(1 << s);
+
+                for(int slice = 0; slice < CHUNK_SIZE; slice++) {
+                    for(int v = 0; v < CHUNK_SIZE; v++)
+                        rows[v] = visible[f][(f < 2) ? (v + slice * CHUNK_SIZE) : (slice + v * CHUNK_SIZE)]
+                            & section_bits;
+
+                    if(f < 2)
+                        chunk_merge_slice(tess + s, blocks, f, slice, rows, 64, CHUNK_SIZE,
+                                          face_cells + slice * CHUNK_SIZE * 64, 1, 64);
+                    else
+                        chunk_merge_slice(tess + s, blocks, f, slice, rows, 64, CHUNK_SIZE, face_cells + slice * 64,
+                                          1, CHUNK_SIZE * 64);
+                }
+            }
+        } else {
+            // top and bottom: one slice per layer, rows run along x
+            for(int slice = 0; slice < 64; slice++) {
+                bool any = false;
+
+                for(int v = 0; v < CHUNK_SIZE; v++) {
+                    rows[v] = 0;
+                    for(int u = 0; u < CHUNK_SIZE; u++)
+                        rows[v] |= ((visible[f][u + v * CHUNK_SIZE] >> slice) & 1) << u;
+                    any |= rows[v] != 0;
+                }
+
+                if(any)
+                    chunk_merge_slice(tess + (map_size_y - 1 - slice) / CHUNK_SIZE, blocks, f, slice, rows,
+                                      CHUNK_SIZE, CHUNK_SIZE, face_cells + slice, 64, CHUNK_SIZE * 64);
+            }
+        }
+    }
+
+    (*max_height)++;
+}
+
+// caller must hold chunk_work_lock, a chunk that is already queued keeps its entry and only gains sections
+static void chunk_work_put(struct chunk* c, uint8_t sections, bool rebuild) {
+    c->dirty |= sections;
+
+    if(c->queued)
+        return;
+
+    c->queued = true;
+    chunk_work_queue[chunk_work_count++] = (struct chunk_work_packet) {
+        .chunk_x = (size_t)c->x,
+        .chunk_y = (size_t)c->y,
+        .chunk = c,
+        .sections = 0,
+        .rebuild = rebuild,
+        .generation = chunk_rebuild_generation,
+        .priority = 0.0F,
+    };
+
+    threadpool_submit(THREADPOOL_NORMAL, chunk_generate, NULL, 0, &chunk_work_group);
+}
+
+static int chunk_work_cmp(const void* a, const void* b) {
+    float pa = ((struct chunk_work_packet*)a)->priority;
+    float pb = ((struct chunk_work_packet*)b)->priority;
+    return (pa < pb) - (pa > pb);
+}
+
+// squared distance of the chunk's nearest copy to the camera, increased if it is not in view
+static float chunk_work_priority(struct chunk* c) {
+    float x = (c->x + 0.5F) * CHUNK_SIZE;
+    float z = (c->y + 0.5F) * CHUNK_SIZE;
+
+    if(x - camera_x > map_size_x / 2)
+        x -= map_size_x;
+    if(x - camera_x < -map_size_x / 2)
+        x += map_size_x;
+    if(z - camera_z > map_size_z / 2)
+        z -= map_size_z;
+    if(z - camera_z < -map_size_z / 2)
+        z += map_size_z;
+
+    float d = distance2D(x, z, camera_x, camera_z);
+
+    if(camera_CubeInFrustum(x, 0.0F, z, CHUNK_SIZE / 2, c->created ? c->max_height : map_size_y))
+        return d;
+
+    return d * 4.0F;
+}
+
+// sort pending work by the current camera position
+static void chunk_work_rank() {
+    pthread_mutex_lock(&chunk_work_lock);
+
+    for(size_t k = 0; k < chunk_work_count; k++)
+        chunk_work_queue[k].priority = chunk_work_priority(chunk_work_queue[k].chunk);
+
+    qsort(chunk_work_queue, chunk_work_count, sizeof(struct chunk_work_packet), chunk_work_cmp);
+
+    pthread_mutex_unlock(&chunk_work_lock);
+}
+
+static void chunk_result_rebuilt(struct chunk_result_packet* result) {
+    if(!result->rebuild || result->generation != chunk_rebuild_generation || chunk_rebuild_pending <= 0)
+        return;
+
+    chunk_rebuild_copied += result->copied_bytes;
+    chunk_rebuild_meshing += result->mesh_time;
+    chunk_rebuild_faces += result->face_count;
+    chunk_rebuild_quads += chunk_result_quads(result);
+    chunk_rebuild_count++;
+
+    if(--chunk_rebuild_pending == 0) {
+        log_info("Rebuilt all chunks in %0.1fms (%0.3fms meshing per chunk), %zu KiB of map data copied",
+                 (window_time() - chunk_rebuild_start) * 1000.0F, chunk_rebuild_meshing * 1000.0F / chunk_rebuild_count,
+                 chunk_rebuild_copied / 1024);
+        log_info("%zu faces merged into %zu quads (%zu per chunk, %0.1f%% fewer)", chunk_rebuild_faces,
+                 chunk_rebuild_quads, chunk_rebuild_quads / chunk_rebuild_count,
+                 chunk_rebuild_faces ? 100.0F - chunk_rebuild_quads * 100.0F / chunk_rebuild_faces : 0.0F);
+    }
+}
+
+static void chunk_section_destroy(struct chunk_section* section) {
+    if(section->in_arena)
+        glx_arena_free(&section->arena);
+    else
+        glx_displaylist_destroy(&section->display_list);
+
+    section->created = false;
+}
+
+static void chunk_minimap_mark(int row, int start, int end) {
+    if(chunk_minimap_start[row] < chunk_minimap_end[row]) {
+        start = minc(start, chunk_minimap_start[row]);
+        end = maxc(end, chunk_minimap_end[row]);
+    }
+
+    chunk_minimap_start[row] = start;
+    chunk_minimap_end[row] = end;
+}
+
+static void chunk_minimap_put(struct chunk* c, uint32_t* data) {
+    int x = c->x * CHUNK_SIZE;
+    int y = c->y * CHUNK_SIZE;
+
+    for(int k = 0; k < CHUNK_SIZE; k++)
+        memcpy(chunk_minimap + x + (y + k) * CHUNK_MINIMAP_SIZE, data + k * CHUNK_SIZE, CHUNK_SIZE * sizeof(uint32_t));
+
+    chunk_minimap_mark(c->y, c->x, c->x + 1);
+}
+
+// the texture always shows the copy, so a new map never uploads tiles left over from the previous one
+static void chunk_minimap_clear() {
+    memset(chunk_minimap, 0, sizeof(chunk_minimap));
+
+    for(int row = 0; row < CHUNKS_PER_DIM; row++)
+        chunk_minimap_mark(row, 0, CHUNKS_PER_DIM);
+}
+
+static void chunk_minimap_flush() {
+    bool bound = false;
+
+    for(int row = 0; row < CHUNKS_PER_DIM;) {
+        int start = chunk_minimap_start[row];
+        int end = chunk_minimap_end[row];
+
+        if(start >= end) {
+            row++;
+            continue;
+        }
+
+        // following rows with the same span are uploaded together
+        int rows = 1;
+        while(row + rows < CHUNKS_PER_DIM && chunk_minimap_start[row + rows] == start
+              && chunk_minimap_end[row + rows] == end)
+            rows++;
+
+        if(!bound) {
+            glBindTexture(GL_TEXTURE_2D, texture_minimap.texture_id);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, CHUNK_MINIMAP_SIZE);
+            bound = true;
+        }
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, start * CHUNK_SIZE, row * CHUNK_SIZE, (end - start) * CHUNK_SIZE,
+                        rows * CHUNK_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+                        chunk_minimap + start * CHUNK_SIZE + row * CHUNK_SIZE * CHUNK_MINIMAP_SIZE);
+
+        for(int k = 0; k < rows; k++)
+            chunk_minimap_start[row + k] = chunk_minimap_end[row + k] = 0;
+
+        row += rows;
+    }
+
+    if(bound) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
+
+void chunk_update_all() {
+    chunk_work_rank();
+
+    double start = window_time_precise();
+    size_t available = channel_size(&chunk_result_queue);
+    size_t drain = 0;
+    size_t bytes = 0;
+
+    if(available > 0) {
+        struct chunk_result_packet* results
+            = (struct chunk_result_packet*)malloc(available * sizeof(struct chunk_result_packet));
+        CHECK_ALLOCATION_ERROR(results)
+
+        while(drain < available && bytes < CHUNK_UPLOAD_BUDGET) {
+            channel_await(&chunk_result_queue, results + drain);
+            results[drain].chunk->updated = 0;
+            chunk_result_rebuilt(results + drain);
+            bytes += chunk_result_bytes(results + drain);
+            drain++;
+        }
+
+        bool staged = glx_arena_enabled() && glx_arena_upload_begin(bytes);
+
         auto result = results + drain - 1;
 
+        // newest results first, each section is only uploaded from the latest mesh that contains it
         for(size_t k = 0; k < drain; k++, result--) {
-            if(!result->chunk->updated) {
-                result->chunk->updated = true;
+            struct chunk* c = result->chunk;
 
-                if(!result->chunk->created) {
-                    glx_displaylist_create(&result->chunk->display_list, true, false);
-                    result->chunk->created = true;
-                }
+            if(!c->updated) {
+                c->created = true;
+                c->max_height = result->max_height;
+                c->solid_height = result->solid_height;
+                chunk_minimap_put(c, result->minimap_data);
+            }
+
+            for(int s = 0; s < CHUNK_SECTIONS; s++) {
+                if(!(result->sections & (1 << s)))
+                    continue;
+
+                if(!(c->updated & (1 << s))) {
+                    struct chunk_section* section = c->sections + s;
+                    bool arena = glx_arena_enabled();
+
+                    if(section->created && section->in_arena != arena)
+                        chunk_section_destroy(section);
+
+                    if(arena) {
+                        if(!section->created) {
+                            glx_arena_create(&section->arena);
+                            section->created = true;
+                            section->in_arena = true;
+                        }
 
-                result->chunk->max_height = result->max_height;
+                        tesselator_arena(result->tesselator + s, &section->arena);
+                    } else {
+                        if(!section->created) {
+                            glx_displaylist_create(&section->display_list, true, false);
+                            section->created = true;
+                            section->in_arena = false;
+                        }
 
-                tesselator_glx(&result->tesselator, &result->chunk->display_list);
+                        tesselator_glx(result->tesselator + s, &section->display_list);
+                    }
+                }
 
-                glBindTexture(GL_TEXTURE_2D, texture_minimap.texture_id);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, result->chunk->x * CHUNK_SIZE, result->chunk->y * CHUNK_SIZE,
-                                CHUNK_SIZE, CHUNK_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, result->minimap_data);
-                glBindTexture(GL_TEXTURE_2D, 0);
+                tesselator_free(result->tesselator + s);
             }
 
-            tesselator_free(&result->tesselator);
+            c->updated |= result->sections;
             free(result->minimap_data);
         }
+
+        free(results);
+
+        if(staged && !glx_arena_upload_end()) {
+            log_warn("Terrain upload was lost by the driver, rebuilding all chunks");
+            chunk_rebuild_all();
+        }
+
+        chunk_minimap_flush();
+    }
+
+    float now = window_time();
+    float time = window_time_precise() - start;
+
+    if(now - chunk_upload_window >= 1.0F) {
+        chunk_uploads.worst = chunk_upload_worst;
+        chunk_upload_worst = 0.0F;
+        chunk_upload_window = now;
+    }
+
+    chunk_upload_worst = fmax(chunk_upload_worst, time);
+    chunk_uploads.meshes = drain;
+    chunk_uploads.bytes = bytes;
+    chunk_uploads.pending = channel_size(&chunk_result_queue);
+    chunk_uploads.time = time;
+}
+
+void chunk_upload_stats(struct chunk_upload_stats* stats) {
+    *stats = chunk_uploads;
+}
+
+// blocks until every queued chunk is meshed
+void chunk_wait() {
+    threadpool_wait(&chunk_work_group);
+}
+
+// takes all finished meshes like chunk_update_all(), but only counts them, there is no GL context to upload to
+void chunk_update_headless(struct chunk_mesh_stats* stats) {
+    size_t drain = channel_size(&chunk_result_queue);
+
+    for(size_t k = 0; k < drain; k++) {
+        struct chunk_result_packet result;
+        channel_await(&chunk_result_queue, &result);
+        chunk_result_rebuilt(&result);
+
+        result.chunk->created = true;
+        result.chunk->max_height = result.max_height;
+        result.chunk->solid_height = result.solid_height;
+
+        stats->meshes++;
+        stats->quads += chunk_result_quads(&result);
+        stats->mesh_time += result.mesh_time;
+
+        for(int s = 0; s < CHUNK_SECTIONS; s++)
+            if(result.sections & (1 << s))
+                tesselator_free(result.tesselator + s);
+        free(result.minimap_data);
     }
 }
 
 void chunk_rebuild_all() {
-    channel_clear(&chunk_work_queue);
+    pthread_mutex_lock(&chunk_work_lock);
 
-    for(int k = CHUNKS_PER_DIM / 2; k >= 0; k--) {
-        for(int i = k; i < CHUNKS_PER_DIM - k; i++) {
-            struct chunk* build[] = {
-                chunks + i + k * CHUNKS_PER_DIM,
-                chunks + i + (CHUNKS_PER_DIM - k - 1) * CHUNKS_PER_DIM,
-                chunks + k + i * CHUNKS_PER_DIM,
-                chunks + (CHUNKS_PER_DIM - k - 1) + i * CHUNKS_PER_DIM,
-            };
+    for(size_t k = 0; k < chunk_work_count; k++)
+        chunk_work_queue[k].chunk->queued = false;
+    chunk_work_count = 0;
 
-            chunk_work_packet result;
+    for(size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++)
+        chunks[k].dirty = 0;
 
-            for (size_t j = 0; j < sizeof(build) / sizeof(*build); j++) {
-                result.chunk = build[j];
-                result.chunk_x = build[j]->x;
-                result.chunk_y = build[j]->y;
+    chunk_rebuild_generation++;
+    chunk_rebuild_pending = 0;
+    chunk_rebuild_start = window_time();
+    chunk_rebuild_copied = 0;
+    chunk_rebuild_meshing = 0.0F;
+    chunk_rebuild_count = 0;
+    chunk_rebuild_faces = 0;
+    chunk_rebuild_quads = 0;
 
-                channel_put(&chunk_work_queue, &result);
-            }
-        }
+    chunk_minimap_clear();
+
+    for(size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++) {
+        chunk_work_put(chunks + k, CHUNK_SECTIONS_ALL, true);
+        chunk_rebuild_pending++;
     }
+
+    pthread_mutex_unlock(&chunk_work_lock);
+
+    chunk_work_rank();
 }
 
-void chunk_block_update(int x, int y, int z) {
-    struct chunk* c = chunks + (x / CHUNK_SIZE) + (z / CHUNK_SIZE) * CHUNKS_PER_DIM;
+// sections of a chunk whose mesh depends on a block at height y
+uint8_t chunk_block_sections(int y) {
+    // a block shades up to CHUNK_COPY_BORDER_MIN_Z blocks below it and the faces of its direct neighbours
+    int lowest = maxc(y - CHUNK_COPY_BORDER_MIN_Z, 0) / CHUNK_SIZE;
+    int highest = minc(minc(y + 1, map_size_y - 1) / CHUNK_SIZE, CHUNK_SECTIONS - 1);
+
+    uint8_t sections = 0;
+    for(int s = lowest; s <= highest; s++)
+        sections |= 1 << s;
+
+    return sections;
+}
 
+// sections[k] are the sections of chunks[k] that changed, they are remeshed on the next chunk_queue_blocks()
+void chunk_block_update(const uint8_t* sections) {
     pthread_mutex_lock(&chunk_block_queue_lock);
 
-    chunk_work_packet result;
-    result.chunk = c;
-    result.chunk_x = c->x;
-    result.chunk_y = c->y;
+    for(size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++) {
+        if(!sections[k])
+            continue;
+
+        struct chunk* c = chunks + k;
+        struct chunk_work_packet* pending = (struct chunk_work_packet*)ht_lookup(&chunk_block_queue, &c);
+
+        if(pending) {
+            pending->sections |= sections[k];
+        } else {
+            chunk_work_packet result;
+            result.chunk = c;
+            result.chunk_x = c->x;
+            result.chunk_y = c->y;
+            result.sections = sections[k];
+            result.rebuild = false;
+
+            ht_insert(&chunk_block_queue, &c, &result);
+        }
+    }
 
-    ht_insert(&chunk_block_queue, &c, &result);
     pthread_mutex_unlock(&chunk_block_queue_lock);
 }
 
 static bool iterate_chunk_updates(void* key, void* value, void* user) {
-    channel_put(&chunk_work_queue, value);
+    struct chunk_work_packet* work = (struct chunk_work_packet*)value;
+    chunk_work_put(work->chunk, work->sections, false);
 
     return true;
 }
 
 void chunk_queue_blocks() {
     pthread_mutex_lock(&chunk_block_queue_lock);
+    pthread_mutex_lock(&chunk_work_lock);
     ht_iterate(&chunk_block_queue, NULL, iterate_chunk_updates);
+    pthread_mutex_unlock(&chunk_work_lock);
     ht_clear(&chunk_block_queue);
     pthread_mutex_unlock(&chunk_block_queue_lock);
+
+    chunk_work_rank();
 }
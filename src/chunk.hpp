@@ -27,28 +27,78 @@
 #include <glx.hpp>
 #include <tesselator.hpp>
 #include <libvxl.hpp>
+#include <occlusion.hpp>
 
 #define CHUNK_SIZE 16
 #define CHUNKS_PER_DIM (512 / CHUNK_SIZE)
 
-extern struct chunk {
+// chunks are split vertically into sections of CHUNK_SIZE³ blocks, which are meshed and uploaded separately
+#define CHUNK_SECTIONS (64 / CHUNK_SIZE)
+#define CHUNK_SECTIONS_ALL ((1 << CHUNK_SECTIONS) - 1)
+
+// columns around a chunk its mesh depends on: sunblock looks up to 9 blocks towards -z,
+// everything else only at direct neighbours
+#define CHUNK_COPY_BORDER_MIN_X 1
+#define CHUNK_COPY_BORDER_MIN_Z 9
+#define CHUNK_COPY_BORDER_MAX 1
+
+// sections live in the shared terrain arena, unless legacy display lists are in use
+struct chunk_section {
     struct glx_displaylist display_list;
+    struct glx_arena_range arena;
+    bool created;
+    // the renderer can be switched at runtime, a section is only drawn by the one it was created for
+    bool in_arena;
+};
+
+extern struct chunk {
+    struct chunk_section sections[CHUNK_SECTIONS];
     int max_height;
-    bool updated;
+    // every block below this height is solid, the terrain hides everything behind it
+    int solid_height;
+    uint8_t updated;
+    uint8_t dirty;
     bool created;
+    bool queued;
     int x, y;
 } chunks[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
 
-#define CHUNK_WORKERS_MAX 16
+struct chunk_mesh_stats {
+    size_t meshes;
+    size_t quads;
+    float mesh_time;
+};
+
+// mesh uploads of the last frame
+struct chunk_upload_stats {
+    size_t meshes;
+    size_t bytes;
+    // finished meshes left for the next frames
+    size_t pending;
+    float time;
+    // longest upload of a frame during the previous second
+    float worst;
+};
 
 void chunk_init(void);
 
-void chunk_block_update(int x, int y, int z);
+uint8_t chunk_block_sections(int y);
+void chunk_block_update(const uint8_t* sections);
 void chunk_update_all(void);
-void* chunk_generate(void* data);
+void chunk_upload_stats(struct chunk_upload_stats* stats);
+void chunk_update_headless(struct chunk_mesh_stats* stats);
+void chunk_wait(void);
+void chunk_generate(void* data);
 void chunk_generate_greedy(struct libvxl_chunk_copy* blocks, size_t start_x, size_t start_z, struct tesselator* tess,
                            int* max_height);
 void chunk_generate_naive(struct libvxl_chunk_copy* blocks, struct tesselator* tess, int* max_height, int ao);
+void chunk_generate_bitmask(struct libvxl_chunk_copy* blocks, struct tesselator* tess, int* max_height, int ao,
+                            uint8_t sections);
+void chunk_generate_greedy_bitmask(struct libvxl_chunk_copy* blocks, struct tesselator* tess, int* max_height,
+                                   int ao, uint8_t sections, size_t* face_count);
 void chunk_rebuild_all(void);
 void chunk_draw_visible(void);
+void chunk_benchmark_visibility(void);
+void chunk_benchmark_mesh(void);
+void chunk_occlusion_stats(struct occlusion_stats* stats);
 void chunk_queue_blocks();
@@ -85,6 +85,11 @@ void config_save() {
     config_setf("client", "camera_fov", settings.camera_fov);
     config_seti("client", "hold_down_sights", settings.hold_down_sights);
     config_seti("client", "chat_shadow", settings.chat_shadow);
+    config_seti("client", "network_telemetry", settings.network_telemetry);
+    config_seti("client", "network_capture", settings.network_capture);
+    config_seti("client", "send_rate", settings.send_rate);
+    config_seti("client", "packed_vertices", settings.packed_vertices);
+    config_seti("client", "occlusion_culling", settings.occlusion_culling);
 
     for (const auto & key: config_keys)
         if (strlen(key.name) > 0)
@@ -150,6 +155,16 @@ static int config_read_key(void* user, const char* section, const char* name, co
             settings.hold_down_sights = atoi(value);
         } else if(!strcmp(name, "chat_shadow")) {
             settings.chat_shadow = atoi(value);
+        } else if(!strcmp(name, "network_telemetry")) {
+            settings.network_telemetry = atoi(value);
+        } else if(!strcmp(name, "network_capture")) {
+            settings.network_capture = atoi(value);
+        } else if(!strcmp(name, "send_rate")) {
+            settings.send_rate = atoi(value);
+        } else if(!strcmp(name, "packed_vertices")) {
+            settings.packed_vertices = atoi(value);
+        } else if(!strcmp(name, "occlusion_culling")) {
+            settings.occlusion_culling = atoi(value);
         }
     }
     if(!strcmp(section, "controls")) {
@@ -397,6 +412,18 @@ void config_reload() {
         "Force Displaylist", "Enable this on buggy drivers",
     };
 
+    config_setting packed_vertices {
+        &settings_tmp.packed_vertices,
+        CONFIG_TYPE_INT, 0, 1,
+        "Packed vertices", "Smaller terrain, needs shaders",
+    };
+
+    config_setting occlusion_culling {
+        &settings_tmp.occlusion_culling,
+        CONFIG_TYPE_INT, 0, 1,
+        "Occlusion culling", "Skip terrain hidden by hills",
+    };
+
     config_setting smooth_fog {
         &settings_tmp.smooth_fog,
         CONFIG_TYPE_INT, 0, 1,
@@ -406,7 +433,7 @@ void config_reload() {
     config_setting ambient_occlusion {
         &settings_tmp.ambient_occlusion,
         CONFIG_TYPE_INT, 0, 1,
-        "Ambient occlusion", "(won't work with greedy mesh)",
+        "Ambient occlusion", "Darken corners between blocks",
     };
 
     config_setting show_fps {
@@ -434,6 +461,8 @@ void config_reload() {
     config_settings.push_back(hold_down_sights);
     config_settings.push_back(greedy_meshing);
     config_settings.push_back(force_displaylist);
+    config_settings.push_back(packed_vertices);
+    config_settings.push_back(occlusion_culling);
     config_settings.push_back(smooth_fog);
     config_settings.push_back(ambient_occlusion);
     config_settings.push_back(show_fps);
@@ -51,6 +51,11 @@ extern struct RENDER_OPTIONS {
     float camera_fov;
     int hold_down_sights;
     int chat_shadow;
+    int network_telemetry;
+    int network_capture;
+    int send_rate;
+    int packed_vertices;
+    int occlusion_culling;
 } settings, settings_tmp;
 
 struct config_key_pair {
@@ -29,6 +29,10 @@
 #include <log.hpp>
 #include <file.hpp>
 
+#ifndef OS_WINDOWS
+#include <sys/mman.h>
+#endif
+
 struct fhandle {
     void* internal;
     int type;
@@ -102,6 +106,50 @@ unsigned char* file_load(const char* name) {
     return data;
 }
 
+// maps a file read-only into memory, where mmap is not available it is read instead
+void* file_map(const char* name, size_t* size) {
+#ifdef OS_WINDOWS
+    FILE* f = fopen(name, "rb");
+    if(!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    void* data = malloc(*size);
+    CHECK_ALLOCATION_ERROR(data)
+    fseek(f, 0, SEEK_SET);
+    fread(data, *size, 1, f);
+    fclose(f);
+    return data;
+#else
+    int fd = open(name, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return data;
+#endif
+}
+
+void file_unmap(void* data, size_t size) {
+#ifdef OS_WINDOWS
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
 void* file_open(const char* name, const char* mode) {
     return fopen(name, mode);
 }
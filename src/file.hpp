@@ -19,6 +19,8 @@
     along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
+
 void* file_open(const char* name, const char* mode);
 void file_printf(void* file, const char* fmt, ...);
 void file_close(void* file);
@@ -27,6 +29,8 @@ int file_dir_exists(const char* path);
 int file_dir_create(const char* path);
 int file_exists(const char* name);
 unsigned char* file_load(const char* name);
+void* file_map(const char* name, size_t* size);
+void file_unmap(void* data, size_t size);
 float buffer_readf(unsigned char* buffer, int index);
 unsigned int buffer_read32(unsigned char* buffer, int index);
 unsigned short buffer_read16(unsigned char* buffer, int index);
@@ -18,6 +18,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <common.hpp>
@@ -26,6 +27,8 @@
 #include <map.hpp>
 #include <matrix.hpp>
 #include <texture.hpp>
+#include <window.hpp>
+#include <tesselator.hpp>
 #include <glx.hpp>
 
 // for future opengl-es abstraction layer
@@ -59,7 +62,7 @@ int glx_shader(const char* vertex, const char* fragment) {
     int program = glCreateProgram();
     if(vertex)
         glAttachShader(program, v);
-    if(vertex)
+    if(fragment)
         glAttachShader(program, f);
     glLinkProgram(program);
     return program;
@@ -68,6 +71,8 @@ int glx_shader(const char* vertex, const char* fragment) {
 void glx_displaylist_create(struct glx_displaylist* x, bool has_color, bool has_normal) {
     x->has_color = has_color;
     x->has_normal = has_normal;
+    x->legacy = 0;
+    x->modern = 0;
 
     if(!glx_version || settings.force_displaylist) {
         x->legacy = glGenLists(1);
@@ -78,13 +83,15 @@ void glx_displaylist_create(struct glx_displaylist* x, bool has_color, bool has_
     x->buffer_size = 0;
 }
 
+// deletes whatever was created, the setting may have changed since
 void glx_displaylist_destroy(struct glx_displaylist* x) {
-    if (!glx_version || settings.force_displaylist) glDeleteLists(x->legacy, 1);
-    else glDeleteBuffers(1, &x->modern);
+    if(x->legacy)
+        glDeleteLists(x->legacy, 1);
+    if(x->modern)
+        glDeleteBuffers(1, &x->modern);
 }
 
 void glx_displaylist_update(struct glx_displaylist* x, size_t size, int type, void* color, void* vertex, void* normal) {
-    int grow_buffer = size > x->buffer_size;
     x->buffer_size = maxc(x->buffer_size, size);
     x->size = size;
 
@@ -124,9 +131,8 @@ void glx_displaylist_update(struct glx_displaylist* x, size_t size, int type, vo
 
         glBindBuffer(GL_ARRAY_BUFFER, x->modern);
 
-        if(grow_buffer) {
-            glBufferData(GL_ARRAY_BUFFER, x->size * (len_vertex + len_color + len_normal), NULL, GL_STATIC_DRAW);
-        }
+        // always a fresh store, the old one may still be in use by frames the GPU has not finished yet
+        glBufferData(GL_ARRAY_BUFFER, x->buffer_size * (len_vertex + len_color + len_normal), NULL, GL_STATIC_DRAW);
 
         glBufferSubData(GL_ARRAY_BUFFER, 0, x->size * len_vertex, vertex);
 
@@ -183,6 +189,524 @@ void glx_displaylist_draw(struct glx_displaylist* x, int type) {
     }
 }
 
+// a plain page is one buffer holding GLX_ARENA_PAGE_VERTICES vertex positions followed by as many colors, so a range
+// addresses both with the same first vertex; packed pages hold interleaved 8 byte vertices instead
+#define GLX_ARENA_VERTEX_LEN (sizeof(GLshort) * 3)
+#define GLX_ARENA_COLOR_LEN (sizeof(GLubyte) * 4)
+#define GLX_ARENA_PACKED_LEN (sizeof(GLushort) * 2 + sizeof(GLubyte) * 4)
+
+// terrain meshes are built by the tesselator, which emits either quads or triangles
+#ifdef TESSELATE_TRIANGLES
+#define GLX_ARENA_PRIMITIVE GL_TRIANGLES
+#else
+#define GLX_ARENA_PRIMITIVE GL_QUADS
+#endif
+
+// quads per range the shared index buffer covers, 16 bit indices are enough for any chunk section
+#define GLX_ARENA_INDEXED_QUADS (65536 / 4)
+
+struct glx_arena_block {
+    uint32_t first;
+    uint32_t size;
+};
+
+struct glx_arena_page {
+    uint32_t buffer;
+    bool packed;
+    // free ranges, sorted by first vertex and never adjacent to each other
+    struct glx_arena_block* blocks;
+    size_t block_count;
+    size_t block_space;
+    // draws collected since the last glx_arena_draw()
+    GLint* firsts;
+    GLsizei* counts;
+    GLsizei* index_counts;
+    const void** index_offsets;
+    size_t queued;
+    size_t queue_space;
+};
+
+static struct glx_arena_page* glx_arena_pages = NULL;
+static size_t glx_arena_page_count = 0;
+static size_t glx_arena_used = 0;
+static size_t glx_arena_used_bytes = 0;
+static size_t glx_arena_ranges = 0;
+static size_t glx_arena_meshes, glx_arena_meshes_last;
+static size_t glx_arena_draws, glx_arena_draws_last;
+
+static size_t glx_arena_uploads, glx_arena_uploaded;
+static size_t glx_arena_upload_bytes;
+static float glx_arena_upload_rate;
+static float glx_arena_upload_start;
+
+// packed vertices: x and z as unsigned shorts, then red, green, blue and y as bytes. Terrain is always opaque, so
+// the alpha channel is free to carry the height
+static const char* glx_arena_vertex_shader = "#version 120\n"
+                                             "attribute vec2 packed_xz;\n"
+                                             "attribute vec4 packed_color;\n"
+                                             "void main() {\n"
+                                             "    vec4 eye = gl_ModelViewMatrix\n"
+                                             "        * vec4(packed_xz.x, packed_color.a * 255.0, packed_xz.y, 1.0);\n"
+                                             "    gl_Position = gl_ProjectionMatrix * eye;\n"
+                                             "    gl_FrontColor = vec4(packed_color.rgb, 1.0);\n"
+                                             "    gl_TexCoord[1] = gl_TextureMatrix[1]\n"
+                                             "        * vec4(dot(eye, gl_EyePlaneS[1]), dot(eye, gl_EyePlaneT[1]), 0.0, 1.0);\n"
+                                             "}\n";
+
+static int glx_arena_program = 0;
+static bool glx_arena_program_failed = false;
+static uint32_t glx_arena_index_buffer = 0;
+static bool glx_arena_indexed = false;
+
+static uint8_t* glx_arena_scratch = NULL;
+static size_t glx_arena_scratch_size = 0;
+
+// while an upload batch is open, mesh data goes to a staging buffer and is copied into the pages on the GPU, the CPU
+// never writes to a page the frames still in flight draw from. Two staging buffers take turns and each one is
+// orphaned before it is mapped, so mapping never waits for the copies of earlier frames
+#define GLX_ARENA_STAGING_BUFFERS 2
+
+struct glx_arena_copy {
+    uint32_t buffer;
+    size_t source;
+    size_t target;
+    size_t length;
+};
+
+static uint32_t glx_arena_staging[GLX_ARENA_STAGING_BUFFERS];
+static int glx_arena_staging_next = 0;
+static uint8_t* glx_arena_staging_data = NULL;
+static size_t glx_arena_staging_size = 0;
+static size_t glx_arena_staging_used = 0;
+
+static struct glx_arena_copy* glx_arena_copies = NULL;
+static size_t glx_arena_copy_count = 0;
+static size_t glx_arena_copy_space = 0;
+
+// only a vertex shader is attached, fragments still go through the fixed function pipeline including the fog
+// texture on unit 1; smooth fog relies on fixed function lighting and keeps using plain vertices
+static bool glx_arena_packed() {
+    if(!settings.packed_vertices || settings.smooth_fog || glx_arena_program_failed)
+        return false;
+
+    if(!glx_arena_program) {
+        int program = glx_shader(glx_arena_vertex_shader, NULL);
+        glBindAttribLocation(program, 0, "packed_xz");
+        glBindAttribLocation(program, 1, "packed_color");
+        glLinkProgram(program);
+
+        int linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+        if(!linked) {
+            log_warn("Packed vertex shader unavailable, terrain uses plain vertices");
+            glDeleteProgram(program);
+            glx_arena_program_failed = true;
+            return false;
+        }
+
+        glx_arena_program = program;
+#ifdef TESSELATE_QUADS
+        glx_arena_indexed = GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+#endif
+
+        if(glx_arena_indexed) {
+            GLushort* indices = (GLushort*)malloc(GLX_ARENA_INDEXED_QUADS * 6 * sizeof(GLushort));
+            CHECK_ALLOCATION_ERROR(indices)
+
+            for(int k = 0; k < GLX_ARENA_INDEXED_QUADS; k++) {
+                GLushort* quad = indices + k * 6;
+                quad[0] = k * 4 + 0;
+                quad[1] = k * 4 + 1;
+                quad[2] = k * 4 + 2;
+                quad[3] = k * 4 + 0;
+                quad[4] = k * 4 + 2;
+                quad[5] = k * 4 + 3;
+            }
+
+            glGenBuffers(1, &glx_arena_index_buffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glx_arena_index_buffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLX_ARENA_INDEXED_QUADS * 6 * sizeof(GLushort), indices,
+                         GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            free(indices);
+        }
+
+        log_info("Packed terrain vertices enabled, %s draws", glx_arena_indexed ? "indexed" : "direct");
+    }
+
+    return true;
+}
+
+static size_t glx_arena_vertex_size(bool packed) {
+    return packed ? GLX_ARENA_PACKED_LEN : (GLX_ARENA_VERTEX_LEN + GLX_ARENA_COLOR_LEN);
+}
+
+static void glx_arena_block_insert(struct glx_arena_page* p, size_t index, uint32_t first, uint32_t size) {
+    if(p->block_count == p->block_space) {
+        p->block_space = maxc(p->block_space * 2, 16);
+        p->blocks = (struct glx_arena_block*)realloc(p->blocks, p->block_space * sizeof(struct glx_arena_block));
+        CHECK_ALLOCATION_ERROR(p->blocks)
+    }
+
+    memmove(p->blocks + index + 1, p->blocks + index, (p->block_count - index) * sizeof(struct glx_arena_block));
+    p->blocks[index] = (struct glx_arena_block) {.first = first, .size = size};
+    p->block_count++;
+}
+
+static void glx_arena_block_remove(struct glx_arena_page* p, size_t index) {
+    p->block_count--;
+    memmove(p->blocks + index, p->blocks + index + 1, (p->block_count - index) * sizeof(struct glx_arena_block));
+}
+
+// returns a range to the free list of its page, coalescing it with free neighbours
+static void glx_arena_release(struct glx_arena_page* p, uint32_t first, uint32_t size) {
+    size_t k = 0;
+    while(k < p->block_count && p->blocks[k].first < first)
+        k++;
+
+    bool merge_prev = k > 0 && p->blocks[k - 1].first + p->blocks[k - 1].size == first;
+    bool merge_next = k < p->block_count && first + size == p->blocks[k].first;
+
+    if(merge_prev && merge_next) {
+        p->blocks[k - 1].size += size + p->blocks[k].size;
+        glx_arena_block_remove(p, k);
+    } else if(merge_prev) {
+        p->blocks[k - 1].size += size;
+    } else if(merge_next) {
+        p->blocks[k].first = first;
+        p->blocks[k].size += size;
+    } else {
+        glx_arena_block_insert(p, k, first, size);
+    }
+}
+
+// first fit, which keeps small meshes packed towards the start of a page
+static bool glx_arena_take(struct glx_arena_page* p, uint32_t size, uint32_t* first) {
+    for(size_t k = 0; k < p->block_count; k++) {
+        if(p->blocks[k].size >= size) {
+            *first = p->blocks[k].first;
+            p->blocks[k].first += size;
+            p->blocks[k].size -= size;
+
+            if(!p->blocks[k].size)
+                glx_arena_block_remove(p, k);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void glx_arena_page_create(bool packed) {
+    glx_arena_pages = (struct glx_arena_page*)realloc(glx_arena_pages,
+                                                      (glx_arena_page_count + 1) * sizeof(struct glx_arena_page));
+    CHECK_ALLOCATION_ERROR(glx_arena_pages)
+
+    struct glx_arena_page* p = glx_arena_pages + glx_arena_page_count++;
+    *p = (struct glx_arena_page) {0};
+    p->packed = packed;
+
+    glGenBuffers(1, &p->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, p->buffer);
+    glBufferData(GL_ARRAY_BUFFER, GLX_ARENA_PAGE_VERTICES * glx_arena_vertex_size(packed), NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glx_arena_block_insert(p, 0, 0, GLX_ARENA_PAGE_VERTICES);
+}
+
+bool glx_arena_enabled() {
+    return glx_version && !settings.force_displaylist;
+}
+
+void glx_arena_create(struct glx_arena_range* r) {
+    r->page = -1;
+    r->first = 0;
+    r->size = 0;
+    r->capacity = 0;
+}
+
+void glx_arena_free(struct glx_arena_range* r) {
+    if(r->page >= 0) {
+        struct glx_arena_page* p = glx_arena_pages + r->page;
+        glx_arena_release(p, r->first, r->capacity);
+        glx_arena_used -= r->capacity;
+        glx_arena_used_bytes -= r->capacity * glx_arena_vertex_size(p->packed);
+        glx_arena_ranges--;
+    }
+
+    glx_arena_create(r);
+}
+
+// writes to a page, through the staging buffer if an upload batch is open and directly otherwise
+static void glx_arena_write(struct glx_arena_page* p, size_t offset, size_t length, const void* data) {
+    if(glx_arena_staging_data && glx_arena_staging_used + length <= glx_arena_staging_size) {
+        if(glx_arena_copy_count == glx_arena_copy_space) {
+            glx_arena_copy_space = maxc(glx_arena_copy_space * 2, 64);
+            glx_arena_copies = (struct glx_arena_copy*)realloc(glx_arena_copies,
+                                                               glx_arena_copy_space * sizeof(struct glx_arena_copy));
+            CHECK_ALLOCATION_ERROR(glx_arena_copies)
+        }
+
+        memcpy(glx_arena_staging_data + glx_arena_staging_used, data, length);
+        glx_arena_copies[glx_arena_copy_count++] = (struct glx_arena_copy) {
+            .buffer = p->buffer,
+            .source = glx_arena_staging_used,
+            .target = offset,
+            .length = length,
+        };
+        glx_arena_staging_used += length;
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, p->buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, length, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glx_arena_upload_bytes += length;
+}
+
+void glx_arena_update(struct glx_arena_range* r, size_t size, void* color, void* vertex) {
+    uint32_t capacity = (size + GLX_ARENA_ALIGN - 1) / GLX_ARENA_ALIGN * GLX_ARENA_ALIGN;
+    bool packed = glx_arena_packed() && (!glx_arena_indexed || size <= GLX_ARENA_INDEXED_QUADS * 4);
+
+    if(!size || size > GLX_ARENA_PAGE_VERTICES || capacity > r->capacity
+       || (r->page >= 0 && glx_arena_pages[r->page].packed != packed)) {
+        glx_arena_free(r);
+    } else if(capacity < r->capacity) {
+        // shrink in place, the tail goes back to the free list
+        glx_arena_release(glx_arena_pages + r->page, r->first + capacity, r->capacity - capacity);
+        glx_arena_used -= r->capacity - capacity;
+        glx_arena_used_bytes -= (r->capacity - capacity) * glx_arena_vertex_size(packed);
+        r->capacity = capacity;
+    }
+
+    if(!size)
+        return;
+
+    if(size > GLX_ARENA_PAGE_VERTICES) {
+        log_error("Mesh of %zu vertices does not fit into an arena page", size);
+        return;
+    }
+
+    if(r->page < 0) {
+        for(size_t k = 0; k < glx_arena_page_count && r->page < 0; k++)
+            if(glx_arena_pages[k].packed == packed && glx_arena_take(glx_arena_pages + k, capacity, &r->first))
+                r->page = k;
+
+        if(r->page < 0) {
+            glx_arena_page_create(packed);
+            r->page = glx_arena_page_count - 1;
+            glx_arena_take(glx_arena_pages + r->page, capacity, &r->first);
+        }
+
+        r->capacity = capacity;
+        glx_arena_used += capacity;
+        glx_arena_used_bytes += capacity * glx_arena_vertex_size(packed);
+        glx_arena_ranges++;
+    }
+
+    r->size = size;
+
+    struct glx_arena_page* p = glx_arena_pages + r->page;
+
+    if(packed) {
+        size_t len = size * GLX_ARENA_PACKED_LEN;
+
+        if(len > glx_arena_scratch_size) {
+            glx_arena_scratch_size = len;
+            glx_arena_scratch = (uint8_t*)realloc(glx_arena_scratch, glx_arena_scratch_size);
+            CHECK_ALLOCATION_ERROR(glx_arena_scratch)
+        }
+
+        int16_t* positions = (int16_t*)vertex;
+        uint32_t* colors = (uint32_t*)color;
+
+        for(size_t k = 0; k < size; k++) {
+            uint16_t xz[2] = {(uint16_t)positions[k * 3 + 0], (uint16_t)positions[k * 3 + 2]};
+            uint32_t rgby = (colors[k] & 0xFFFFFF) | ((uint32_t)(uint8_t)positions[k * 3 + 1] << 24);
+            memcpy(glx_arena_scratch + k * GLX_ARENA_PACKED_LEN, xz, sizeof(xz));
+            memcpy(glx_arena_scratch + k * GLX_ARENA_PACKED_LEN + sizeof(xz), &rgby, sizeof(rgby));
+        }
+
+        glx_arena_write(p, r->first * GLX_ARENA_PACKED_LEN, len, glx_arena_scratch);
+    } else {
+        glx_arena_write(p, r->first * GLX_ARENA_VERTEX_LEN, size * GLX_ARENA_VERTEX_LEN, vertex);
+        glx_arena_write(p, GLX_ARENA_PAGE_VERTICES * GLX_ARENA_VERTEX_LEN + r->first * GLX_ARENA_COLOR_LEN,
+                        size * GLX_ARENA_COLOR_LEN, color);
+    }
+
+    glx_arena_uploads++;
+}
+
+// opens a batch for meshes of up to the given size as plain vertices, returns false if they will be uploaded directly
+bool glx_arena_upload_begin(size_t bytes) {
+    if(!bytes || !(GLEW_VERSION_3_1 || GLEW_ARB_copy_buffer))
+        return false;
+
+    if(!glx_arena_staging[0])
+        glGenBuffers(GLX_ARENA_STAGING_BUFFERS, glx_arena_staging);
+
+    glx_arena_staging_size = bytes;
+    glx_arena_staging_used = 0;
+    glx_arena_copy_count = 0;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, glx_arena_staging[glx_arena_staging_next]);
+    glBufferData(GL_COPY_READ_BUFFER, glx_arena_staging_size, NULL, GL_STREAM_DRAW);
+    glx_arena_staging_data = (uint8_t*)glMapBuffer(GL_COPY_READ_BUFFER, GL_WRITE_ONLY);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    return glx_arena_staging_data != NULL;
+}
+
+// copies everything written since glx_arena_upload_begin() into the pages, in the order it was written. Returns false
+// if the driver lost the staging buffer while it was mapped, the meshes of the batch need to be uploaded again then
+bool glx_arena_upload_end() {
+    if(!glx_arena_staging_data)
+        return true;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, glx_arena_staging[glx_arena_staging_next]);
+    bool intact = glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glx_arena_staging_data = NULL;
+
+    if(intact) {
+        for(size_t k = 0; k < glx_arena_copy_count; k++) {
+            struct glx_arena_copy* c = glx_arena_copies + k;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, c->buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, c->source, c->target, c->length);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glx_arena_staging_next = (glx_arena_staging_next + 1) % GLX_ARENA_STAGING_BUFFERS;
+    glx_arena_copy_count = 0;
+
+    return intact;
+}
+
+void glx_arena_begin() {
+    glx_arena_meshes_last = glx_arena_meshes;
+    glx_arena_draws_last = glx_arena_draws;
+    glx_arena_meshes = 0;
+    glx_arena_draws = 0;
+
+    float now = window_time();
+
+    if(now - glx_arena_upload_start >= 1.0F) {
+        glx_arena_upload_rate = glx_arena_upload_bytes / (now - glx_arena_upload_start);
+        glx_arena_uploaded += glx_arena_upload_bytes;
+        glx_arena_upload_bytes = 0;
+        glx_arena_upload_start = now;
+    }
+}
+
+void glx_arena_queue(struct glx_arena_range* r) {
+    if(r->page < 0 || !r->size)
+        return;
+
+    struct glx_arena_page* p = glx_arena_pages + r->page;
+
+    if(p->queued == p->queue_space) {
+        size_t space = maxc(p->queue_space * 2, 256);
+        p->firsts = (GLint*)realloc(p->firsts, space * sizeof(GLint));
+        CHECK_ALLOCATION_ERROR(p->firsts)
+        p->counts = (GLsizei*)realloc(p->counts, space * sizeof(GLsizei));
+        CHECK_ALLOCATION_ERROR(p->counts)
+        p->index_counts = (GLsizei*)realloc(p->index_counts, space * sizeof(GLsizei));
+        CHECK_ALLOCATION_ERROR(p->index_counts)
+        // every draw starts at the beginning of the shared index buffer, the base vertex selects the range
+        p->index_offsets = (const void**)realloc(p->index_offsets, space * sizeof(const void*));
+        CHECK_ALLOCATION_ERROR(p->index_offsets)
+
+        for(size_t k = p->queue_space; k < space; k++)
+            p->index_offsets[k] = NULL;
+        p->queue_space = space;
+    }
+
+    p->firsts[p->queued] = r->first;
+    p->counts[p->queued] = r->size;
+    p->index_counts[p->queued] = r->size / 4 * 6;
+    p->queued++;
+}
+
+static void glx_arena_draw_packed(struct glx_arena_page* p) {
+    glUseProgram(glx_arena_program);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_FALSE, GLX_ARENA_PACKED_LEN, NULL);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, GLX_ARENA_PACKED_LEN, (const void*)(sizeof(GLushort) * 2));
+
+    if(glx_arena_indexed) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glx_arena_index_buffer);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, p->index_counts, GL_UNSIGNED_SHORT, p->index_offsets, p->queued,
+                                      p->firsts);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    } else {
+        glMultiDrawArrays(GLX_ARENA_PRIMITIVE, p->firsts, p->counts, p->queued);
+    }
+
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(0);
+    glUseProgram(0);
+}
+
+static void glx_arena_draw_plain(struct glx_arena_page* p) {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_SHORT, 0, NULL);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, (const void*)(GLX_ARENA_PAGE_VERTICES * GLX_ARENA_VERTEX_LEN));
+    glMultiDrawArrays(GLX_ARENA_PRIMITIVE, p->firsts, p->counts, p->queued);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void glx_arena_draw() {
+    for(size_t k = 0; k < glx_arena_page_count; k++) {
+        struct glx_arena_page* p = glx_arena_pages + k;
+
+        if(p->queued > 0) {
+            glBindBuffer(GL_ARRAY_BUFFER, p->buffer);
+
+            if(p->packed)
+                glx_arena_draw_packed(p);
+            else
+                glx_arena_draw_plain(p);
+
+            glx_arena_meshes += p->queued;
+            glx_arena_draws++;
+            p->queued = 0;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void glx_arena_stats(struct glx_arena_stats* stats) {
+    stats->pages = glx_arena_page_count;
+    stats->ranges = glx_arena_ranges;
+    stats->meshes = glx_arena_meshes_last;
+    stats->draw_calls = glx_arena_draws_last;
+    stats->vertices = glx_arena_used;
+    stats->bytes_used = glx_arena_used_bytes;
+    stats->bytes_free = 0;
+    stats->largest_free = 0;
+
+    for(size_t k = 0; k < glx_arena_page_count; k++) {
+        struct glx_arena_page* p = glx_arena_pages + k;
+        size_t len = glx_arena_vertex_size(p->packed);
+        stats->bytes_free += GLX_ARENA_PAGE_VERTICES * len;
+
+        for(size_t b = 0; b < p->block_count; b++)
+            stats->largest_free = maxc(stats->largest_free, p->blocks[b].size * len);
+    }
+
+    stats->bytes_free -= glx_arena_used_bytes;
+    stats->uploads = glx_arena_uploads;
+    stats->bytes_uploaded = glx_arena_uploaded + glx_arena_upload_bytes;
+    stats->upload_rate = glx_arena_upload_rate;
+}
+
 void glx_enable_sphericalfog() {
     float color[] {fog_color[0], fog_color[1], fog_color[2], 1.0F};
 
@@ -36,6 +36,32 @@ struct glx_displaylist {
     bool has_color;
 };
 
+// terrain meshes are sub-allocated from a few large shared buffers (pages), so all visible meshes of a page can be
+// submitted with a single multi-draw call instead of one draw call per mesh
+#define GLX_ARENA_PAGE_VERTICES (1 << 20)
+#define GLX_ARENA_ALIGN 64
+
+struct glx_arena_range {
+    int page;
+    uint32_t first;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+struct glx_arena_stats {
+    size_t pages;
+    size_t ranges;
+    size_t meshes;
+    size_t draw_calls;
+    size_t vertices;
+    size_t bytes_used;
+    size_t bytes_free;
+    size_t largest_free;
+    size_t uploads;
+    size_t bytes_uploaded;
+    float upload_rate;
+};
+
 enum {
     GLX_DISPLAYLIST_NORMAL,
     GLX_DISPLAYLIST_ENHANCED,
@@ -53,3 +79,14 @@ void glx_displaylist_create(struct glx_displaylist* x, bool has_color, bool has_
 void glx_displaylist_destroy(struct glx_displaylist* x);
 void glx_displaylist_update(struct glx_displaylist* x, size_t size, int type, void* color, void* vertex, void* normal);
 void glx_displaylist_draw(struct glx_displaylist* x, int type);
+
+bool glx_arena_enabled(void);
+void glx_arena_create(struct glx_arena_range* r);
+void glx_arena_free(struct glx_arena_range* r);
+void glx_arena_update(struct glx_arena_range* r, size_t size, void* color, void* vertex);
+bool glx_arena_upload_begin(size_t bytes);
+bool glx_arena_upload_end(void);
+void glx_arena_begin(void);
+void glx_arena_queue(struct glx_arena_range* r);
+void glx_arena_draw(void);
+void glx_arena_stats(struct glx_arena_stats* stats);
@@ -46,6 +46,7 @@
 #include <weapon.hpp>
 #include <tracer.hpp>
 #include <font.hpp>
+#include <threadpool.hpp>
 
 struct hud* hud_active;
 struct window_instance* hud_window;
@@ -389,7 +390,7 @@ static void hud_ingame_render(mu_Context* ctx, float scalex, float scalef) {
         glDepthFunc(GL_LEQUAL);
         glDisable(GL_DEPTH_TEST);
         font_select(FONT_SMALLFNT);
-        char dbg_str[32];
+        char dbg_str[64];
 
         int max = 0;
         for(int k = 0; k < 40; k++) {
@@ -423,6 +424,82 @@ static void hud_ingame_render(mu_Context* ctx, float scalex, float scalef) {
                 font_render(8.0F * scalex, 202.0F * scalef, 8.0F * scalef, dbg_str);
             }
         }
+
+        struct threadpool_stats pool;
+        threadpool_stats(&pool);
+        glColor3f(1.0F, 1.0F, 1.0F);
+        sprintf(dbg_str, "tasks: %i queued", (int)pool.depth);
+        font_render(8.0F * scalex, 192.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "%i done, %i stolen", (int)pool.executed, (int)pool.steals);
+        font_render(8.0F * scalex, 182.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "dispatch: %0.2fms avg, %0.2fms max", network_stats[1].avg_dispatch / 1000.0F,
+                network_stats[1].max_dispatch / 1000.0F);
+        font_render(8.0F * scalex, 172.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "send jitter: %0.2fms", network_stats[1].send_jitter / 1000.0F);
+        font_render(8.0F * scalex, 162.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "%i flushes, %i packets %i b/s saved", network_stats[1].flushes,
+                network_stats[1].saved_packets, network_stats[1].saved_bytes);
+        font_render(8.0F * scalex, 152.0F * scalef, 8.0F * scalef, dbg_str);
+
+        struct glx_arena_stats arena;
+        glx_arena_stats(&arena);
+        sprintf(dbg_str, "terrain: %i draws, %i meshes", (int)arena.draw_calls, (int)arena.meshes);
+        font_render(8.0F * scalex, 142.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "%i KiB in %i pages, %i%% fragmented", (int)(arena.bytes_used / 1024), (int)arena.pages,
+                arena.bytes_free ? (int)(100 - arena.largest_free * 100 / arena.bytes_free) : 0);
+        font_render(8.0F * scalex, 132.0F * scalef, 8.0F * scalef, dbg_str);
+
+        int meshed = 0;
+        for(int k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++)
+            meshed += chunks[k].created;
+        sprintf(dbg_str, "%i B/chunk, %0.1f B/vertex", meshed ? (int)(arena.bytes_used / meshed) : 0,
+                arena.vertices ? (float)arena.bytes_used / arena.vertices : 0.0F);
+        font_render(8.0F * scalex, 122.0F * scalef, 8.0F * scalef, dbg_str);
+        sprintf(dbg_str, "upload: %i KiB/s, %i B/mesh", (int)(arena.upload_rate / 1024),
+                arena.uploads ? (int)(arena.bytes_uploaded / arena.uploads) : 0);
+        font_render(8.0F * scalex, 112.0F * scalef, 8.0F * scalef, dbg_str);
+
+        struct occlusion_stats occlusion;
+        chunk_occlusion_stats(&occlusion);
+        sprintf(dbg_str, "occlusion: %i/%i culled, %i occluders, %0.2fms", (int)occlusion.culled,
+                (int)occlusion.tested, (int)occlusion.occluders, occlusion.time * 1000.0F);
+        font_render(8.0F * scalex, 102.0F * scalef, 8.0F * scalef, dbg_str);
+
+        struct chunk_upload_stats uploads;
+        chunk_upload_stats(&uploads);
+        snprintf(dbg_str, sizeof(dbg_str), "chunk uploads: %i, %i KiB, %i queued", (int)uploads.meshes,
+                 (int)(uploads.bytes / 1024), (int)uploads.pending);
+        font_render(8.0F * scalex, 92.0F * scalef, 8.0F * scalef, dbg_str);
+        snprintf(dbg_str, sizeof(dbg_str), "upload time: %0.2fms (%0.2fms max)", uploads.time * 1000.0F,
+                 uploads.worst * 1000.0F);
+        font_render(8.0F * scalex, 82.0F * scalef, 8.0F * scalef, dbg_str);
+
+        // packet types that took the most handler time since connecting
+        bool listed[256] = {false};
+        font_render(8.0F * scalex + 168.0F * scalef, 372.0F * scalef, 8.0F * scalef, "packet          in     out    kB     ms   max us");
+        for(int row = 0; row < 16; row++) {
+            int top = -1;
+            for(int id = 0; id < 256; id++) {
+                struct network_packet_stat* p = network_packet_stats + id;
+                if(!listed[id] && (p->received || p->sent)
+                   && (top < 0 || p->handler_time > network_packet_stats[top].handler_time))
+                    top = id;
+            }
+
+            if(top < 0)
+                break;
+
+            listed[top] = true;
+            struct network_packet_stat* p = network_packet_stats + top;
+            char name[16];
+            if(network_packet_names[top])
+                snprintf(name, sizeof(name), "%s", network_packet_names[top]);
+            else
+                snprintf(name, sizeof(name), "#%i", top);
+            snprintf(dbg_str, sizeof(dbg_str), "%-15s %6u %6u %5u %6.1f %7.0f", name, p->received, p->sent,
+                     (p->received_bytes + p->sent_bytes) / 1024, p->handler_time * 1000.0, p->handler_max * 1000000.0F);
+            font_render(8.0F * scalex + 168.0F * scalef, (362.0F - row * 10.0F) * scalef, 8.0F * scalef, dbg_str);
+        }
         font_select(FONT_FIXEDSYS);
         glColor3f(1.0F, 1.0F, 1.0F);
     }
@@ -958,6 +1035,15 @@ static void hud_ingame_render(mu_Context* ctx, float scalex, float scalef) {
         sprintf(debug_str, "%i", (int)fps);
         font_render(11.0F * scalef, settings.window_height * 0.33F - 20.0F * scalef, 20.0F * scalef, debug_str);
     }
+
+    float save_progress = map_save_progress();
+    if(save_progress >= 0.0F) {
+        char save_str[32];
+        font_select(FONT_FIXEDSYS);
+        glColor3f(1.0F, 1.0F, 1.0F);
+        sprintf(save_str, "Saving map %i%%", (int)(save_progress * 100.0F));
+        font_render(11.0F * scalef, settings.window_height * 0.33F - 40.0F * scalef, 20.0F * scalef, save_str);
+    }
 }
 
 static void hud_ingame_scroll(double yoffset) {
@@ -1796,8 +1882,7 @@ static void server_c(char* address, char* name) {
         hud_change(&hud_ingame);
     } else {
         window_title(name);
-        if (network_connect_string(address))
-            hud_change(&hud_ingame);
+        network_connect_string(address);
     }
 }
 
@@ -1975,6 +2060,18 @@ static void hud_serverlist_render(mu_Context* ctx, float scalex, float scaley) {
         mu_end_window(ctx);
     }
 
+    if(network_connection_state() == NETWORK_CONNECTING
+       && mu_begin_window_ex(ctx, "Connecting", mu_rect(200, 250, 300, 100),
+                             MU_OPT_HOLDFOCUS | MU_OPT_NORESIZE | MU_OPT_NOCLOSE)) {
+        mu_Container* cnt = mu_get_current_container(ctx);
+        mu_bring_to_front(ctx, cnt);
+        cnt->rect = mu_rect((settings.window_width - 300 * scaley) / 2, 250 * scaley, 300 * scaley, 100 * scaley);
+
+        mu_layout_row(ctx, 1, (int*) &empty_row, 0);
+        mu_text(ctx, "Connecting to server...");
+        mu_end_window(ctx);
+    }
+
     if(window_time() - chat_popup_timer < chat_popup_duration
        && mu_begin_window_ex(ctx, "Disconnected from server", mu_rect(200, 250, 300, 100),
                              MU_OPT_HOLDFOCUS | MU_OPT_NORESIZE | MU_OPT_NOCLOSE)) {
@@ -2280,10 +2377,16 @@ static void hud_settings_render(mu_Context* ctx, float scalex, float scaley) {
             mu_layout_next(ctx);
 
             if(mu_button(ctx, "Apply changes")) {
+                // terrain meshes are stored in the renderer and vertex format these select
+                bool remesh = settings.packed_vertices != settings_tmp.packed_vertices
+                    || settings.smooth_fog != settings_tmp.smooth_fog
+                    || settings.force_displaylist != settings_tmp.force_displaylist;
                 memcpy(&settings, &settings_tmp, sizeof(struct RENDER_OPTIONS));
                 window_fromsettings();
                 sound_volume(settings.volume / 10.0F);
                 config_save();
+                if(remesh)
+                    chunk_rebuild_all();
             }
         }
 
@@ -0,0 +1,519 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <enet/enet.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include <common.hpp>
+#include <file.hpp>
+#include <log.hpp>
+#include <window.hpp>
+#include <player.hpp>
+#include <network.hpp>
+#include <loadserver.hpp>
+
+// Stands in for a game server on the local machine: sends a map like a 0.75/0.76 server, then keeps the client busy
+// with synthetic players moving around and editing blocks, so that client frame time and memory can be measured
+// while the load grows. Bots exist only as packets, nothing is simulated.
+
+#define LOADSERVER_CLIENTS 8
+#define LOADSERVER_TICK 0.01
+#define LOADSERVER_WORLD_UPDATE 0.1
+#define LOADSERVER_STATS_INTERVAL 5.0
+#define LOADSERVER_MAP_CHUNK 8192
+#define LOADSERVER_CHUNKS_PER_TICK 4
+#define LOADSERVER_MAP_SIZE 512
+
+enum loadserver_state {
+    LOADSERVER_FREE,
+    LOADSERVER_MAP_CACHED, // 0.76 clients answer whether they have the map already
+    LOADSERVER_MAP,
+    LOADSERVER_JOINED,
+};
+
+struct loadserver_client {
+    ENetPeer* peer;
+    enum loadserver_state state;
+    enet_uint32 version;
+    size_t map_offset;
+    int bots; // bots created on this client so far
+};
+
+static struct loadserver_options {
+    int port;
+    int players;
+    float edits;    // per second, spread over all bots
+    float loss;     // percent of world updates dropped, only these are unreliable
+    float ramp;     // seconds until all bots have joined, all are there from the start if 0
+    float duration; // seconds, runs until killed if 0
+} loadserver;
+
+static struct loadserver_client loadserver_clients[LOADSERVER_CLIENTS];
+
+static uint8_t* loadserver_map;
+static uLongf loadserver_map_size;
+static uint32_t loadserver_map_crc;
+// protocol z (0 is the sky) of the topmost block of each column, kept roughly up to date with the edits sent
+static uint8_t loadserver_height[LOADSERVER_MAP_SIZE * LOADSERVER_MAP_SIZE];
+
+static struct {
+    unsigned int packets;
+    size_t bytes;
+    unsigned int edits;
+    unsigned int dropped;
+} loadserver_stats;
+
+static void loadserver_send(struct loadserver_client* c, int id, const void* data, size_t len, bool reliable) {
+    if(!reliable && rand() % 10000 < loadserver.loss * 100.0F) {
+        loadserver_stats.dropped++;
+        return;
+    }
+
+    ENetPacket* packet = enet_packet_create(NULL, len + 1, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+    packet->data[0] = id;
+    memcpy(packet->data + 1, data, len);
+
+    if(enet_peer_send(c->peer, 0, packet) < 0) {
+        enet_packet_destroy(packet);
+        return;
+    }
+
+    loadserver_stats.packets++;
+    loadserver_stats.bytes += len + 1;
+}
+
+static void loadserver_broadcast(int id, const void* data, size_t len) {
+    for(int k = 0; k < LOADSERVER_CLIENTS; k++)
+        if(loadserver_clients[k].state == LOADSERVER_JOINED)
+            loadserver_send(loadserver_clients + k, id, data, len, true);
+}
+
+static int loadserver_local_id(struct loadserver_client* c) {
+    return PLAYERS_MAX - 1 - (c - loadserver_clients);
+}
+
+// walks the span headers of every column, the first span starts at the topmost block
+static bool loadserver_heightmap(uint8_t* vxl, size_t len) {
+    size_t offset = 0;
+
+    for(int y = 0; y < LOADSERVER_MAP_SIZE; y++) {
+        for(int x = 0; x < LOADSERVER_MAP_SIZE; x++) {
+            if(offset + 4 > len)
+                return false;
+
+            loadserver_height[x + y * LOADSERVER_MAP_SIZE] = vxl[offset + 1];
+
+            while(1) {
+                if(offset + 4 > len)
+                    return false;
+
+                uint8_t* span = vxl + offset;
+                if(!span[0]) {
+                    offset += 4 * (span[2] - span[1] + 2);
+                    break;
+                }
+
+                offset += span[0] * 4;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int loadserver_height_at(int x, int y) {
+    return loadserver_height[(x & (LOADSERVER_MAP_SIZE - 1)) + (y & (LOADSERVER_MAP_SIZE - 1)) * LOADSERVER_MAP_SIZE];
+}
+
+// bots run in circles of different sizes around the map center
+static void loadserver_bot(int bot, double time, struct PacketWorldUpdate075* out) {
+    float radius = 32.0F + (bot * 37) % 192;
+    float angle = time * 8.0F / radius + bot;
+
+    out->x = LOADSERVER_MAP_SIZE / 2 + cos(angle) * radius;
+    out->y = LOADSERVER_MAP_SIZE / 2 + sin(angle) * radius;
+    out->z = loadserver_height_at(out->x, out->y) - 3.0F;
+    out->ox = -sin(angle);
+    out->oy = cos(angle);
+    out->oz = 0.0F;
+}
+
+static int loadserver_active_bots(double elapsed) {
+    if(loadserver.ramp <= 0.0F || elapsed >= loadserver.ramp)
+        return loadserver.players;
+    return loadserver.players * elapsed / loadserver.ramp;
+}
+
+static void loadserver_create_player(struct loadserver_client* c, int player_id, int team, int weapon,
+                                     struct PacketWorldUpdate075* pos) {
+    struct PacketCreatePlayer p;
+    memset(&p, 0, sizeof(p));
+    p.player_id = player_id;
+    p.team = team;
+    p.weapon = weapon;
+    p.x = pos->x;
+    p.y = pos->y;
+    p.z = pos->z;
+    snprintf(p.name, sizeof(p.name), player_id < loadserver.players ? "Bot%i" : "Client%i", player_id);
+    loadserver_send(c, PACKET_CREATEPLAYER_ID, &p, sizeof(p), true);
+}
+
+static void loadserver_state_data(struct loadserver_client* c) {
+    struct PacketStateData p;
+    memset(&p, 0, sizeof(p));
+    p.player_id = loadserver_local_id(c);
+    p.fog_red = 128;
+    p.fog_green = 232;
+    p.fog_blue = 255;
+    p.team_1_blue = 255;
+    p.team_2_green = 255;
+    strcpy(p.team_1_name, "Blue");
+    strcpy(p.team_2_name, "Green");
+    p.gamemode = GAMEMODE_CTF;
+    p.gamemode_data.ctf.capture_limit = 10;
+    loadserver_send(c, PACKET_STATEDATA_ID, &p, sizeof(p), true);
+
+    c->state = LOADSERVER_JOINED;
+    c->bots = 0;
+}
+
+static void loadserver_connect(ENetPeer* peer, enet_uint32 version) {
+    if(version != VERSION_075 && version != VERSION_076) {
+        enet_peer_disconnect(peer, 3);
+        return;
+    }
+
+    struct loadserver_client* c = NULL;
+    for(int k = 0; k < LOADSERVER_CLIENTS && !c; k++)
+        if(loadserver_clients[k].state == LOADSERVER_FREE)
+            c = loadserver_clients + k;
+
+    if(!c) {
+        enet_peer_disconnect(peer, 4);
+        return;
+    }
+
+    c->peer = peer;
+    c->version = version;
+    c->map_offset = 0;
+    peer->data = c;
+
+    if(version == VERSION_075) {
+        struct PacketMapStart075 p = {.map_size = (unsigned int)loadserver_map_size};
+        loadserver_send(c, PACKET_MAPSTART_ID, &p, sizeof(p), true);
+        c->state = LOADSERVER_MAP;
+    } else {
+        struct PacketMapStart076 p;
+        memset(&p, 0, sizeof(p));
+        p.map_size = loadserver_map_size;
+        p.crc32 = loadserver_map_crc;
+        strcpy(p.map_name, "loadserver");
+        loadserver_send(c, PACKET_MAPSTART_ID, &p, sizeof(p), true);
+        c->state = LOADSERVER_MAP_CACHED;
+    }
+
+    log_info("Client %i connected using protocol %s", loadserver_local_id(c), version == VERSION_075 ? "0.75" : "0.76");
+}
+
+static void loadserver_receive(struct loadserver_client* c, uint8_t* data, size_t len) {
+    switch(data[0]) {
+        case PACKET_MAPCACHED_ID:
+            if(c->state == LOADSERVER_MAP_CACHED && len > sizeof(struct PacketMapCached)) {
+                c->state = LOADSERVER_MAP;
+                if(((struct PacketMapCached*)(data + 1))->cached)
+                    c->map_offset = loadserver_map_size;
+            }
+            break;
+        case PACKET_EXISTINGPLAYER_ID:
+            if(c->state == LOADSERVER_JOINED && len > sizeof(struct PacketExistingPlayer) - sizeof(char[17])) {
+                struct PacketExistingPlayer* p = (struct PacketExistingPlayer*)(data + 1);
+                struct PacketWorldUpdate075 spawn;
+                loadserver_bot(loadserver_local_id(c), 0.0, &spawn);
+                loadserver_create_player(c, loadserver_local_id(c), p->team, p->weapon, &spawn);
+            }
+            break;
+    }
+}
+
+static void loadserver_edit(double time, int bots) {
+    struct PacketWorldUpdate075 pos;
+    int bot = rand() % bots;
+    loadserver_bot(bot, time, &pos);
+
+    int x = (int)pos.x + rand() % 17 - 8;
+    int y = (int)pos.y + rand() % 17 - 8;
+    x &= LOADSERVER_MAP_SIZE - 1;
+    y &= LOADSERVER_MAP_SIZE - 1;
+    uint8_t* height = loadserver_height + x + y * LOADSERVER_MAP_SIZE;
+
+    int kind = rand() % 10;
+
+    if(kind < 4) {
+        if(*height >= 62)
+            return;
+
+        struct PacketBlockAction p = {.player_id = (unsigned char)bot, .action_type = ACTION_DESTROY, .x = x, .y = y,
+                                      .z = *height};
+        loadserver_broadcast(PACKET_BLOCKACTION_ID, &p, sizeof(p));
+        (*height)++;
+    } else if(kind < 7) {
+        if(*height <= 1)
+            return;
+
+        struct PacketBlockAction p = {.player_id = (unsigned char)bot, .action_type = ACTION_BUILD, .x = x, .y = y,
+                                      .z = *height - 1};
+        loadserver_broadcast(PACKET_BLOCKACTION_ID, &p, sizeof(p));
+        (*height)--;
+    } else if(kind < 9) {
+        int z = maxc(*height - 1, 0);
+        int length = 1 + rand() % 8;
+        int ex = minc(x + length, LOADSERVER_MAP_SIZE - 1);
+
+        struct PacketBlockLine p
+            = {.player_id = (unsigned char)bot, .sx = x, .sy = y, .sz = z, .ex = ex, .ey = y, .ez = z};
+        loadserver_broadcast(PACKET_BLOCKLINE_ID, &p, sizeof(p));
+
+        for(int k = x; k <= ex; k++) {
+            uint8_t* h = loadserver_height + k + y * LOADSERVER_MAP_SIZE;
+            *h = minc(*h, z);
+        }
+    } else {
+        struct PacketGrenade g = {.player_id = (unsigned char)bot, .fuse_length = 0.0F, .x = x + 0.5F, .y = y + 0.5F,
+                                  .z = *height - 0.5F, .vx = 0.0F, .vy = 0.0F, .vz = 0.0F};
+        loadserver_broadcast(PACKET_GRENADE_ID, &g, sizeof(g));
+
+        struct PacketBlockAction p = {.player_id = (unsigned char)bot, .action_type = ACTION_GRENADE, .x = x, .y = y,
+                                      .z = *height};
+        loadserver_broadcast(PACKET_BLOCKACTION_ID, &p, sizeof(p));
+        *height = minc(*height + 1, 62);
+    }
+
+    loadserver_stats.edits++;
+}
+
+static void loadserver_world_update(struct loadserver_client* c, double time) {
+    if(!c->bots)
+        return;
+
+    if(c->version == VERSION_075) {
+        // entries are indexed by player id
+        struct PacketWorldUpdate075 p[PLAYERS_MAX];
+        for(int k = 0; k < c->bots; k++)
+            loadserver_bot(k, time, p + k);
+        loadserver_send(c, PACKET_WORLDUPDATE_ID, p, c->bots * sizeof(*p), false);
+    } else {
+        struct PacketWorldUpdate076 p[PLAYERS_MAX];
+        for(int k = 0; k < c->bots; k++) {
+            struct PacketWorldUpdate075 pos;
+            loadserver_bot(k, time, &pos);
+            p[k] = (struct PacketWorldUpdate076) {.player_id = (unsigned char)k, .x = pos.x, .y = pos.y, .z = pos.z,
+                                                  .ox = pos.ox, .oy = pos.oy, .oz = pos.oz};
+        }
+        loadserver_send(c, PACKET_WORLDUPDATE_ID, p, c->bots * sizeof(*p), false);
+    }
+}
+
+static void loadserver_tick(double time, int bots, bool world_update) {
+    for(int k = 0; k < LOADSERVER_CLIENTS; k++) {
+        struct loadserver_client* c = loadserver_clients + k;
+
+        if(c->state == LOADSERVER_MAP) {
+            for(int n = 0; n < LOADSERVER_CHUNKS_PER_TICK && c->map_offset < loadserver_map_size; n++) {
+                size_t length = minc(loadserver_map_size - c->map_offset, (size_t)LOADSERVER_MAP_CHUNK);
+                loadserver_send(c, PACKET_MAPCHUNK_ID, loadserver_map + c->map_offset, length, true);
+                c->map_offset += length;
+            }
+
+            if(c->map_offset >= loadserver_map_size)
+                loadserver_state_data(c);
+        }
+
+        if(c->state == LOADSERVER_JOINED) {
+            for(; c->bots < bots; c->bots++) {
+                struct PacketWorldUpdate075 pos;
+                loadserver_bot(c->bots, time, &pos);
+                loadserver_create_player(c, c->bots, c->bots % 2 ? TEAM_2 : TEAM_1, c->bots % 3, &pos);
+            }
+
+            if(world_update)
+                loadserver_world_update(c, time);
+        }
+    }
+}
+
+static bool loadserver_options_parse(int argc, char** argv) {
+    loadserver.port = 32887;
+    loadserver.players = 32;
+    loadserver.edits = 10.0F;
+    loadserver.loss = 0.0F;
+    loadserver.ramp = 0.0F;
+    loadserver.duration = 0.0F;
+
+    for(int k = 0; k < argc; k++) {
+        char* value = strchr(argv[k], '=');
+        if(!value) {
+            log_error("Option %s needs a value", argv[k]);
+            return false;
+        }
+
+        size_t length = value++ - argv[k];
+
+        if(!strncmp(argv[k], "port", length)) {
+            loadserver.port = atoi(value);
+        } else if(!strncmp(argv[k], "players", length)) {
+            loadserver.players = atoi(value);
+        } else if(!strncmp(argv[k], "edits", length)) {
+            loadserver.edits = atof(value);
+        } else if(!strncmp(argv[k], "loss", length)) {
+            loadserver.loss = atof(value);
+        } else if(!strncmp(argv[k], "ramp", length)) {
+            loadserver.ramp = atof(value);
+        } else if(!strncmp(argv[k], "duration", length)) {
+            loadserver.duration = atof(value);
+        } else {
+            log_error("Unknown option %s", argv[k]);
+            return false;
+        }
+    }
+
+    // the top ids are left to the clients
+    loadserver.players = minc(maxc(loadserver.players, 0), PLAYERS_MAX - LOADSERVER_CLIENTS);
+    return true;
+}
+
+// argv[0] is the map to send, followed by options like players=64
+bool loadserver_run(int argc, char** argv) {
+    if(argc < 1 || !loadserver_options_parse(argc - 1, argv + 1))
+        return false;
+
+    uint8_t* vxl = file_load(argv[0]);
+    if(!vxl) {
+        log_error("Could not load %s", argv[0]);
+        return false;
+    }
+
+    size_t vxl_size = file_size(argv[0]);
+    if(!loadserver_heightmap(vxl, vxl_size)) {
+        log_error("%s is not a 512x512 map", argv[0]);
+        free(vxl);
+        return false;
+    }
+
+    loadserver_map_crc = crc32(0L, vxl, vxl_size);
+    loadserver_map_size = compressBound(vxl_size);
+    loadserver_map = (uint8_t*)malloc(loadserver_map_size);
+    CHECK_ALLOCATION_ERROR(loadserver_map)
+    int compressed = compress2(loadserver_map, &loadserver_map_size, vxl, vxl_size, Z_BEST_COMPRESSION);
+    free(vxl);
+
+    if(compressed != Z_OK) {
+        log_error("Could not compress %s: %s", argv[0], zError(compressed));
+        free(loadserver_map);
+        return false;
+    }
+
+    enet_initialize();
+
+    ENetAddress address = {.host = ENET_HOST_ANY, .port = (enet_uint16)loadserver.port};
+    ENetHost* host = enet_host_create(&address, LOADSERVER_CLIENTS * 2, 1, 0, 0);
+    if(!host) {
+        log_error("Could not listen on port %i", loadserver.port);
+        free(loadserver_map);
+        return false;
+    }
+    enet_host_compress_with_range_coder(host);
+
+    log_info("Load server on port %i: %i bots, %0.1f edits/s, %0.1f%% loss, %0.0fs ramp, map of %zu KiB",
+             loadserver.port, loadserver.players, loadserver.edits, loadserver.loss, loadserver.ramp,
+             (size_t)loadserver_map_size / 1024);
+
+    double start = window_time_precise();
+    double next_tick = start;
+    double next_world_update = start;
+    double next_stats = start + LOADSERVER_STATS_INTERVAL;
+    float edits_due = 0.0F;
+
+    while(loadserver.duration <= 0.0F || window_time_precise() - start < loadserver.duration) {
+        ENetEvent event;
+        while(enet_host_service(host, &event, 1) > 0) {
+            struct loadserver_client* c = (struct loadserver_client*)event.peer->data;
+
+            switch(event.type) {
+                case ENET_EVENT_TYPE_CONNECT: loadserver_connect(event.peer, event.data); break;
+                case ENET_EVENT_TYPE_RECEIVE:
+                    if(c && event.packet->dataLength > 0)
+                        loadserver_receive(c, event.packet->data, event.packet->dataLength);
+                    enet_packet_destroy(event.packet);
+                    break;
+                case ENET_EVENT_TYPE_DISCONNECT:
+                    if(c) {
+                        log_info("Client %i disconnected", loadserver_local_id(c));
+                        c->state = LOADSERVER_FREE;
+                        event.peer->data = NULL;
+                    }
+                    break;
+                default: break;
+            }
+        }
+
+        double now = window_time_precise();
+        if(now < next_tick)
+            continue;
+        next_tick += LOADSERVER_TICK;
+
+        double elapsed = now - start;
+        int bots = loadserver_active_bots(elapsed);
+
+        bool world_update = now >= next_world_update;
+        if(world_update)
+            next_world_update += LOADSERVER_WORLD_UPDATE;
+
+        loadserver_tick(elapsed, bots, world_update);
+
+        bool joined = false;
+        for(int k = 0; k < LOADSERVER_CLIENTS; k++)
+            joined |= loadserver_clients[k].state == LOADSERVER_JOINED;
+
+        edits_due = (joined && bots > 0) ? edits_due + loadserver.edits * LOADSERVER_TICK : 0.0F;
+        for(; edits_due >= 1.0F; edits_due -= 1.0F)
+            loadserver_edit(elapsed, bots);
+
+        if(now >= next_stats) {
+            log_info("%i bots, %0.1f edits/s, %0.0f packets/s, %0.1f KiB/s, %u world updates dropped", bots,
+                     loadserver_stats.edits / LOADSERVER_STATS_INTERVAL,
+                     loadserver_stats.packets / LOADSERVER_STATS_INTERVAL,
+                     loadserver_stats.bytes / LOADSERVER_STATS_INTERVAL / 1024.0, loadserver_stats.dropped);
+            memset(&loadserver_stats, 0, sizeof(loadserver_stats));
+            next_stats += LOADSERVER_STATS_INTERVAL;
+        }
+    }
+
+    for(int k = 0; k < LOADSERVER_CLIENTS; k++)
+        if(loadserver_clients[k].state != LOADSERVER_FREE)
+            enet_peer_disconnect(loadserver_clients[k].peer, 5);
+    enet_host_flush(host);
+    enet_host_destroy(host);
+
+    free(loadserver_map);
+    return true;
+}
@@ -44,6 +44,8 @@
 #include <matrix.hpp>
 #include <texture.hpp>
 #include <chunk.hpp>
+#include <threadpool.hpp>
+#include <loadserver.hpp>
 #include <main.hpp>
 
 int fps = 0;
@@ -452,6 +454,7 @@ void init() {
     glShadeModel(GL_SMOOTH);
     glDisable(GL_FOG);
 
+    threadpool_init();
     map_init();
 
     glx_init();
@@ -472,6 +475,23 @@ void init() {
     weapon_set();
 }
 
+// enough to run packet handlers, map physics and chunk meshing, nothing that needs a window, GL or a sound device
+void init_headless() {
+    window_init_headless();
+    sound_enabled = 0;
+
+    threadpool_init();
+    map_init();
+
+    player_init();
+    particle_init();
+    network_init();
+    chunk_init();
+    grenade_init();
+
+    weapon_set();
+}
+
 void reshape(struct window_instance* window, int width, int height) {
     font_reset();
     glViewport(0, 0, width, height);
@@ -588,10 +608,12 @@ void keys(struct window_instance* window, int key, int scancode, int action, int
         char save_name[128];
         sprintf(save_name, "vxl/%ld.vxl", (long)save_time);
 
-        map_save_file(save_name);
-
-        sprintf(save_name, "Saved map as vxl/%ld.vxl", (long)save_time);
-        chat_add(0, 0x0000FF, save_name);
+        if(map_save_file(save_name)) {
+            sprintf(save_name, "Saving map as vxl/%ld.vxl", (long)save_time);
+            chat_add(0, 0x0000FF, save_name);
+        } else {
+            chat_add(0, 0x0000FF, "Map is still being saved");
+        }
     }
 }
 
@@ -628,8 +650,7 @@ void mouse_scroll(struct window_instance* window, double xoffset, double yoffset
 
 void deinit() {
     ping_deinit();
-    if(network_connected)
-        network_disconnect();
+    network_deinit();
     window_deinit();
 }
 
@@ -652,6 +673,11 @@ int main(int argc, char** argv) {
     settings.greedy_meshing = 0;
     settings.mouse_sensitivity = MOUSE_SENSITIVITY;
     settings.show_fps = 0;
+    settings.network_telemetry = 0;
+    settings.network_capture = 0;
+    settings.send_rate = 60;
+    settings.packed_vertices = 0;
+    settings.occlusion_culling = 1;
     settings.volume = 10;
     settings.force_displaylist = 0;
     settings.invert_y = 0;
@@ -681,6 +707,60 @@ int main(int argc, char** argv) {
 
     config_reload();
 
+    if(argc > 2 && !strcmp(argv[1], "--benchmark-replay")) {
+        init_headless();
+        exit(network_benchmark_replay(argv[2]) ? 0 : 1);
+    }
+
+    if(argc > 1 && !strcmp(argv[1], "--benchmark-visibility")) {
+        init_headless();
+
+        if(argc > 2) {
+            void* data = file_load(argv[2]);
+
+            if(!data) {
+                log_error("Error: Could not load %s", argv[2]);
+                exit(1);
+            }
+
+            map_vxl_load((uintptr_t)data, file_size(argv[2]));
+            free(data);
+        }
+
+        // the culling hierarchy needs the height of every chunk mesh
+        struct chunk_mesh_stats stats = {0};
+        chunk_rebuild_all();
+        chunk_wait();
+        chunk_update_headless(&stats);
+
+        chunk_benchmark_visibility();
+        exit(0);
+    }
+
+    if(argc > 1 && !strcmp(argv[1], "--benchmark-mesh")) {
+        init_headless();
+
+        if(argc > 2) {
+            void* data = file_load(argv[2]);
+
+            if(!data) {
+                log_error("Error: Could not load %s", argv[2]);
+                exit(1);
+            }
+
+            map_vxl_load((uintptr_t)data, file_size(argv[2]));
+            free(data);
+        }
+
+        chunk_benchmark_mesh();
+        exit(0);
+    }
+
+    if(argc > 2 && !strcmp(argv[1], "--loadserver")) {
+        window_init_headless();
+        exit(loadserver_run(argc - 2, argv + 2) ? 0 : 1);
+    }
+
     window_init();
 
     if (glewInit()) log_error("Could not load extended OpenGL functions!");
@@ -709,15 +789,81 @@ int main(int argc, char** argv) {
         if(!strcmp(argv[1], "--help")) {
             log_info("Usage: client                     [server browser]");
             log_info("       client -aos://<ip>:<port>  [custom address]");
+            log_info("       client --benchmark-map [file]");
+            log_info("       client --benchmark-storage <file>");
+            log_info("       client --benchmark-join <file>");
+            log_info("       client --benchmark-load <file> [file...]");
+            log_info("       client --benchmark-replay <capture>");
+            log_info("       client --benchmark-visibility [file]");
+            log_info("       client --benchmark-mesh [file]");
+            log_info("       client --loadserver <map> [port=32887] [players=32] [edits=10] [loss=0] [ramp=0] "
+                     "[duration=0]");
             exit(0);
         }
 
+        if(!strcmp(argv[1], "--benchmark-map")) {
+            if(argc > 2) {
+                void* data = file_load(argv[2]);
+
+                if(!data) {
+                    log_error("Error: Could not load %s", argv[2]);
+                    exit(1);
+                }
+
+                map_vxl_load((uintptr_t)data, file_size(argv[2]));
+                free(data);
+            }
+
+            map_benchmark(5.0F);
+            exit(0);
+        }
+
+        if(!strcmp(argv[1], "--benchmark-storage") && argc > 2) {
+            void* data = file_load(argv[2]);
+
+            if(!data) {
+                log_error("Error: Could not load %s", argv[2]);
+                exit(1);
+            }
+
+            map_benchmark_storage((uintptr_t)data, file_size(argv[2]));
+            free(data);
+            exit(0);
+        }
+
+        if(!strcmp(argv[1], "--benchmark-join") && argc > 2) {
+            void* data = file_load(argv[2]);
+
+            if(!data) {
+                log_error("Error: Could not load %s", argv[2]);
+                exit(1);
+            }
+
+            network_benchmark_join(data, file_size(argv[2]));
+            free(data);
+            exit(0);
+        }
+
+        if(!strcmp(argv[1], "--benchmark-load")) {
+            for(int k = 2; k < argc; k++) {
+                void* data = file_load(argv[k]);
+
+                if(!data) {
+                    log_error("Error: Could not load %s", argv[k]);
+                    exit(1);
+                }
+
+                map_benchmark_load((uintptr_t)data, file_size(argv[k]), argv[k]);
+                free(data);
+            }
+
+            exit(0);
+        }
+
+        // the game is entered once the connection is up
         if(!network_connect_string(argv[1] + 1)) {
-            log_error("Error: Connection failed (use --help for instructions)");
+            log_error("Error: Invalid server address (use --help for instructions)");
             exit(1);
-        } else {
-            log_info("Connection to %s successful", argv[1] + 1);
-            hud_change(&hud_ingame);
         }
     }
 
@@ -755,6 +901,17 @@ int main(int argc, char** argv) {
 
         display();
 
+        float save_duration;
+        const char* save_file = map_save_finished(&save_duration);
+        if(save_file) {
+            char save_msg[128];
+            if(save_duration >= 0.0F)
+                snprintf(save_msg, sizeof(save_msg), "Saved map as %s in %0.0fms", save_file, save_duration * 1000.0F);
+            else
+                snprintf(save_msg, sizeof(save_msg), "Could not save map as %s", save_file);
+            chat_add(0, 0x0000FF, save_msg);
+        }
+
         sound_update();
         network_update();
         window_update();
@@ -17,6 +17,7 @@
     along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
@@ -40,6 +41,7 @@
 #include <config.hpp>
 #include <channel.hpp>
 #include <entitysystem.hpp>
+#include <threadpool.hpp>
 
 int map_size_x = 512;
 int map_size_y = 64;
@@ -48,6 +50,33 @@ int map_size_z = 512;
 static struct libvxl_map map;
 static pthread_rwlock_t map_lock;
 
+// geometry is read without locking: writers hold map_lock and make the sequence odd while they change the map,
+// readers retry if it was odd or changed during their query
+static unsigned int map_sequence = 0;
+
+static void map_write_begin() {
+    __atomic_store_n(&map_sequence, map_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void map_write_end() {
+    __atomic_store_n(&map_sequence, map_sequence + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned int map_read_begin() {
+    unsigned int sequence;
+
+    while((sequence = __atomic_load_n(&map_sequence, __ATOMIC_ACQUIRE)) & 1)
+        ;
+
+    return sequence;
+}
+
+static bool map_read_retry(unsigned int sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&map_sequence, __ATOMIC_RELAXED) != sequence;
+}
+
 float fog_color[4] = {0.5F, 0.9098F, 1.0F, 1.0F};
 
 struct damaged_voxel {
@@ -153,9 +182,12 @@ struct map_work_packet {
     int x, y, z;
 };
 
-struct channel map_work_queue;
 struct channel map_result_queue;
 
+// collapse detection runs on the thread pool, only removing a structure from the map is serialized
+static pthread_mutex_t map_physics_lock;
+static struct threadpool_group map_physics_group;
+
 struct map_collapsing {
     HashTable voxels;
     struct Velocity v;
@@ -224,18 +256,35 @@ static bool falling_blocks_meshing(void* key, void* value, void* user) {
     return true;
 }
 
+struct falling_blocks_removal {
+    float pivot[3];
+    struct map_edit* edits;
+    size_t count;
+};
+
 static bool falling_blocks_pivot(void* key, void* value, void* user) {
-    float* pivot = (float*)user;
+    struct falling_blocks_removal* removal = (struct falling_blocks_removal*)user;
     uint32_t pos = *(uint32_t*)key;
 
-    map_set(pos_keyx(pos), pos_keyy(pos), pos_keyz(pos), 0xFFFFFFFF);
-    pivot[0] += pos_keyx(pos);
-    pivot[1] += pos_keyy(pos);
-    pivot[2] += pos_keyz(pos);
+    removal->edits[removal->count++] = (struct map_edit) {
+        .x = pos_keyx(pos),
+        .y = pos_keyy(pos),
+        .z = pos_keyz(pos),
+        .color = 0xFFFFFFFF,
+    };
+
+    removal->pivot[0] += pos_keyx(pos);
+    removal->pivot[1] += pos_keyy(pos);
+    removal->pivot[2] += pos_keyz(pos);
 
     return true;
 }
 
+static bool falling_blocks_solid(void* key, void* value, void* user) {
+    uint32_t pos = *(uint32_t*)key;
+    return !map_isair(pos_keyx(pos), pos_keyy(pos), pos_keyz(pos));
+}
+
 static const int DIRECTION_MASK[][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
 
 static bool map_update_physics_sub(struct map_collapsing* collapsing, int x, int y, int z) {
@@ -271,20 +320,29 @@ static bool map_update_physics_sub(struct map_collapsing* collapsing, int x, int
             return false;
         }
 
-        for(size_t k = 0; k < sizeof(DIRECTION_MASK) / sizeof(*DIRECTION_MASK); k++) {
-            int dir_block[3] = {
+        const size_t directions = sizeof(DIRECTION_MASK) / sizeof(*DIRECTION_MASK);
+        struct Point neighbours[directions];
+        bool air[directions];
+
+        for(size_t k = 0; k < directions; k++)
+            neighbours[k] = (struct Point) {
                 pos_keyx(current.pos) + DIRECTION_MASK[k][0],
                 pos_keyy(current.pos) + DIRECTION_MASK[k][1],
                 pos_keyz(current.pos) + DIRECTION_MASK[k][2],
             };
 
+        map_isair_many(neighbours, directions, air);
+
+        for(size_t k = 0; k < directions; k++) {
+            int dir_block[3] = {neighbours[k].x, neighbours[k].y, neighbours[k].z};
+
             struct minheap_block block = (struct minheap_block) {
                 .pos = pos_key(dir_block[0], dir_block[1], dir_block[2]),
             };
 
             if(dir_block[0] >= 0 && dir_block[1] >= 0 && dir_block[2] >= 0 && dir_block[0] < map_size_x
                && dir_block[1] < map_size_y && dir_block[2] < map_size_z && !ht_contains(&closedlist, &block.pos)
-               && !map_isair(dir_block[0], dir_block[1], dir_block[2])) {
+               && !air[k]) {
                 minheap_put(&openlist, &block);
                 uint32_t color = map_get(dir_block[0], dir_block[1], dir_block[2]);
                 ht_insert(&closedlist, &block.pos, &color);
@@ -294,9 +352,30 @@ static bool map_update_physics_sub(struct map_collapsing* collapsing, int x, int
 
     minheap_destroy(&openlist);
 
-    float pivot[3] = {0, 0, 0};
-    ht_iterate(&closedlist, pivot, falling_blocks_pivot);
+    pthread_mutex_lock(&map_physics_lock);
+
+    // another task found the same structure first
+    if(ht_iterate(&closedlist, NULL, falling_blocks_solid)) {
+        pthread_mutex_unlock(&map_physics_lock);
+        ht_destroy(&closedlist);
+        return false;
+    }
+
+    struct falling_blocks_removal removal = {
+        .pivot = {0, 0, 0},
+        .edits = (struct map_edit*)malloc(closedlist.size * sizeof(struct map_edit)),
+        .count = 0,
+    };
+    CHECK_ALLOCATION_ERROR(removal.edits)
+
+    ht_iterate(&closedlist, &removal, falling_blocks_pivot);
+    map_set_many(removal.edits, removal.count);
+
+    pthread_mutex_unlock(&map_physics_lock);
+
+    free(removal.edits);
 
+    float* pivot = removal.pivot;
     for(size_t k = 0; k < 3; k++)
         pivot[k] = (pivot[k] / (float)closedlist.size) + 0.5F;
 
@@ -459,26 +538,43 @@ void map_collapsing_update(float dt) {
     entitysys_iterate(&map_collapsing_structures, &dt, falling_blocks_update);
 }
 
+size_t map_collapsing_count() {
+    return map_collapsing_structures.count;
+}
+
+// blocks until every collapse check submitted by map_update_physics() is done
+void map_update_physics_wait() {
+    threadpool_wait(&map_physics_group);
+}
+
+static void falling_blocks_task(void* data) {
+    struct map_work_packet* work = (struct map_work_packet*)data;
+
+    struct map_collapsing collapsing;
+    if(map_update_physics_sub(&collapsing, work->x, work->y, work->z))
+        channel_put(&map_result_queue, &collapsing);
+}
+
 void map_update_physics(int x, int y, int z) {
-    map_work_packet below {.x = x, .y = y - 1, .z = z};
-    map_work_packet above {.x = x, .y = y + 1, .z = z};
-    map_work_packet left  {.x = x, .y = y, .z = z - 1};
-    map_work_packet right {.x = x, .y = y, .z = z + 1};
-    map_work_packet front {.x = x + 1, .y = y, .z = z};
-    map_work_packet back  {.x = x - 1, .y = y, .z = z};
-
-    if(x + 1 < map_size_x && !map_isair(x + 1, y, z))
-        channel_put(&map_work_queue, &front);
-    if(x >= 1 && !map_isair(x - 1, y, z))
-        channel_put(&map_work_queue, &back);
-    if(z + 1 < map_size_z && !map_isair(x, y, z + 1))
-        channel_put(&map_work_queue, &right);
-    if(z >= 1 && !map_isair(x, y, z - 1))
-        channel_put(&map_work_queue, &left);
-    if(y >= 3 && !map_isair(x, y - 1, z)) // don't check ground layers
-        channel_put(&map_work_queue, &below);
-    if(y + 1 < map_size_y && !map_isair(x, y + 1, z))
-        channel_put(&map_work_queue, &above);
+    struct Point neighbours[] {
+        {x + 1, y, z}, {x - 1, y, z}, {x, y, z + 1}, {x, y, z - 1}, {x, y - 1, z}, {x, y + 1, z},
+    };
+
+    bool valid[] {
+        x + 1 < map_size_x, x >= 1, z + 1 < map_size_z, z >= 1,
+        y >= 3, // don't check ground layers
+        y + 1 < map_size_y,
+    };
+
+    bool air[6];
+    map_isair_many(neighbours, 6, air);
+
+    for(size_t k = 0; k < 6; k++) {
+        if(valid[k] && !air[k]) {
+            map_work_packet work {.x = neighbours[k].x, .y = neighbours[k].y, .z = neighbours[k].z};
+            threadpool_submit(THREADPOOL_HIGH, falling_blocks_task, &work, sizeof(work), &map_physics_group);
+        }
+    }
 }
 
 // see this for details: https://github.com/infogulch/pyspades/blob/protocol075/pyspades/vxl_c.cpp#L380
@@ -494,19 +590,6 @@ float map_sunblock(int x, int y, int z) {
     return (float)i / 127.0F;
 }
 
-void* falling_blocks_worker(void* user) {
-    while(1) {
-        struct map_work_packet work;
-        channel_await(&map_work_queue, &work);
-
-        struct map_collapsing collapsing;
-        if(map_update_physics_sub(&collapsing, work.x, work.y, work.z))
-            channel_put(&map_result_queue, &collapsing);
-    }
-
-    return NULL;
-}
-
 void map_init() {
     libvxl_create(&map, 512, 512, 64, 0, 0);
     tesselator_create(&map_damaged_tesselator, VERTEX_INT, 0);
@@ -518,83 +601,137 @@ void map_init() {
 
     entitysys_create(&map_collapsing_structures, sizeof(struct map_collapsing), 32);
 
-    channel_create(&map_work_queue, sizeof(struct map_work_packet), 16);
     channel_create(&map_result_queue, sizeof(struct map_collapsing), 16);
-
-    pthread_t worker;
-    pthread_create(&worker, NULL, falling_blocks_worker, NULL);
+    pthread_mutex_init(&map_physics_lock, NULL);
+    threadpool_group_create(&map_physics_group);
 }
 
 int map_height_at(int x, int z) {
-    int result[2];
-    pthread_rwlock_rdlock(&map_lock);
-    libvxl_map_gettop(&map, x, z, (uint32_t*) result);
-    pthread_rwlock_unlock(&map_lock);
-    return map_size_y - 1 - result[1];
+    if(x < 0 || z < 0 || x >= map_size_x || z >= map_size_z)
+        return 0;
+
+    unsigned int sequence;
+    int top;
+
+    do {
+        sequence = map_read_begin();
+
+        for(top = 0; top < map_size_y; top++)
+            if(libvxl_map_issolid(&map, x, z, top))
+                break;
+    } while(map_read_retry(sequence));
+
+    return map_size_y - 1 - top;
 }
 
 bool map_isair(int x, int y, int z) {
-    pthread_rwlock_rdlock(&map_lock);
-    bool result = !libvxl_map_issolid(&map, x, z, map_size_y - 1 - y);
-    pthread_rwlock_unlock(&map_lock);
+    unsigned int sequence;
+    bool result;
+
+    do {
+        sequence = map_read_begin();
+        result = !libvxl_map_issolid(&map, x, z, map_size_y - 1 - y);
+    } while(map_read_retry(sequence));
 
     return result;
 }
 
+// answers many queries with a single consistent view of the map, air[k] tells if points[k] is air
+void map_isair_many(struct Point* points, size_t count, bool* air) {
+    unsigned int sequence;
+
+    do {
+        sequence = map_read_begin();
+
+        for(size_t k = 0; k < count; k++)
+            air[k] = !libvxl_map_issolid(&map, points[k].x, points[k].z, map_size_y - 1 - points[k].y);
+    } while(map_read_retry(sequence));
+}
+
 unsigned int map_get(int x, int y, int z) {
+    // block lists are reallocated while editing, so only air can be answered without the lock
+    if(map_isair(x, y, z))
+        return rgb2bgr(0);
+
     pthread_rwlock_rdlock(&map_lock);
     unsigned int result = libvxl_map_get(&map, x, z, map_size_y - 1 - y);
     pthread_rwlock_unlock(&map_lock);
     return rgb2bgr(result);
 }
 
-void map_set(int x, int y, int z, unsigned int color) {
-    if(x < 0 || y < 0 || z < 0 || x >= map_size_x || y >= map_size_y || z >= map_size_z)
-        return;
-
-    pthread_rwlock_wrlock(&map_lock);
-
-    if(color == 0xFFFFFFFF) {
-        libvxl_map_setair(&map, x, z, map_size_y - 1 - y);
-    } else {
-        libvxl_map_set(&map, x, z, map_size_y - 1 - y, rgb2bgr(color));
-    }
-
-    pthread_rwlock_unlock(&map_lock);
+static void map_dirty_chunk(uint8_t* dirty, int x, int y, int z) {
+    dirty[(x / CHUNK_SIZE) + (z / CHUNK_SIZE) * CHUNKS_PER_DIM] |= chunk_block_sections(y);
+}
 
-    chunk_block_update(x, y, z);
+// marks every chunk whose mesh depends on the block at x, y, z
+static void map_dirty_chunks(uint8_t* dirty, int x, int y, int z) {
+    map_dirty_chunk(dirty, x, y, z);
 
     int x_off = x % CHUNK_SIZE;
     int z_off = z % CHUNK_SIZE;
 
     if(x > 0 && x_off == 0)
-        chunk_block_update(x - 1, y, z);
+        map_dirty_chunk(dirty, x - 1, y, z);
     if(z > 0 && z_off == 0)
-        chunk_block_update(x, y, z - 1);
+        map_dirty_chunk(dirty, x, y, z - 1);
     if(x < map_size_x - 1 && x_off == CHUNK_SIZE - 1)
-        chunk_block_update(x + 1, y, z);
+        map_dirty_chunk(dirty, x + 1, y, z);
     if(z < map_size_z - 1 && z_off == CHUNK_SIZE - 1)
-        chunk_block_update(x, y, z + 1);
+        map_dirty_chunk(dirty, x, y, z + 1);
 
     if(settings.ambient_occlusion) {
         if(x > 0 && z > 0 && x_off == 0 && z_off == 0)
-            chunk_block_update(x - 1, y, z - 1);
+            map_dirty_chunk(dirty, x - 1, y, z - 1);
         if(x < map_size_x - 1 && z < map_size_z - 1 && x_off == CHUNK_SIZE - 1 && z_off == CHUNK_SIZE - 1)
-            chunk_block_update(x + 1, y, z + 1);
+            map_dirty_chunk(dirty, x + 1, y, z + 1);
         if(x > 0 && z < map_size_z - 1 && x_off == 0 && z_off == CHUNK_SIZE - 1)
-            chunk_block_update(x - 1, y, z + 1);
+            map_dirty_chunk(dirty, x - 1, y, z + 1);
         if(x < map_size_x - 1 && z > 0 && x_off == CHUNK_SIZE - 1 && z_off == 0)
-            chunk_block_update(x + 1, y, z - 1);
+            map_dirty_chunk(dirty, x + 1, y, z - 1);
     }
 
     if(x == 0)
-        chunk_block_update(map_size_x - 1, y, z);
+        map_dirty_chunk(dirty, map_size_x - 1, y, z);
     if(x == map_size_x - 1)
-        chunk_block_update(0, y, z);
+        map_dirty_chunk(dirty, 0, y, z);
     if(z == 0)
-        chunk_block_update(x, y, map_size_z - 1);
+        map_dirty_chunk(dirty, x, y, map_size_z - 1);
     if(z == map_size_z - 1)
-        chunk_block_update(x, y, 0);
+        map_dirty_chunk(dirty, x, y, 0);
+}
+
+void map_set(int x, int y, int z, unsigned int color) {
+    struct map_edit edit = {.x = x, .y = y, .z = z, .color = color};
+    map_set_many(&edit, 1);
+}
+
+// applies all edits under one write lock and queues every affected chunk once
+void map_set_many(struct map_edit* edits, size_t count) {
+    uint8_t dirty[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
+    memset(dirty, 0, sizeof(dirty));
+
+    pthread_rwlock_wrlock(&map_lock);
+    map_write_begin();
+
+    for(size_t k = 0; k < count; k++) {
+        struct map_edit* e = edits + k;
+
+        if(e->x < 0 || e->y < 0 || e->z < 0 || e->x >= map_size_x || e->y >= map_size_y || e->z >= map_size_z)
+            continue;
+
+        if(e->color == 0xFFFFFFFF) {
+            libvxl_map_setair(&map, e->x, e->z, map_size_y - 1 - e->y);
+        } else {
+            libvxl_map_set(&map, e->x, e->z, map_size_y - 1 - e->y, rgb2bgr(e->color));
+        }
+
+        map_dirty_chunks(dirty, e->x, e->y, e->z);
+    }
+
+    map_write_end();
+    pthread_rwlock_unlock(&map_lock);
+
+    chunk_block_update(dirty);
 }
 
 // Copyright (c) Mathias Kaerlev 2011-2012 (but might be original code by Ben himself)
@@ -718,21 +855,541 @@ int map_placedblock_color(int color) {
     return color ^ (gkrand & 0x70707);
 }
 
-void map_vxl_load(uintptr_t v, size_t size) {
+// regions of the map decoded by a single task
+#define MAP_DECODE_BATCH 32
+
+struct map_decode_packet {
+    struct libvxl_decode* decode;
+    size_t first, count;
+};
+
+static void map_decode_task(void* data) {
+    struct map_decode_packet* p = (struct map_decode_packet*)data;
+    for(size_t k = p->first; k < p->first + p->count; k++)
+        libvxl_decode_region(p->decode, k);
+}
+
+// columns are located first, then all regions are decoded on the thread pool
+static bool map_vxl_decode(struct libvxl_map* result, uintptr_t v, size_t size) {
+    if(!v)
+        return libvxl_create(result, map_size_x, map_size_z, map_size_y, 0, 0);
+
+    struct libvxl_decode decode;
+    if(!libvxl_decode_scan(&decode, result, map_size_x, map_size_z, map_size_y, v, size))
+        return false;
+
+    size_t regions = libvxl_decode_regions(&decode);
+
+    if(libvxl_decode_concurrent(&decode)) {
+        struct threadpool_group group;
+        threadpool_group_create(&group);
+
+        for(size_t k = 0; k < regions; k += MAP_DECODE_BATCH) {
+            struct map_decode_packet packet = {
+                .decode = &decode,
+                .first = k,
+                .count = minc(regions - k, (size_t)MAP_DECODE_BATCH),
+            };
+            threadpool_submit(THREADPOOL_HIGH, map_decode_task, &packet, sizeof(packet), &group);
+        }
+
+        threadpool_wait(&group);
+        threadpool_group_destroy(&group);
+    } else {
+        for(size_t k = 0; k < regions; k++)
+            libvxl_decode_region(&decode, k);
+    }
+
+    libvxl_decode_finish(&decode);
+    return true;
+}
+
+bool map_vxl_load(uintptr_t v, size_t size) {
+    // decode outside of the lock, readers are only blocked while swapping maps
+    struct libvxl_map loaded;
+
+    if(!map_vxl_decode(&loaded, v, size)) {
+        log_warn("Map data is truncated, keeping previous map");
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&map_lock);
+    map_write_begin();
+    libvxl_map_replace(&map, &loaded);
+    map_write_end();
+    pthread_rwlock_unlock(&map_lock);
+    return true;
+}
+
+bool map_decoded_load(const void* data, size_t len) {
+    struct libvxl_map loaded;
+
+    if(!libvxl_decoded_create(&loaded, data, len))
+        return false;
+
+    if(loaded.width != (size_t)map_size_x || loaded.height != (size_t)map_size_z
+       || loaded.depth != (size_t)map_size_y) {
+        libvxl_free(&loaded);
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&map_lock);
+    map_write_begin();
+    libvxl_map_replace(&map, &loaded);
+    map_write_end();
+    pthread_rwlock_unlock(&map_lock);
+
+    return true;
+}
+
+void* map_decoded_save(size_t* len) {
+    pthread_rwlock_rdlock(&map_lock);
+    *len = libvxl_decoded_size(&map);
+    void* data = malloc(*len);
+    CHECK_ALLOCATION_ERROR(data)
+    libvxl_decoded_write(&map, data);
+    pthread_rwlock_unlock(&map_lock);
+
+    return data;
+}
+
+static struct libvxl_map map_streamed;
+static struct libvxl_decoder map_decoder;
+static bool map_streaming = false;
+
+// a map that is still arriving is decoded aside and only swapped in once complete
+void map_vxl_stream_begin(void) {
+    map_vxl_stream_cancel();
+
+    libvxl_decoder_create(&map_decoder, &map_streamed, 512, 512, 64);
+    map_streaming = true;
+}
+
+void map_vxl_stream_cancel(void) {
+    if(map_streaming && libvxl_decoder_finish(&map_decoder))
+        libvxl_free(&map_streamed);
+
+    map_streaming = false;
+}
+
+size_t map_vxl_stream_write(const void* data, size_t len) {
+    return map_streaming ? libvxl_decoder_write(&map_decoder, data, len) : 0;
+}
+
+bool map_vxl_stream_end(void) {
+    if(!map_streaming)
+        return false;
+
+    map_streaming = false;
+
+    if(!libvxl_decoder_finish(&map_decoder))
+        return false;
+
+    pthread_rwlock_wrlock(&map_lock);
+    map_write_begin();
+    libvxl_map_replace(&map, &map_streamed);
+    map_write_end();
+    pthread_rwlock_unlock(&map_lock);
+
+    return true;
+}
+
+// rows of the map encoded by a single task, must be a multiple of LIBVXL_CHUNK_SIZE
+#define MAP_SAVE_BAND LIBVXL_CHUNK_SIZE
+#define MAP_SAVE_BANDS_MAX 64
+
+// saves encode a snapshot on the thread pool, the map stays editable meanwhile
+static struct {
+    struct libvxl_map snapshot;
+    char* filename;
+    void* bands[MAP_SAVE_BANDS_MAX];
+    size_t lengths[MAP_SAVE_BANDS_MAX];
+    size_t band_count;
+    size_t pending;
+    bool running;
+    bool finished;
+    bool written;
+    float start;
+    float duration;
+} map_save;
+
+struct map_save_packet {
+    size_t band;
+};
+
+static void map_save_write(void) {
+    FILE* f = fopen(map_save.filename, "wb");
+    map_save.written = f != NULL;
+
+    for(size_t k = 0; k < map_save.band_count; k++) {
+        if(f && fwrite(map_save.bands[k], 1, map_save.lengths[k], f) != map_save.lengths[k])
+            map_save.written = false;
+        free(map_save.bands[k]);
+    }
+
+    if(f && fclose(f))
+        map_save.written = false;
+
+    if(!map_save.written)
+        log_error("Could not write map to %s", map_save.filename);
+
+    pthread_rwlock_wrlock(&map_lock);
+    libvxl_snapshot_free(&map, &map_save.snapshot);
+    pthread_rwlock_unlock(&map_lock);
+
+    map_save.duration = window_time() - map_save.start;
+    __atomic_store_n(&map_save.finished, true, __ATOMIC_RELEASE);
+}
+
+static void map_save_task(void* data) {
+    struct map_save_packet* p = (struct map_save_packet*)data;
+    size_t y0 = p->band * MAP_SAVE_BAND;
+    size_t y1 = y0 + MAP_SAVE_BAND;
+
+    map_save.bands[p->band] = malloc(libvxl_write_rows_bound(&map_save.snapshot, y0, y1));
+    CHECK_ALLOCATION_ERROR(map_save.bands[p->band])
+    map_save.lengths[p->band] = libvxl_write_rows(&map_save.snapshot, y0, y1, map_save.bands[p->band]);
+
+    // whoever encodes the last band writes the file
+    if(__atomic_sub_fetch(&map_save.pending, 1, __ATOMIC_ACQ_REL) == 0)
+        map_save_write();
+}
+
+bool map_save_file(const char* filename) {
+    if(map_save.running)
+        return false;
+
+    size_t band_count = (map_size_z + MAP_SAVE_BAND - 1) / MAP_SAVE_BAND;
+    if(band_count > MAP_SAVE_BANDS_MAX)
+        return false;
+
+    free(map_save.filename);
+    map_save.filename = strdup(filename);
+    CHECK_ALLOCATION_ERROR(map_save.filename)
+    map_save.band_count = band_count;
+    map_save.pending = band_count;
+    map_save.running = true;
+    map_save.finished = false;
+    map_save.start = window_time();
+
+    // only geometry is copied, blocks are shared until the map modifies them
     pthread_rwlock_wrlock(&map_lock);
-    libvxl_free(&map);
-    libvxl_create(&map, 512, 512, 64, v, size);
+    libvxl_snapshot(&map, &map_save.snapshot);
     pthread_rwlock_unlock(&map_lock);
+
+    for(size_t k = 0; k < band_count; k++) {
+        struct map_save_packet packet = {.band = k};
+        threadpool_submit(THREADPOOL_LOW, map_save_task, &packet, sizeof(packet), NULL);
+    }
+
+    return true;
+}
+
+float map_save_progress(void) {
+    if(!map_save.running)
+        return -1.0F;
+
+    // writing the file counts as one more band
+    size_t pending = __atomic_load_n(&map_save.pending, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&map_save.finished, __ATOMIC_ACQUIRE))
+        return 1.0F;
+    return (float)(map_save.band_count - pending) / (float)(map_save.band_count + 1);
+}
+
+const char* map_save_finished(float* duration) {
+    if(!map_save.running || !__atomic_load_n(&map_save.finished, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    map_save.running = false;
+    *duration = map_save.written ? map_save.duration : -1.0F;
+    return map_save.filename;
 }
 
-void map_save_file(const char* filename) {
+size_t map_copy_blocks(libvxl_chunk_copy* copy, size_t x, size_t y, size_t border_min_x, size_t border_min_y,
+                       size_t border_max) {
     pthread_rwlock_rdlock(&map_lock);
-    libvxl_writefile(&map, (char*) filename);
+    size_t copied = libvxl_copy_chunk(&map, copy, x, y, border_min_x, border_min_y, border_max);
     pthread_rwlock_unlock(&map_lock);
+    return copied;
 }
 
-void map_copy_blocks(libvxl_chunk_copy* copy, size_t x, size_t y) {
+#define MAP_BENCHMARK_READERS 4
+
+struct map_benchmark_reader {
+    pthread_t thread;
+    bool locked;
+    bool* stop;
+    size_t queries;
+};
+
+// the read path before it went lock-free, for comparison
+static bool map_benchmark_isair_locked(int x, int y, int z) {
     pthread_rwlock_rdlock(&map_lock);
-    libvxl_copy_chunk(&map, copy, x, y);
+    bool result = !libvxl_map_issolid(&map, x, z, map_size_y - 1 - y);
     pthread_rwlock_unlock(&map_lock);
+
+    return result;
+}
+
+static void* map_benchmark_read(void* user) {
+    struct map_benchmark_reader* reader = (struct map_benchmark_reader*)user;
+    uint32_t seed = (uint32_t)(uintptr_t)reader | 1;
+    size_t air = 0;
+
+    while(!__atomic_load_n(reader->stop, __ATOMIC_RELAXED)) {
+        for(int k = 0; k < 1024; k++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            int x = seed % map_size_x;
+            int y = (seed >> 9) % map_size_y;
+            int z = (seed >> 18) % map_size_z;
+
+            air += reader->locked ? map_benchmark_isair_locked(x, y, z) : map_isair(x, y, z);
+        }
+
+        reader->queries += 1024;
+    }
+
+    return (void*)air;
+}
+
+// measures voxel queries per second of several reader threads while all chunks are remeshed and blocks are edited
+void map_benchmark(float duration) {
+    for(int locked = 1; locked >= 0; locked--) {
+        struct map_benchmark_reader readers[MAP_BENCHMARK_READERS];
+        bool stop = false;
+
+        for(int k = 0; k < MAP_BENCHMARK_READERS; k++) {
+            readers[k] = (struct map_benchmark_reader) {.locked = (bool)locked, .stop = &stop, .queries = 0};
+            pthread_create(&readers[k].thread, NULL, map_benchmark_read, readers + k);
+        }
+
+        float start = window_time();
+        size_t edits = 0;
+
+        chunk_rebuild_all();
+
+        while(window_time() - start < duration) {
+            int x = rand() % map_size_x;
+            int z = rand() % map_size_z;
+            int y = map_height_at(x, z);
+
+            map_set(x, y, z, 0xFFFFFFFF);
+            map_set(x, y, z, rgb(rand() % 256, rand() % 256, rand() % 256));
+            edits += 2;
+
+            chunk_queue_blocks();
+            chunk_update_all();
+        }
+
+        __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+
+        size_t queries = 0;
+        for(int k = 0; k < MAP_BENCHMARK_READERS; k++) {
+            pthread_join(readers[k].thread, NULL);
+            queries += readers[k].queries;
+        }
+
+        float elapsed = window_time() - start;
+        log_info("%s reads: %0.2f million queries/s on %i threads, %zu edits", locked ? "locked" : "lock-free",
+                 queries / elapsed / 1000000.0F, MAP_BENCHMARK_READERS, edits);
+    }
+}
+
+// compares two chunk copies of the same map, both have to produce identical meshes
+static bool map_benchmark_copy_equal(struct libvxl_chunk_copy* a, struct libvxl_chunk_copy* b) {
+    size_t sg = (a->window_x * a->window_y * a->depth + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8);
+
+    return a->blocks_sorted_count == b->blocks_sorted_count
+        && !memcmp(a->blocks_sorted, b->blocks_sorted, a->blocks_sorted_count * sizeof(struct libvxl_block))
+        && !memcmp(a->geometry, b->geometry, sg * sizeof(size_t));
+}
+
+static size_t map_benchmark_storage_compare(struct libvxl_map* vxl, struct libvxl_columns* columns) {
+    size_t mismatches = 0;
+
+    for(size_t y = 0; y < vxl->height; y += CHUNK_SIZE) {
+        for(size_t x = 0; x < vxl->width; x += CHUNK_SIZE) {
+            struct libvxl_chunk_copy a, b;
+            libvxl_copy_chunk(vxl, &a, x, y, CHUNK_COPY_BORDER_MIN_X, CHUNK_COPY_BORDER_MIN_Z,
+                              CHUNK_COPY_BORDER_MAX);
+            libvxl_columns_copy_chunk(columns, &b, x, y, CHUNK_COPY_BORDER_MIN_X, CHUNK_COPY_BORDER_MIN_Z,
+                                      CHUNK_COPY_BORDER_MAX);
+
+            if(!map_benchmark_copy_equal(&a, &b))
+                mismatches++;
+
+            libvxl_copy_chunk_destroy(&a);
+            libvxl_copy_chunk_destroy(&b);
+        }
+    }
+
+    return mismatches;
+}
+
+static float map_benchmark_storage_mesh(void* storage, bool columns) {
+    struct tesselator tess[CHUNK_SECTIONS];
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        tesselator_create(tess + s, VERTEX_INT, 0);
+
+    float start = window_time();
+
+    for(size_t y = 0; y < 512; y += CHUNK_SIZE) {
+        for(size_t x = 0; x < 512; x += CHUNK_SIZE) {
+            struct libvxl_chunk_copy blocks;
+            int max_height;
+
+            if(columns)
+                libvxl_columns_copy_chunk((struct libvxl_columns*)storage, &blocks, x, y, CHUNK_COPY_BORDER_MIN_X,
+                                          CHUNK_COPY_BORDER_MIN_Z, CHUNK_COPY_BORDER_MAX);
+            else
+                libvxl_copy_chunk((struct libvxl_map*)storage, &blocks, x, y, CHUNK_COPY_BORDER_MIN_X,
+                                  CHUNK_COPY_BORDER_MIN_Z, CHUNK_COPY_BORDER_MAX);
+
+            chunk_generate_bitmask(&blocks, tess, &max_height, 1, CHUNK_SECTIONS_ALL);
+            libvxl_copy_chunk_destroy(&blocks);
+
+            for(int s = 0; s < CHUNK_SECTIONS; s++)
+                tesselator_clear(tess + s);
+        }
+    }
+
+    float elapsed = window_time() - start;
+
+    for(int s = 0; s < CHUNK_SECTIONS; s++)
+        tesselator_free(tess + s);
+
+    return elapsed;
+}
+
+#define MAP_BENCHMARK_STORAGE_EDITS 200000
+
+// A/B comparison of the chunked libvxl map against the column representation: load, random edits and meshing
+void map_benchmark_storage(uintptr_t data, size_t len) {
+    struct libvxl_map vxl;
+    struct libvxl_columns columns;
+
+    float start = window_time();
+    if(!libvxl_create(&vxl, 512, 512, 64, data, len)) {
+        log_error("Map could not be decoded");
+        return;
+    }
+    float vxl_load = window_time() - start;
+
+    start = window_time();
+    if(!libvxl_columns_create(&columns, 512, 512, 64, data, len)) {
+        log_error("Map could not be decoded into columns");
+        libvxl_columns_free(&columns);
+        libvxl_free(&vxl);
+        return;
+    }
+    float columns_load = window_time() - start;
+
+    log_info("load: %0.2fms chunks, %0.2fms columns", vxl_load * 1000.0F, columns_load * 1000.0F);
+    log_info("chunk copies differing after load: %zu", map_benchmark_storage_compare(&vxl, &columns));
+
+    struct map_edit* edits = (struct map_edit*)malloc(MAP_BENCHMARK_STORAGE_EDITS * sizeof(struct map_edit));
+    CHECK_ALLOCATION_ERROR(edits)
+
+    uint32_t seed = 0x9E3779B9;
+    for(size_t k = 0; k < MAP_BENCHMARK_STORAGE_EDITS; k++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        edits[k] = (struct map_edit) {
+            .x = (int)(seed % 512),
+            .y = (int)((seed >> 9) % 512),
+            .z = (int)((seed >> 18) % 64),
+            .color = (seed & 1) ? 0xFFFFFFFF : (seed >> 8) & 0xFFFFFF,
+        };
+    }
+
+    start = window_time();
+    for(size_t k = 0; k < MAP_BENCHMARK_STORAGE_EDITS; k++) {
+        if(edits[k].color == 0xFFFFFFFF)
+            libvxl_map_setair(&vxl, edits[k].x, edits[k].y, edits[k].z);
+        else
+            libvxl_map_set(&vxl, edits[k].x, edits[k].y, edits[k].z, edits[k].color);
+    }
+    float vxl_edit = window_time() - start;
+
+    start = window_time();
+    for(size_t k = 0; k < MAP_BENCHMARK_STORAGE_EDITS; k++) {
+        if(edits[k].color == 0xFFFFFFFF)
+            libvxl_columns_setair(&columns, edits[k].x, edits[k].y, edits[k].z);
+        else
+            libvxl_columns_set(&columns, edits[k].x, edits[k].y, edits[k].z, edits[k].color);
+    }
+    float columns_edit = window_time() - start;
+
+    free(edits);
+
+    log_info("%i random edits: %0.2fms chunks, %0.2fms columns", MAP_BENCHMARK_STORAGE_EDITS, vxl_edit * 1000.0F,
+             columns_edit * 1000.0F);
+    log_info("chunk copies differing after edits: %zu", map_benchmark_storage_compare(&vxl, &columns));
+
+    float vxl_mesh = map_benchmark_storage_mesh(&vxl, false);
+    float columns_mesh = map_benchmark_storage_mesh(&columns, true);
+
+    log_info("full map mesh: %0.2fms chunks, %0.2fms columns", vxl_mesh * 1000.0F, columns_mesh * 1000.0F);
+
+    libvxl_free(&vxl);
+    libvxl_columns_free(&columns);
+}
+
+static bool map_benchmark_map_equal(struct libvxl_map* a, struct libvxl_map* b) {
+    size_t chunks = (a->width / LIBVXL_CHUNK_SIZE) * (a->height / LIBVXL_CHUNK_SIZE);
+    size_t sg = (a->width * a->height * a->depth + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8);
+
+    if(memcmp(a->geometry, b->geometry, sg * sizeof(size_t)))
+        return false;
+
+    for(size_t k = 0; k < chunks; k++)
+        if(a->chunks[k].index != b->chunks[k].index
+           || memcmp(a->chunks[k].blocks, b->chunks[k].blocks, a->chunks[k].index * sizeof(struct libvxl_block)))
+            return false;
+
+    return true;
+}
+
+// decodes a map column by column as before, in regions on one thread and on the thread pool
+void map_benchmark_load(uintptr_t data, size_t len, const char* name) {
+    struct libvxl_map reference, serial, parallel;
+
+    float start = window_time();
+    if(!libvxl_create_reference(&reference, map_size_x, map_size_z, map_size_y, data, len)) {
+        log_error("%s: could not be decoded", name);
+        return;
+    }
+    float sequential_time = window_time() - start;
+
+    start = window_time();
+    if(!libvxl_create(&serial, map_size_x, map_size_z, map_size_y, data, len)) {
+        log_error("%s: could not be decoded in regions", name);
+        libvxl_free(&reference);
+        return;
+    }
+    float serial_time = window_time() - start;
+
+    start = window_time();
+    if(!map_vxl_decode(&parallel, data, len)) {
+        log_error("%s: could not be decoded in parallel", name);
+        libvxl_free(&reference);
+        libvxl_free(&serial);
+        return;
+    }
+    float parallel_time = window_time() - start;
+
+    bool identical = map_benchmark_map_equal(&reference, &serial) && map_benchmark_map_equal(&reference, &parallel);
+
+    log_info("%s: %0.1fms sequential, %0.1fms in regions, %0.1fms in parallel, %s", name,
+             sequential_time * 1000.0F, serial_time * 1000.0F, parallel_time * 1000.0F,
+             identical ? "identical" : "OUTPUT DIFFERS");
+
+    libvxl_free(&reference);
+    libvxl_free(&serial);
+    libvxl_free(&parallel);
 }
@@ -34,6 +34,12 @@ struct Point {
     int x, y, z;
 };
 
+// a single voxel change, color 0xFFFFFFFF removes the block
+struct map_edit {
+    int x, y, z;
+    unsigned int color;
+};
+
 void map_init();
 int map_object_visible(float x, float y, float z);
 int map_damage(int x, int y, int z, int damage);
@@ -41,18 +47,37 @@ int map_damage_get(int x, int y, int z);
 bool map_damage_action(int x, int y, int z);
 void map_damaged_voxels_render();
 void map_update_physics(int x, int y, int z);
+void map_update_physics_wait(void);
 float map_sunblock(int x, int y, int z);
 bool map_isair(int x, int y, int z);
+void map_isair_many(struct Point* points, size_t count, bool* air);
 unsigned int map_get(int x, int y, int z);
 void map_set(int x, int y, int z, unsigned int color);
+void map_set_many(struct map_edit* edits, size_t count);
 int map_cube_line(int x1, int y1, int z1, int x2, int y2, int z2, struct Point* cube_array);
 void map_vxl_setgeom(int x, int y, int z, unsigned int t, unsigned int* map);
 void map_vxl_setcolor(int x, int y, int z, unsigned int t, unsigned int* map);
 int map_dirt_color(int x, int y, int z);
 int map_placedblock_color(int color);
-void map_vxl_load(uintptr_t v, size_t size);
+bool map_vxl_load(uintptr_t v, size_t size);
+void map_vxl_stream_begin(void);
+void map_vxl_stream_cancel(void);
+size_t map_vxl_stream_write(const void* data, size_t len);
+bool map_vxl_stream_end(void);
+bool map_decoded_load(const void* data, size_t len);
+void* map_decoded_save(size_t* len);
 void map_collapsing_render(void);
 void map_collapsing_update(float dt);
+size_t map_collapsing_count(void);
 int map_height_at(int x, int z);
-void map_save_file(const char* filename);
-void map_copy_blocks(struct libvxl_chunk_copy* copy, size_t x, size_t y);
+// starts saving the map in the background, returns false if a save is already running
+bool map_save_file(const char* filename);
+// fraction of the running save that is done, negative if there is none
+float map_save_progress(void);
+// filename of a save that has finished since the last call or NULL, duration is negative if writing failed
+const char* map_save_finished(float* duration);
+size_t map_copy_blocks(struct libvxl_chunk_copy* copy, size_t x, size_t y, size_t border_min_x, size_t border_min_y,
+                       size_t border_max);
+void map_benchmark(float duration);
+void map_benchmark_storage(uintptr_t data, size_t len);
+void map_benchmark_load(uintptr_t data, size_t len, const char* name);
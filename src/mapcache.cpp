@@ -0,0 +1,196 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <utime.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <common.hpp>
+#include <file.hpp>
+#include <log.hpp>
+#include <map.hpp>
+#include <threadpool.hpp>
+#include <window.hpp>
+#include <mapcache.hpp>
+
+// serializes write-backs, so eviction never sees a file that is still being written
+static pthread_mutex_t mapcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool mapcache_enabled = true;
+
+struct mapcache_entry {
+    char filename[64];
+    size_t size;
+    time_t used;
+};
+
+struct mapcache_write {
+    uint32_t crc;
+    void* data;
+    size_t size;
+};
+
+static int mapcache_entry_cmp(const void* a, const void* b) {
+    const struct mapcache_entry* aa = (const struct mapcache_entry*)a;
+    const struct mapcache_entry* bb = (const struct mapcache_entry*)b;
+    return (aa->used > bb->used) - (aa->used < bb->used);
+}
+
+static void mapcache_evict(void) {
+    DIR* d = opendir("cache");
+    if(!d)
+        return;
+
+    size_t length = 16;
+    size_t count = 0;
+    size_t total = 0;
+    struct mapcache_entry* entries = (struct mapcache_entry*)malloc(length * sizeof(struct mapcache_entry));
+    CHECK_ALLOCATION_ERROR(entries)
+
+    struct dirent* e;
+    while((e = readdir(d))) {
+        size_t name_length = strlen(e->d_name);
+        // only decoded maps are evicted, vxl files might have been put here by hand
+        if(name_length != 12 || strcmp(e->d_name + 8, ".vxd"))
+            continue;
+
+        if(count == length) {
+            length *= 2;
+            entries = (struct mapcache_entry*)realloc(entries, length * sizeof(struct mapcache_entry));
+            CHECK_ALLOCATION_ERROR(entries)
+        }
+
+        struct mapcache_entry* entry = entries + count;
+        struct stat st;
+        sprintf(entry->filename, "cache/%s", e->d_name);
+        if(stat(entry->filename, &st) < 0)
+            continue;
+
+        entry->size = st.st_size;
+        entry->used = st.st_mtime;
+        total += entry->size;
+        count++;
+    }
+
+    closedir(d);
+
+    qsort(entries, count, sizeof(struct mapcache_entry), mapcache_entry_cmp);
+
+    // the most recent map always stays
+    for(size_t k = 0; k + 1 < count && total > MAPCACHE_SIZE_MAX; k++) {
+        if(!remove(entries[k].filename)) {
+            log_info("map cache: evicted %s", entries[k].filename);
+            total -= entries[k].size;
+        }
+    }
+
+    free(entries);
+}
+
+static void mapcache_write_task(void* data) {
+    struct mapcache_write* w = (struct mapcache_write*)data;
+    char filename[64], tmp[64];
+    sprintf(filename, "cache/%08X.vxd", w->crc);
+    sprintf(tmp, "cache/%08X.tmp", w->crc);
+
+    pthread_mutex_lock(&mapcache_lock);
+
+    // written under a different name first, an interrupted write never leaves a broken cache entry
+    FILE* f = fopen(tmp, "wb");
+    bool written = f && fwrite(w->data, 1, w->size, f) == w->size;
+    if(f)
+        fclose(f);
+
+    if(written) {
+        remove(filename);
+        written = !rename(tmp, filename);
+    } else {
+        remove(tmp);
+    }
+
+    if(written) {
+        log_info("map cache: stored %s (%zu KB)", filename, w->size / 1024);
+        mapcache_evict();
+    } else {
+        log_warn("map cache: could not write %s", filename);
+    }
+
+    pthread_mutex_unlock(&mapcache_lock);
+
+    free(w->data);
+}
+
+bool mapcache_load(uint32_t crc) {
+    if(!mapcache_enabled)
+        return false;
+
+    char filename[64];
+    float start = window_time();
+
+    sprintf(filename, "cache/%08X.vxd", crc);
+
+    size_t size;
+    void* data = file_map(filename, &size);
+    if(data) {
+        bool loaded = map_decoded_load(data, size);
+        file_unmap(data, size);
+
+        if(loaded) {
+            utime(filename, NULL); // marks it as recently used
+            log_info("map cache: loaded %s in %0.1fms", filename, (window_time() - start) * 1000.0F);
+            return true;
+        }
+
+        log_warn("map cache: discarding invalid %s", filename);
+        remove(filename);
+    }
+
+    // vxl files put into the cache by hand, they are stored decoded for the next time
+    sprintf(filename, "cache/%02X%02X%02X%02X.vxl", red(crc), green(crc), blue(crc), alpha(crc));
+    if(file_exists(filename)) {
+        void* mapd = file_load(filename);
+        bool loaded = mapd && map_vxl_load((uintptr_t)mapd, file_size(filename));
+        free(mapd);
+
+        if(loaded) {
+            log_info("map cache: loaded %s in %0.1fms", filename, (window_time() - start) * 1000.0F);
+            mapcache_store(crc);
+            return true;
+        }
+
+        log_warn("map cache: could not load %s", filename);
+    }
+
+    return false;
+}
+
+// the current map is copied right away, so later block edits don't end up in the cache
+void mapcache_store(uint32_t crc) {
+    if(!mapcache_enabled)
+        return;
+
+    struct mapcache_write w;
+    w.crc = crc;
+    w.data = map_decoded_save(&w.size);
+    threadpool_submit(THREADPOOL_LOW, mapcache_write_task, &w, sizeof(w), NULL);
+}
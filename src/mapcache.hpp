@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// decoded maps are kept in cache/ by the crc32 of their vxl data, least recently used ones go first
+#define MAPCACHE_SIZE_MAX (256 * 1024 * 1024)
+
+// while false, mapcache_load() misses and mapcache_store() does nothing
+extern bool mapcache_enabled;
+
+bool mapcache_load(uint32_t crc);
+void mapcache_store(uint32_t crc);
@@ -19,9 +19,13 @@
 
 #include <enet/enet.h>
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
-#include "libdeflate.h"
+#include <zlib.h>
 #include <texture.hpp>
 #include <common.hpp>
 #include <sound.hpp>
@@ -37,6 +41,9 @@
 #include <particle.hpp>
 #include <texture.hpp>
 #include <chunk.hpp>
+#include <mapcache.hpp>
+#include <config.hpp>
+#include <ringbuffer.hpp>
 
 void (*packets[256])(void* data, int len) = {NULL};
 
@@ -54,14 +61,42 @@ unsigned char network_keys_last = 0;
 unsigned char network_buttons_last = 0;
 unsigned char network_tool_last = 255;
 
-uintptr_t compressed_chunk_data;
-int compressed_chunk_data_size;
 int compressed_chunk_data_offset = 0;
 int compressed_chunk_data_estimate = 0;
 
+// map data is inflated and decoded while it arrives, so little is left to do once StateData comes in
+static z_stream network_inflate;
+static bool network_inflating = false;
+static float network_map_start;
+static uint32_t network_map_crc;
+static uint32_t network_map_crc_announced;
+static bool network_map_crc_known = false;
+
 struct network_stat network_stats[40];
 float network_stats_last = 0.0F;
 
+struct network_packet_stat network_packet_stats[256];
+const char* network_packet_names[256] = {NULL};
+
+// appended to a csv file in logs/ while connected, if enabled in the config
+#define NETWORK_TELEMETRY_INTERVAL 10.0F
+static char network_telemetry_file[64];
+static float network_telemetry_last;
+
+// time between calls of network_update(), once per frame, logged with the telemetry
+static double network_frame_last = 0.0;
+static double network_frame_total;
+static float network_frame_max;
+static int network_frame_count;
+
+// received packets are written to logs/ while connected, if enabled in the config, and can be fed through the client
+// again with network_benchmark_replay(). After an 8 byte header, each packet is stored as the microseconds since the
+// previous one and its length, both as LEB128 varints, followed by its data.
+#define NETWORK_CAPTURE_MAGIC "BSCP"
+#define NETWORK_CAPTURE_VERSION 1
+static FILE* network_capture;
+static uint64_t network_capture_time;
+
 ENetHost* client;
 ENetPeer* peer;
 
@@ -95,16 +130,74 @@ static void printJoinMsg(int team, char* name) {
     chat_add(0, 0x0000FF, s);
 }
 
-void read_PacketMapChunk(void* data, int len) {
-    // increase allocated memory if it is not enough to store the next chunk
-    if(compressed_chunk_data_offset + len > compressed_chunk_data_size) {
-        compressed_chunk_data_size += 1024 * 1024;
-        compressed_chunk_data = (uintptr_t) realloc((void*) compressed_chunk_data, compressed_chunk_data_size);
-        CHECK_ALLOCATION_ERROR(compressed_chunk_data)
+// the estimate only drives the progress bar, map data is inflated as it arrives and never stored
+static void network_map_begin(int estimate) {
+    compressed_chunk_data_offset = 0;
+    compressed_chunk_data_estimate = estimate;
+    network_map_start = window_time();
+    network_map_crc = crc32(0L, Z_NULL, 0);
+    network_map_crc_known = false;
+
+    if(network_inflating)
+        inflateEnd(&network_inflate);
+
+    network_inflating = false;
+    map_vxl_stream_cancel();
+}
+
+// only once the map is known not to be cached, the decoder allocates a whole map
+static void network_map_stream(void) {
+    memset(&network_inflate, 0, sizeof(network_inflate));
+    network_inflating = inflateInit(&network_inflate) == Z_OK;
+    map_vxl_stream_begin();
+}
+
+static void network_map_inflate(void* data, int len) {
+    static uint8_t out[64 * 1024];
+
+    network_inflate.next_in = (Bytef*)data;
+    network_inflate.avail_in = len;
+
+    do {
+        network_inflate.next_out = out;
+        network_inflate.avail_out = sizeof(out);
+
+        int r = inflate(&network_inflate, Z_NO_FLUSH);
+
+        if(r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+            log_warn("Map data is corrupt: %s", network_inflate.msg ? network_inflate.msg : "unknown error");
+            inflateEnd(&network_inflate);
+            network_inflating = false;
+            return;
+        }
+
+        network_map_crc = crc32(network_map_crc, out, sizeof(out) - network_inflate.avail_out);
+        map_vxl_stream_write(out, sizeof(out) - network_inflate.avail_out);
+
+        if(r == Z_STREAM_END)
+            break;
+    } while(network_inflate.avail_out == 0);
+}
+
+static bool network_map_end(void) {
+    bool complete = network_inflating;
+
+    if(network_inflating) {
+        network_map_inflate(NULL, 0);
+        if(network_inflating)
+            inflateEnd(&network_inflate);
+        network_inflating = false;
     }
+
+    return map_vxl_stream_end() && complete;
+}
+
+void read_PacketMapChunk(void* data, int len) {
     // accept any chunk length for "superior" performance, as pointed out by github/NotAFile
-    memcpy((void*) (compressed_chunk_data + compressed_chunk_data_offset), data, len);
     compressed_chunk_data_offset += len;
+
+    if(network_inflating)
+        network_map_inflate(data, len);
 }
 
 void read_PacketChatMessage(void* data, int len) {
@@ -176,34 +269,44 @@ void read_PacketBlockAction(void* data, int len) {
                 particle_create(col, p->x + 0.5F, 63 - p->z + 0.5F, p->y + 0.5F, 2.5F, 1.0F, 8, 0.1F, 0.25F);
             }
             break;
-        case ACTION_GRENADE:
+        case ACTION_GRENADE: {
+            struct map_edit edits[27];
+            size_t count = 0;
+
             for(int y = (63 - (p->z)) - 1; y <= (63 - (p->z)) + 1; y++) {
                 for(int z = (p->y) - 1; z <= (p->y) + 1; z++) {
                     for(int x = (p->x) - 1; x <= (p->x) + 1; x++) {
-                        if(y > 1) {
-                            map_set(x, y, z, 0xFFFFFFFF);
-                            map_update_physics(x, y, z);
-                        }
+                        if(y > 1)
+                            edits[count++] = (struct map_edit) {.x = x, .y = y, .z = z, .color = 0xFFFFFFFF};
                     }
                 }
             }
+
+            map_set_many(edits, count);
+
+            for(size_t k = 0; k < count; k++)
+                map_update_physics(edits[k].x, edits[k].y, edits[k].z);
             break;
-        case ACTION_SPADE:
-            if((63 - p->z - 1) > 1) {
-                map_set(p->x, 63 - p->z - 1, p->y, 0xFFFFFFFF);
-                map_update_physics(p->x, 63 - p->z - 1, p->y);
+        }
+        case ACTION_SPADE: {
+            struct map_edit edits[3];
+            size_t count = 0;
+            int col = map_get(p->x, 63 - p->z, p->y);
+
+            for(int y = 63 - p->z - 1; y <= 63 - p->z + 1; y++) {
+                if(y > 1)
+                    edits[count++] = (struct map_edit) {.x = p->x, .y = y, .z = p->y, .color = 0xFFFFFFFF};
             }
-            if((63 - p->z + 0) > 1) {
-                int col = map_get(p->x, 63 - p->z, p->y);
-                map_set(p->x, 63 - p->z + 0, p->y, 0xFFFFFFFF);
-                map_update_physics(p->x, 63 - p->z + 0, p->y);
+
+            map_set_many(edits, count);
+
+            for(size_t k = 0; k < count; k++)
+                map_update_physics(edits[k].x, edits[k].y, edits[k].z);
+
+            if((63 - p->z + 0) > 1)
                 particle_create(col, p->x + 0.5F, 63 - p->z + 0.5F, p->y + 0.5F, 2.5F, 1.0F, 8, 0.1F, 0.25F);
-            }
-            if((63 - p->z + 1) > 1) {
-                map_set(p->x, 63 - p->z + 1, p->y, 0xFFFFFFFF);
-                map_update_physics(p->x, 63 - p->z + 1, p->y);
-            }
             break;
+        }
         case ACTION_BUILD:
             if(p->player_id < PLAYERS_MAX) {
                 bool play_sound = map_isair(p->x, 63 - p->z, p->y);
@@ -230,15 +333,22 @@ void read_PacketBlockLine(void* data, int len) {
                     | (players[p->player_id].block.blue << 16));
     } else {
         struct Point blocks[64];
+        struct map_edit edits[64];
+        size_t count = 0;
         int len = map_cube_line(p->sx, p->sy, p->sz, p->ex, p->ey, p->ez, blocks);
         while(len > 0) {
             if(map_isair(blocks[len - 1].x, 63 - blocks[len - 1].z, blocks[len - 1].y)) {
-                map_set(blocks[len - 1].x, 63 - blocks[len - 1].z, blocks[len - 1].y,
-                        players[p->player_id].block.red | (players[p->player_id].block.green << 8)
-                            | (players[p->player_id].block.blue << 16));
+                edits[count++] = (struct map_edit) {
+                    .x = blocks[len - 1].x,
+                    .y = 63 - blocks[len - 1].z,
+                    .z = blocks[len - 1].y,
+                    .color = players[p->player_id].block.red | (players[p->player_id].block.green << 8)
+                        | (players[p->player_id].block.blue << 16),
+                };
             }
             len--;
         }
+        map_set_many(edits, count);
     }
     sound_create(SOUND_WORLD, &sound_build, (p->sx + p->ex) * 0.5F + 0.5F, (63 - p->sz + 63 - p->ez) * 0.5F + 0.5F,
                  (p->sy + p->ey) * 0.5F + 0.5F);
@@ -292,39 +402,24 @@ void read_PacketStateData(void* data, int len) {
 
     log_info("map data was %i bytes", compressed_chunk_data_offset);
     if(!network_map_cached) {
-        int avail_size = 1024 * 1024;
-        void* decompressed = malloc(avail_size);
-        CHECK_ALLOCATION_ERROR(decompressed)
-        size_t decompressed_size;
-        auto d = libdeflate_alloc_decompressor();
-        while(1) {
-            int r = libdeflate_zlib_decompress(d, (void*) compressed_chunk_data, compressed_chunk_data_offset, decompressed,
-                                               avail_size, &decompressed_size);
-            // switch not fancy enough here, breaking out of the loop is not aesthetic
-            if(r == LIBDEFLATE_INSUFFICIENT_SPACE) {
-                avail_size += 1024 * 1024;
-                decompressed = realloc(decompressed, avail_size);
-                CHECK_ALLOCATION_ERROR(decompressed)
-            }
-            if(r == LIBDEFLATE_SUCCESS) {
-                map_vxl_load((uintptr_t) decompressed, decompressed_size);
-/*
-                char filename[128];
-                sprintf(filename, "cache/%08X.vxl", libdeflate_crc32(0, decompressed, decompressed_size));
-                log_info("%s", filename);
-                FILE* f = fopen(filename, "wb");
-                fwrite(decompressed, 1, decompressed_size, f);
-                fclose(f);
-*/
-                chunk_rebuild_all();
-                break;
-            }
-            if(r == LIBDEFLATE_BAD_DATA || r == LIBDEFLATE_SHORT_OUTPUT)
-                break;
+        float start = window_time();
+
+        if(network_map_end()) {
+            chunk_rebuild_all();
+
+            if(network_map_crc_known && network_map_crc == network_map_crc_announced)
+                mapcache_store(network_map_crc);
+            else if(network_map_crc_known)
+                log_warn("map crc32 is 0x%08X instead of 0x%08X, not caching", network_map_crc,
+                         network_map_crc_announced);
+        } else {
+            log_error("Map transfer incomplete");
         }
-        free(decompressed);
-        free((void*) compressed_chunk_data);
-        libdeflate_free_decompressor(d);
+
+        log_info("map ready %0.1fms after state data, %0.2fs after map start", (window_time() - start) * 1000.0F,
+                 window_time() - network_map_start);
+    } else {
+        network_map_end();
     }
 }
 
@@ -413,33 +508,27 @@ void read_PacketPlayerLeft(void* data, int len) {
 }
 
 void read_PacketMapStart(void* data, int len) {
-    // ffs someone fix the wrong map size of 1.5mb
-    compressed_chunk_data_size = 1024 * 1024;
-    compressed_chunk_data = (uintptr_t) malloc(compressed_chunk_data_size);
-    CHECK_ALLOCATION_ERROR(compressed_chunk_data)
-    compressed_chunk_data_offset = 0;
     network_logged_in = 0;
     network_map_transfer = 1;
     network_map_cached = 0;
 
     if(len == sizeof(struct PacketMapStart075)) {
         struct PacketMapStart075* p = (struct PacketMapStart075*)data;
-        compressed_chunk_data_estimate = p->map_size;
+        network_map_begin(p->map_size);
+        network_map_stream();
     } else {
         struct PacketMapStart076* p = (struct PacketMapStart076*)data;
-        compressed_chunk_data_estimate = p->map_size;
+        network_map_begin(p->map_size);
         log_info("map name: %s", p->map_name);
         log_info("map crc32: 0x%08X", p->crc32);
-        char filename[128];
-        sprintf(filename, "cache/%02X%02X%02X%02X.vxl", red(p->crc32), green(p->crc32), blue(p->crc32),
-                alpha(p->crc32));
-        log_info("%s", filename);
-        if(file_exists(filename)) {
+        network_map_crc_announced = p->crc32;
+        network_map_crc_known = true;
+
+        if(mapcache_load(p->crc32)) {
             network_map_cached = 1;
-            void* mapd = file_load(filename);
-            map_vxl_load((uintptr_t) mapd, file_size(filename));
-            free(mapd);
             chunk_rebuild_all();
+        } else {
+            network_map_stream();
         }
 
         struct PacketMapCached c;
@@ -908,80 +997,408 @@ void network_updateColor() {
     network_send(PACKET_SETCOLOR_ID, &c, sizeof(c));
 }
 
-unsigned char network_send_tmp[512];
-void network_send(int id, void* data, int len) {
-    if(network_connected) {
-        network_stats[0].outgoing += len + 1;
-        network_send_tmp[0] = id;
-        memcpy(network_send_tmp + 1, data, len);
-        enet_peer_send(peer, 0, enet_packet_create(network_send_tmp, len + 1, ENET_PACKET_FLAG_RELIABLE));
+// ENet is serviced on its own thread, packets are handed over in both directions by ring buffers
+#define NETWORK_QUEUE_LENGTH 4096
+#define NETWORK_IO_TIMEOUT 1 // ms
+
+// both protocol versions are tried at once, a server disconnects the one it does not speak
+#define NETWORK_CONNECT_TIMEOUT 2.5F
+// a version is accepted with its first packet, or once it stayed connected this long
+#define NETWORK_ACCEPT_TIMEOUT 1.0F
+#define NETWORK_DISCONNECT_TIMEOUT 3.0F
+
+// disconnect reason if the server never answered
+#define NETWORK_NO_RESPONSE 0xFFFFFFFF
+
+struct network_event {
+    ENetEventType type;
+    ENetPacket* packet;
+    enet_uint32 data;
+    double received;
+};
+
+struct network_outgoing {
+    ENetPacket* packet;
+    double queued;
+    bool flush; // last packet of a batch, see network_flush()
+};
+
+// packets of one simulation tick, handed to the network thread together at the configured send rate
+#define NETWORK_BATCH_LENGTH 256
+static ENetPacket* network_batch[NETWORK_BATCH_LENGTH];
+static int network_batch_count = 0;
+static double network_batch_last = 0.0;
+
+static void network_batch_clear(void) {
+    for(int k = 0; k < network_batch_count; k++)
+        if(network_batch[k])
+            enet_packet_destroy(network_batch[k]);
+    network_batch_count = 0;
+}
+
+static struct ringbuffer network_incoming;
+static struct ringbuffer network_outgoing;
+static pthread_t network_io_thread;
+static bool network_io_running = false;
+static bool network_io_stop;
+static bool network_io_finished;
+
+static enum network_state network_connection = NETWORK_DISCONNECTED;
+static char network_host[32];
+static int network_port;
+static double network_connect_start;
+static bool network_first_packet;
+
+// written by the I/O thread, in microseconds
+static unsigned int network_send_delay;
+static unsigned int network_send_jitter;
+
+static bool network_io_stopped(void) {
+    return __atomic_load_n(&network_io_stop, __ATOMIC_ACQUIRE);
+}
+
+static void network_io_send(void) {
+    struct network_outgoing out;
+
+    // the rest of a batch might still be on its way, it is flushed together once its last packet arrives
+    while(ringbuffer_pop(&network_outgoing, &out)) {
+        enet_peer_send(peer, 0, out.packet);
+
+        if(out.flush)
+            enet_host_flush(client);
+
+        // smoothed like RTP interarrival jitter (RFC 3550)
+        int delay = (window_time_precise() - out.queued) * 1000000.0;
+        int previous = __atomic_load_n(&network_send_delay, __ATOMIC_RELAXED);
+        int jitter = __atomic_load_n(&network_send_jitter, __ATOMIC_RELAXED);
+        jitter += (abs(delay - previous) - jitter) / 16;
+        __atomic_store_n(&network_send_delay, delay, __ATOMIC_RELAXED);
+        __atomic_store_n(&network_send_jitter, jitter, __ATOMIC_RELAXED);
     }
 }
 
-unsigned int network_ping() {
-    return network_connected ? peer->roundTripTime : 0;
+// the simulation is behind if the queue is full, ENet is not serviced until there is room
+static void network_io_deliver(ENetEventType type, ENetPacket* packet, enet_uint32 data) {
+    struct network_event event = {
+        .type = type,
+        .packet = packet,
+        .data = data,
+        .received = window_time_precise(),
+    };
+
+    while(!ringbuffer_push(&network_incoming, &event)) {
+        if(network_io_stopped()) {
+            if(packet)
+                enet_packet_destroy(packet);
+            return;
+        }
+
+        if(peer)
+            network_io_send();
+
+        struct timespec ts = {0, NETWORK_IO_TIMEOUT * 1000000};
+        nanosleep(&ts, NULL);
+    }
 }
 
-void network_disconnect() {
-    if(network_connected) {
-        enet_peer_disconnect(peer, 0);
-        network_connected = 0;
-        network_logged_in = 0;
+// returns the peer of the accepted protocol version, NULL if neither was accepted
+static ENetPeer* network_io_connect(void) {
+    ENetAddress address;
+    if(enet_address_set_host(&address, network_host) < 0) {
+        network_io_deliver(ENET_EVENT_TYPE_DISCONNECT, NULL, NETWORK_NO_RESPONSE);
+        return NULL;
+    }
+    address.port = network_port;
+
+    const enet_uint32 versions[2] = {VERSION_075, VERSION_076};
+    ENetPeer* attempts[2];
+    float connected[2] = {-1.0F, -1.0F};
+    for(int k = 0; k < 2; k++)
+        attempts[k] = enet_host_connect(client, &address, 1, versions[k]);
+
+    float start = window_time();
+    enet_uint32 reason = NETWORK_NO_RESPONSE;
+    ENetPacket* first = NULL;
+    int accepted = -1;
+
+    while(accepted < 0 && !network_io_stopped() && (attempts[0] || attempts[1])) {
+        if(connected[0] < 0.0F && connected[1] < 0.0F && window_time() - start > NETWORK_CONNECT_TIMEOUT)
+            break;
 
         ENetEvent event;
-        while(enet_host_service(client, &event, 3000) > 0) {
+        if(enet_host_service(client, &event, NETWORK_IO_TIMEOUT) > 0) {
+            int k = (event.peer == attempts[0]) ? 0 : 1;
+
             switch(event.type) {
-                case ENET_EVENT_TYPE_RECEIVE: enet_packet_destroy(event.packet); break;
-                case ENET_EVENT_TYPE_DISCONNECT: return;
+                case ENET_EVENT_TYPE_CONNECT: connected[k] = window_time(); break;
+                case ENET_EVENT_TYPE_DISCONNECT:
+                    attempts[k] = NULL;
+                    connected[k] = -1.0F;
+                    reason = event.data;
+                    break;
+                case ENET_EVENT_TYPE_RECEIVE:
+                    first = event.packet;
+                    accepted = k;
+                    break;
+                default: break;
             }
         }
 
-        enet_peer_reset(peer);
+        for(int k = 0; k < 2 && accepted < 0; k++)
+            if(connected[k] >= 0.0F && window_time() - connected[k] > NETWORK_ACCEPT_TIMEOUT)
+                accepted = k;
     }
+
+    for(int k = 0; k < 2; k++)
+        if(attempts[k] && k != accepted)
+            enet_peer_disconnect_now(attempts[k], 0);
+
+    if(accepted < 0) {
+        if(!network_io_stopped())
+            network_io_deliver(ENET_EVENT_TYPE_DISCONNECT, NULL, reason);
+        return NULL;
+    }
+
+    peer = attempts[accepted];
+    network_io_deliver(ENET_EVENT_TYPE_CONNECT, NULL, versions[accepted]);
+    if(first)
+        network_io_deliver(ENET_EVENT_TYPE_RECEIVE, first, 0);
+
+    return attempts[accepted];
 }
 
-int network_connect_sub(char* ip, int port, int version) {
-    ENetAddress address;
-    ENetEvent event;
-    enet_address_set_host(&address, ip);
-    address.port = port;
-    peer = enet_host_connect(client, &address, 1, version);
-    network_logged_in = 0;
-    *network_custom_reason = 0;
-    memset(network_stats, 0, sizeof(struct network_stat) * 40);
-    if(peer == NULL)
-        return 0;
-    if(enet_host_service(client, &event, 2500) > 0 && event.type == ENET_EVENT_TYPE_CONNECT) {
-        network_received_packets = 0;
-        network_connected = 1;
+static void* network_io(void* user) {
+    // peer stays valid for the main thread after a disconnect, only this thread forgets about it
+    ENetPeer* connection = network_io_connect();
+
+    while(connection && !network_io_stopped()) {
+        network_io_send();
+
+        ENetEvent event;
+        if(enet_host_service(client, &event, NETWORK_IO_TIMEOUT) > 0) {
+            switch(event.type) {
+                case ENET_EVENT_TYPE_RECEIVE: network_io_deliver(event.type, event.packet, 0); break;
+                case ENET_EVENT_TYPE_DISCONNECT:
+                    network_io_deliver(event.type, NULL, event.data);
+                    connection = NULL;
+                    break;
+                default: break;
+            }
+        }
+    }
+
+    // disconnect politely, packets that still arrive are dropped
+    if(connection) {
+        enet_peer_disconnect(connection, 0);
 
         float start = window_time();
-        while(window_time() - start < 1.0F) { // listen connection for 1s, check if server disconnects
-            if(!network_update()) {
-                enet_peer_reset(peer);
-                return 0;
+        ENetEvent event;
+        while(connection && window_time() - start < NETWORK_DISCONNECT_TIMEOUT) {
+            if(enet_host_service(client, &event, NETWORK_IO_TIMEOUT) > 0) {
+                switch(event.type) {
+                    case ENET_EVENT_TYPE_RECEIVE: enet_packet_destroy(event.packet); break;
+                    case ENET_EVENT_TYPE_DISCONNECT: connection = NULL; break;
+                    default: break;
+                }
             }
         }
-        return 1;
+
+        if(connection)
+            enet_peer_reset(connection);
     }
-    chat_showpopup("No response", 3.0F, rgb(255, 0, 0));
-    enet_peer_reset(peer);
-    return 0;
+
+    __atomic_store_n(&network_io_finished, true, __ATOMIC_RELEASE);
+    return NULL;
 }
 
-int network_connect(char* ip, int port) {
-    log_info("Connecting to %s at port %i", ip, port);
-    if(network_connected) {
-        network_disconnect();
+static void network_io_start(void) {
+    network_io_stop = false;
+    network_io_finished = false;
+    network_io_running = true;
+    network_send_delay = 0;
+    network_send_jitter = 0;
+    peer = NULL;
+    pthread_create(&network_io_thread, NULL, network_io, NULL);
+}
+
+// waits for the network thread, afterwards ENet may be used from the main thread again
+static void network_io_end(void) {
+    if(!network_io_running)
+        return;
+
+    __atomic_store_n(&network_io_stop, true, __ATOMIC_RELEASE);
+    pthread_join(network_io_thread, NULL);
+    network_io_running = false;
+
+    struct network_event event;
+    while(ringbuffer_pop(&network_incoming, &event))
+        if(event.type == ENET_EVENT_TYPE_RECEIVE)
+            enet_packet_destroy(event.packet);
+
+    struct network_outgoing out;
+    while(ringbuffer_pop(&network_outgoing, &out))
+        enet_packet_destroy(out.packet);
+
+    network_batch_clear();
+}
+
+static void network_capture_varint(uint32_t value) {
+    uint8_t bytes[5];
+    int length = 0;
+
+    do {
+        bytes[length] = value & 0x7F;
+        value >>= 7;
+        if(value)
+            bytes[length] |= 0x80;
+        length++;
+    } while(value);
+
+    fwrite(bytes, 1, length, network_capture);
+}
+
+static void network_capture_open(enet_uint32 version) {
+    char filename[64];
+    sprintf(filename, "logs/capture_%ld.bin", (long)time(NULL));
+
+    network_capture = fopen(filename, "wb");
+    if(!network_capture) {
+        log_warn("Could not create capture %s", filename);
+        return;
+    }
+
+    uint8_t header[8] = {0};
+    memcpy(header, NETWORK_CAPTURE_MAGIC, 4);
+    header[4] = NETWORK_CAPTURE_VERSION;
+    header[5] = version == VERSION_075 ? 75 : 76;
+    fwrite(header, 1, sizeof(header), network_capture);
+
+    network_capture_time = 0;
+    log_info("Capturing received packets to %s", filename);
+}
+
+static void network_capture_packet(double received, ENetPacket* packet) {
+    uint64_t now = maxc((received - network_connect_start) * 1000000.0, 0.0);
+    uint32_t delta = now > network_capture_time ? now - network_capture_time : 0;
+    network_capture_time += delta;
+
+    network_capture_varint(delta);
+    network_capture_varint(packet->dataLength);
+    fwrite(packet->data, 1, packet->dataLength, network_capture);
+}
+
+static void network_capture_close() {
+    if(network_capture) {
+        fclose(network_capture);
+        network_capture = NULL;
     }
-    if(network_connect_sub(ip, port, VERSION_075)) {
-        return 1;
+}
+
+// hands the batch to the network thread, which sends it with a single enet_host_flush()
+static void network_flush(void) {
+    network_batch_last = window_time_precise();
+
+    int last = network_batch_count - 1;
+    while(last >= 0 && !network_batch[last])
+        last--;
+
+    for(int k = 0; k <= last; k++) {
+        ENetPacket* packet = network_batch[k];
+        if(!packet)
+            continue;
+
+        network_stats[0].outgoing += packet->dataLength;
+        network_packet_stats[packet->data[0]].sent++;
+        network_packet_stats[packet->data[0]].sent_bytes += packet->dataLength;
+
+        struct network_outgoing out = {
+            .packet = packet,
+            .queued = network_batch_last,
+            .flush = k == last,
+        };
+
+        // after a disconnect the network thread may have exited already, nothing would drain the queue then
+        bool queued;
+        while(!(queued = ringbuffer_push(&network_outgoing, &out))
+              && !__atomic_load_n(&network_io_finished, __ATOMIC_ACQUIRE))
+            sched_yield();
+
+        if(!queued)
+            enet_packet_destroy(packet);
+    }
+
+    if(last >= 0)
+        network_stats[0].flushes++;
+    network_batch_count = 0;
+}
+
+void network_send(int id, void* data, int len) {
+    if(network_connected && network_io_running) {
+        // only the latest position and orientation matter, an older one still waiting is dropped
+        if(id == PACKET_POSITIONDATA_ID || id == PACKET_ORIENTATIONDATA_ID) {
+            for(int k = 0; k < network_batch_count; k++) {
+                if(network_batch[k] && network_batch[k]->data[0] == id) {
+                    network_stats[0].saved_packets++;
+                    network_stats[0].saved_bytes += network_batch[k]->dataLength;
+                    enet_packet_destroy(network_batch[k]);
+                    network_batch[k] = NULL;
+                }
+            }
+        }
+
+        if(network_batch_count == NETWORK_BATCH_LENGTH)
+            network_flush();
+
+        ENetPacket* packet = enet_packet_create(NULL, len + 1, ENET_PACKET_FLAG_RELIABLE);
+        packet->data[0] = id;
+        memcpy(packet->data + 1, data, len);
+        network_batch[network_batch_count++] = packet;
     }
-    if(network_connect_sub(ip, port, VERSION_076)) {
-        return 1;
+}
+
+unsigned int network_ping() {
+    return network_connected ? __atomic_load_n(&peer->roundTripTime, __ATOMIC_RELAXED) : 0;
+}
+
+// returns immediately, the network thread says goodbye to the server
+void network_disconnect() {
+    if(network_connection == NETWORK_CONNECTING || network_connection == NETWORK_CONNECTED) {
+        __atomic_store_n(&network_io_stop, true, __ATOMIC_RELEASE);
+        network_connection = NETWORK_DISCONNECTING;
+        network_connected = 0;
+        network_logged_in = 0;
     }
-    network_connected = 0;
-    return 0;
+
+    network_capture_close();
+}
+
+enum network_state network_connection_state() {
+    return network_connection;
+}
+
+// starts connecting in the background, network_update() switches to the game once a protocol version is accepted
+int network_connect(char* ip, int port) {
+    log_info("Connecting to %s at port %i", ip, port);
+
+    // a previous connection might still be closing
+    network_disconnect();
+    network_io_end();
+
+    strncpy(network_host, ip, sizeof(network_host) - 1);
+    network_host[sizeof(network_host) - 1] = 0;
+    network_port = port;
+    network_logged_in = 0;
+    network_received_packets = 0;
+    network_first_packet = false;
+    *network_custom_reason = 0;
+    memset(network_stats, 0, sizeof(struct network_stat) * 40);
+    memset(network_packet_stats, 0, sizeof(network_packet_stats));
+    *network_telemetry_file = 0;
+
+    network_connection = NETWORK_CONNECTING;
+    network_connect_start = window_time_precise();
+    network_io_start();
+    return 1;
 }
 
 int network_identifier_split(char* addr, char* ip_out, int* port_out) {
@@ -1014,26 +1431,143 @@ int network_connect_string(char* addr) {
     return network_connect(ip, port);
 }
 
+static int network_histogram_bucket(double duration) {
+    int bucket = 0;
+    for(double limit = 0.000001; bucket < NETWORK_HISTOGRAM_BUCKETS - 1 && duration >= limit; limit *= 2.0)
+        bucket++;
+    return bucket;
+}
+
+// totals since connecting, one row per packet id that was seen
+static void network_telemetry(void) {
+    if(!settings.network_telemetry || window_time() - network_telemetry_last < NETWORK_TELEMETRY_INTERVAL)
+        return;
+
+    network_telemetry_last = window_time();
+
+    bool created = !*network_telemetry_file;
+    if(created)
+        sprintf(network_telemetry_file, "logs/network_%ld.csv", (long)time(NULL));
+
+    void* f = file_open(network_telemetry_file, "a");
+    if(!f)
+        return;
+
+    if(created) {
+        file_printf(f, "time,id,name,received,received_bytes,sent,sent_bytes,handler_ms,handler_max_ms");
+        for(int k = 0; k < NETWORK_HISTOGRAM_BUCKETS - 1; k++)
+            file_printf(f, ",below_%ius", 1 << k);
+        // the last bucket holds everything slower, see network_histogram_bucket()
+        file_printf(f, ",%ius_plus\n", 1 << (NETWORK_HISTOGRAM_BUCKETS - 2));
+    }
+
+    float elapsed = window_time_precise() - network_connect_start;
+    for(int id = 0; id < 256; id++) {
+        struct network_packet_stat* packet = network_packet_stats + id;
+        if(!packet->received && !packet->sent)
+            continue;
+
+        file_printf(f, "%0.1f,%i,%s,%u,%u,%u,%u,%0.3f,%0.3f", elapsed, id,
+                    network_packet_names[id] ? network_packet_names[id] : "", packet->received, packet->received_bytes,
+                    packet->sent, packet->sent_bytes, packet->handler_time * 1000.0, packet->handler_max * 1000.0F);
+        for(int k = 0; k < NETWORK_HISTOGRAM_BUCKETS; k++)
+            file_printf(f, ",%u", packet->handler_histogram[k]);
+        file_printf(f, "\n");
+    }
+
+    file_close(f);
+
+    int players_connected = 0;
+    for(int k = 0; k < PLAYERS_MAX; k++)
+        if(players[k].connected)
+            players_connected++;
+
+    log_info("%i players, frame time %0.2fms (at most %0.2fms), %zu MiB resident", players_connected,
+             network_frame_count ? network_frame_total * 1000.0 / network_frame_count : 0.0,
+             network_frame_max * 1000.0F, window_memory_resident() / (1024 * 1024));
+
+    network_frame_total = 0.0;
+    network_frame_max = 0.0F;
+    network_frame_count = 0;
+}
+
 int network_update() {
-    if(network_connected) {
+    double now = window_time_precise();
+    if(network_frame_last > 0.0) {
+        network_frame_total += now - network_frame_last;
+        network_frame_max = maxc(network_frame_max, (float)(now - network_frame_last));
+        network_frame_count++;
+    }
+    network_frame_last = now;
+
+    if(network_connection == NETWORK_DISCONNECTING && __atomic_load_n(&network_io_finished, __ATOMIC_ACQUIRE)) {
+        network_io_end();
+        network_connection = NETWORK_DISCONNECTED;
+    }
+
+    if(network_connection == NETWORK_CONNECTING || network_connection == NETWORK_CONNECTED) {
         if(window_time() - network_stats_last >= 1.0F) {
             for(int k = 39; k > 0; k--)
                 network_stats[k] = network_stats[k - 1];
             network_stats[0].ingoing = 0;
             network_stats[0].outgoing = 0;
             network_stats[0].avg_ping = network_ping();
+            network_stats[0].dispatched = 0;
+            network_stats[0].avg_dispatch = 0;
+            network_stats[0].max_dispatch = 0;
+            network_stats[0].send_jitter = __atomic_load_n(&network_send_jitter, __ATOMIC_RELAXED);
+            network_stats[0].flushes = 0;
+            network_stats[0].saved_packets = 0;
+            network_stats[0].saved_bytes = 0;
             network_stats_last = window_time();
         }
 
-        ENetEvent event;
-        while(enet_host_service(client, &event, 0) > 0) {
+        // a handler might disconnect, the rest of the queue is dropped then
+        struct network_event event;
+        while(network_connection != NETWORK_DISCONNECTING && ringbuffer_pop(&network_incoming, &event)) {
             switch(event.type) {
+                case ENET_EVENT_TYPE_CONNECT:
+                    network_connection = NETWORK_CONNECTED;
+                    network_connected = 1;
+                    log_info("Connected using protocol %s after %0.0fms", event.data == VERSION_075 ? "0.75" : "0.76",
+                             (event.received - network_connect_start) * 1000.0F);
+                    hud_change(&hud_ingame);
+
+                    if(settings.network_capture)
+                        network_capture_open(event.data);
+                    break;
                 case ENET_EVENT_TYPE_RECEIVE: {
+                    if(!network_first_packet) {
+                        log_info("First packet %0.0fms after connecting",
+                                 (event.received - network_connect_start) * 1000.0F);
+                        network_first_packet = true;
+                    }
+
+                    // time spent waiting in the queue for this frame
+                    int dispatch = (window_time_precise() - event.received) * 1000000.0;
+                    struct network_stat* stat = network_stats;
+                    stat->avg_dispatch += (dispatch - stat->avg_dispatch) / (stat->dispatched + 1);
+                    stat->max_dispatch = maxc(stat->max_dispatch, dispatch);
+                    stat->dispatched++;
+
+                    if(network_capture)
+                        network_capture_packet(event.received, event.packet);
+
                     network_stats[0].ingoing += event.packet->dataLength;
                     int id = event.packet->data[0];
+                    struct network_packet_stat* packet = network_packet_stats + id;
+                    packet->received++;
+                    packet->received_bytes += event.packet->dataLength;
+
                     if(*packets[id]) {
                         log_debug("Packet id %i", id);
+                        double start = window_time_precise();
                         (*packets[id])(event.packet->data + 1, event.packet->dataLength - 1);
+                        double duration = window_time_precise() - start;
+
+                        packet->handler_time += duration;
+                        packet->handler_max = maxc(packet->handler_max, (float)duration);
+                        packet->handler_histogram[network_histogram_bucket(duration)]++;
                     } else {
                         log_error("Invalid packet id %i, length: %i", id, (int)event.packet->dataLength - 1);
                     }
@@ -1042,16 +1576,32 @@ int network_update() {
                     break;
                 }
                 case ENET_EVENT_TYPE_DISCONNECT:
+                    network_io_end();
+                    network_capture_close();
+
+                    if(network_connection == NETWORK_CONNECTING) {
+                        network_connection = NETWORK_DISCONNECTED;
+                        const char* reason
+                            = (event.data == NETWORK_NO_RESPONSE) ? "No response" : network_reason_disconnect(event.data);
+                        chat_showpopup(reason, 3.0F, rgb(255, 0, 0));
+                        log_error("could not connect! reason: %s", reason);
+                        return 0;
+                    }
+
+                    network_connection = NETWORK_DISCONNECTED;
                     hud_change(&hud_serverlist);
                     chat_showpopup(network_reason_disconnect(event.data), 10.0F, rgb(255, 0, 0));
                     log_error("server disconnected! reason: %s", network_reason_disconnect(event.data));
-                    event.peer->data = NULL;
                     network_connected = 0;
                     network_logged_in = 0;
                     return 0;
+                default: break;
             }
         }
 
+        if(network_connected)
+            network_telemetry();
+
         if(network_logged_in && players[local_player_id].team != TEAM_SPECTATOR && players[local_player_id].alive) {
             if(players[local_player_id].input.keys.packed != network_keys_last) {
                 struct PacketInputData in;
@@ -1105,6 +1655,11 @@ int network_update() {
                 network_send(PACKET_ORIENTATIONDATA_ID, &orient, sizeof(orient));
             }
         }
+
+        // everything sent during this frame goes out together, with send_rate batches per second at most
+        if(network_connected
+           && (settings.send_rate <= 0 || window_time_precise() - network_batch_last >= 1.0 / settings.send_rate))
+            network_flush();
     }
 
     chunk_queue_blocks();
@@ -1116,44 +1671,295 @@ int network_status() {
     return network_connected;
 }
 
+void network_deinit() {
+    network_disconnect();
+    network_io_end();
+}
+
+#define NETWORK_HANDLER(id, name) network_handler(id, read_Packet##name, #name)
+
+static void network_handler(int id, void (*handler)(void* data, int len), const char* name) {
+    packets[id] = handler;
+    network_packet_names[id] = name;
+}
+
 void network_init() {
     enet_initialize();
-    client = enet_host_create(NULL, 1, 1, 0, 0); // limit bandwidth here if you want to
+    client = enet_host_create(NULL, 2, 1, 0, 0); // limit bandwidth here if you want to
     enet_host_compress_with_range_coder(client);
 
-    packets[PACKET_POSITIONDATA_ID] = read_PacketPositionData;
-    packets[PACKET_ORIENTATIONDATA_ID] = read_PacketOrientationData;
-    packets[PACKET_WORLDUPDATE_ID] = read_PacketWorldUpdate;
-    packets[PACKET_INPUTDATA_ID] = read_PacketInputData;
-    packets[PACKET_WEAPONINPUT_ID] = read_PacketWeaponInput;
-    packets[PACKET_SETHP_ID] = read_PacketSetHP;
-    packets[PACKET_GRENADE_ID] = read_PacketGrenade;
-    packets[PACKET_SETTOOL_ID] = read_PacketSetTool;
-    packets[PACKET_SETCOLOR_ID] = read_PacketSetColor;
-    packets[PACKET_EXISTINGPLAYER_ID] = read_PacketExistingPlayer;
-    packets[PACKET_SHORTPLAYERDATA_ID] = read_PacketShortPlayerData;
-    packets[PACKET_MOVEOBJECT_ID] = read_PacketMoveObject;
-    packets[PACKET_CREATEPLAYER_ID] = read_PacketCreatePlayer;
-    packets[PACKET_BLOCKACTION_ID] = read_PacketBlockAction;
-    packets[PACKET_BLOCKLINE_ID] = read_PacketBlockLine;
-    packets[PACKET_STATEDATA_ID] = read_PacketStateData;
-    packets[PACKET_KILLACTION_ID] = read_PacketKillAction;
-    packets[PACKET_CHATMESSAGE_ID] = read_PacketChatMessage;
-    packets[PACKET_MAPSTART_ID] = read_PacketMapStart;
-    packets[PACKET_MAPCHUNK_ID] = read_PacketMapChunk;
-    packets[PACKET_PLAYERLEFT_ID] = read_PacketPlayerLeft;
-    packets[PACKET_TERRITORYCAPTURE_ID] = read_PacketTerritoryCapture;
-    packets[PACKET_PROGRESSBAR_ID] = read_PacketProgressBar;
-    packets[PACKET_INTELCAPTURE_ID] = read_PacketIntelCapture;
-    packets[PACKET_INTELPICKUP_ID] = read_PacketIntelPickup;
-    packets[PACKET_INTELDROP_ID] = read_PacketIntelDrop;
-    packets[PACKET_RESTOCK_ID] = read_PacketRestock;
-    packets[PACKET_FOGCOLOR_ID] = read_PacketFogColor;
-    packets[PACKET_WEAPONRELOAD_ID] = read_PacketWeaponReload;
+    ringbuffer_create(&network_incoming, sizeof(struct network_event), NETWORK_QUEUE_LENGTH);
+    ringbuffer_create(&network_outgoing, sizeof(struct network_outgoing), NETWORK_QUEUE_LENGTH);
+
+    NETWORK_HANDLER(PACKET_POSITIONDATA_ID, PositionData);
+    NETWORK_HANDLER(PACKET_ORIENTATIONDATA_ID, OrientationData);
+    NETWORK_HANDLER(PACKET_WORLDUPDATE_ID, WorldUpdate);
+    NETWORK_HANDLER(PACKET_INPUTDATA_ID, InputData);
+    NETWORK_HANDLER(PACKET_WEAPONINPUT_ID, WeaponInput);
+    NETWORK_HANDLER(PACKET_SETHP_ID, SetHP);
+    NETWORK_HANDLER(PACKET_GRENADE_ID, Grenade);
+    NETWORK_HANDLER(PACKET_SETTOOL_ID, SetTool);
+    NETWORK_HANDLER(PACKET_SETCOLOR_ID, SetColor);
+    NETWORK_HANDLER(PACKET_EXISTINGPLAYER_ID, ExistingPlayer);
+    NETWORK_HANDLER(PACKET_SHORTPLAYERDATA_ID, ShortPlayerData);
+    NETWORK_HANDLER(PACKET_MOVEOBJECT_ID, MoveObject);
+    NETWORK_HANDLER(PACKET_CREATEPLAYER_ID, CreatePlayer);
+    NETWORK_HANDLER(PACKET_BLOCKACTION_ID, BlockAction);
+    NETWORK_HANDLER(PACKET_BLOCKLINE_ID, BlockLine);
+    NETWORK_HANDLER(PACKET_STATEDATA_ID, StateData);
+    NETWORK_HANDLER(PACKET_KILLACTION_ID, KillAction);
+    NETWORK_HANDLER(PACKET_CHATMESSAGE_ID, ChatMessage);
+    NETWORK_HANDLER(PACKET_MAPSTART_ID, MapStart);
+    NETWORK_HANDLER(PACKET_MAPCHUNK_ID, MapChunk);
+    NETWORK_HANDLER(PACKET_PLAYERLEFT_ID, PlayerLeft);
+    NETWORK_HANDLER(PACKET_TERRITORYCAPTURE_ID, TerritoryCapture);
+    NETWORK_HANDLER(PACKET_PROGRESSBAR_ID, ProgressBar);
+    NETWORK_HANDLER(PACKET_INTELCAPTURE_ID, IntelCapture);
+    NETWORK_HANDLER(PACKET_INTELPICKUP_ID, IntelPickup);
+    NETWORK_HANDLER(PACKET_INTELDROP_ID, IntelDrop);
+    NETWORK_HANDLER(PACKET_RESTOCK_ID, Restock);
+    NETWORK_HANDLER(PACKET_FOGCOLOR_ID, FogColor);
+    NETWORK_HANDLER(PACKET_WEAPONRELOAD_ID, WeaponReload);
     // 29
-    packets[PACKET_CHANGEWEAPON_ID] = read_PacketChangeWeapon;
-    packets[PACKET_HANDSHAKEINIT_ID] = read_PacketHandshakeInit;
-    packets[PACKET_VERSIONGET_ID] = read_PacketVersionGet;
-    packets[PACKET_EXTINFO_ID] = read_PacketExtInfo;
-    packets[PACKET_EXT_BASE + EXT_PLAYER_PROPERTIES] = read_PacketPlayerProperties;
+    NETWORK_HANDLER(PACKET_CHANGEWEAPON_ID, ChangeWeapon);
+    NETWORK_HANDLER(PACKET_HANDSHAKEINIT_ID, HandshakeInit);
+    NETWORK_HANDLER(PACKET_VERSIONGET_ID, VersionGet);
+    NETWORK_HANDLER(PACKET_EXTINFO_ID, ExtInfo);
+    NETWORK_HANDLER(PACKET_EXT_BASE + EXT_PLAYER_PROPERTIES, PlayerProperties);
+}
+
+#define NETWORK_BENCHMARK_CHUNK 8192
+
+// replays the transfer of a map in MapChunk sized pieces, compares the stall at StateData to inflating all at once
+void network_benchmark_join(void* data, size_t len) {
+    uLongf compressed_len = compressBound(len);
+    void* compressed = malloc(compressed_len);
+    CHECK_ALLOCATION_ERROR(compressed)
+    compress2((Bytef*)compressed, &compressed_len, (Bytef*)data, len, Z_BEST_COMPRESSION);
+
+    int pieces = (compressed_len + NETWORK_BENCHMARK_CHUNK - 1) / NETWORK_BENCHMARK_CHUNK;
+
+    // previous behaviour: inflate in one call at StateData, retrying with a larger buffer
+    float start = window_time();
+    uLongf avail_size = 1024 * 1024;
+    void* decompressed = malloc(avail_size);
+    CHECK_ALLOCATION_ERROR(decompressed)
+    while(1) {
+        uLongf decompressed_size = avail_size;
+        int r = uncompress((Bytef*)decompressed, &decompressed_size, (Bytef*)compressed, compressed_len);
+        if(r == Z_BUF_ERROR) {
+            avail_size += 1024 * 1024;
+            decompressed = realloc(decompressed, avail_size);
+            CHECK_ALLOCATION_ERROR(decompressed)
+            continue;
+        }
+        if(r == Z_OK)
+            map_vxl_load((uintptr_t)decompressed, decompressed_size);
+        break;
+    }
+    free(decompressed);
+    float oneshot = window_time() - start;
+
+    network_map_begin(compressed_len);
+    network_map_stream();
+
+    float streamed = 0.0F;
+    float streamed_max = 0.0F;
+    for(int k = 0; k < pieces; k++) {
+        start = window_time();
+        size_t offset = k * NETWORK_BENCHMARK_CHUNK;
+        read_PacketMapChunk((uint8_t*)compressed + offset, minc(compressed_len - offset, (uLongf)NETWORK_BENCHMARK_CHUNK));
+        float elapsed = window_time() - start;
+        streamed += elapsed;
+        streamed_max = maxc(streamed_max, elapsed);
+    }
+
+    start = window_time();
+    bool complete = network_map_end();
+    float stall = window_time() - start;
+
+    free(compressed);
+
+    log_info("map of %zu bytes, %zu compressed in %i chunks", len, (size_t)compressed_len, pieces);
+    log_info("one-shot: %0.2fms at state data", oneshot * 1000.0F);
+    log_info("streamed: %0.2fms at state data, %0.2fms during transfer (at most %0.3fms per chunk)%s",
+             stall * 1000.0F, streamed * 1000.0F, streamed_max * 1000.0F, complete ? "" : ", map incomplete!");
+}
+
+// one frame of the replay, the packets of a frame are handled before it
+#define NETWORK_REPLAY_STEP (1.0 / 60.0)
+// frames run after the last packet at most, until collapsed structures have landed
+#define NETWORK_REPLAY_TAIL 600
+
+struct network_replay {
+    struct chunk_mesh_stats meshing;
+    double meshing_time;
+    double physics_time;
+    size_t frames;
+    size_t collapsing_max;
+};
+
+// each subsystem runs to completion before the next one starts, so that their times don't overlap
+static void network_replay_frame(struct network_replay* replay) {
+    double start = window_time_precise();
+    chunk_queue_blocks();
+    chunk_wait();
+    chunk_update_headless(&replay->meshing);
+    replay->meshing_time += window_time_precise() - start;
+
+    start = window_time_precise();
+    map_update_physics_wait();
+    map_collapsing_update(NETWORK_REPLAY_STEP);
+    replay->physics_time += window_time_precise() - start;
+
+    replay->collapsing_max = maxc(replay->collapsing_max, map_collapsing_count());
+    replay->frames++;
+}
+
+static bool network_replay_varint(uint8_t* data, size_t len, size_t* offset, uint32_t* value) {
+    *value = 0;
+
+    for(int shift = 0; shift < 35 && *offset < len; shift += 7) {
+        uint8_t byte = data[(*offset)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+static int network_replay_cmp(const void* a, const void* b) {
+    double ta = network_packet_stats[*(int*)a].handler_time;
+    double tb = network_packet_stats[*(int*)b].handler_time;
+    return (ta < tb) - (ta > tb);
+}
+
+// feeds a capture through the packet handlers as fast as possible, meshing chunks and simulating collapsed
+// structures in frames of the captured time
+bool network_benchmark_replay(const char* name) {
+    uint8_t* data = file_load(name);
+    size_t len = data ? file_size(name) : 0;
+
+    if(len < 8 || memcmp(data, NETWORK_CAPTURE_MAGIC, 4) || data[4] != NETWORK_CAPTURE_VERSION) {
+        log_error("%s is not a packet capture", name);
+        free(data);
+        return false;
+    }
+
+    log_info("Replaying %s, protocol 0.%i", name, data[5]);
+
+    // replays must neither read cache/ nor leave anything there, every run has to transfer the whole map again
+    mapcache_enabled = false;
+
+    memset(network_packet_stats, 0, sizeof(network_packet_stats));
+
+    struct network_replay replay = {};
+    size_t count = 0;
+    size_t bytes = 0;
+    uint64_t played = 0;
+    double frame_end = NETWORK_REPLAY_STEP;
+    double start = window_time_precise();
+
+    size_t offset = 8;
+    while(offset < len) {
+        uint32_t delta, length;
+        if(!network_replay_varint(data, len, &offset, &delta) || !network_replay_varint(data, len, &offset, &length)
+           || !length || length > len - offset) {
+            log_warn("Capture is truncated after %zu packets", count);
+            break;
+        }
+
+        played += delta;
+        while(played * 0.000001 >= frame_end) {
+            network_replay_frame(&replay);
+            frame_end += NETWORK_REPLAY_STEP;
+        }
+
+        uint8_t* packet = data + offset;
+        offset += length;
+
+        int id = packet[0];
+        struct network_packet_stat* stat = network_packet_stats + id;
+        stat->received++;
+        stat->received_bytes += length;
+        count++;
+        bytes += length;
+
+        if(!packets[id]) {
+            log_error("Invalid packet id %i, length: %i", id, (int)length - 1);
+            continue;
+        }
+
+        double handler_start = window_time_precise();
+        (*packets[id])(packet + 1, length - 1);
+        double duration = window_time_precise() - handler_start;
+
+        stat->handler_time += duration;
+        stat->handler_max = maxc(stat->handler_max, (float)duration);
+        stat->handler_histogram[network_histogram_bucket(duration)]++;
+    }
+
+    free(data);
+    mapcache_enabled = true;
+
+    for(int k = 0; k < NETWORK_REPLAY_TAIL && map_collapsing_count() > 0; k++)
+        network_replay_frame(&replay);
+    network_replay_frame(&replay);
+
+    double elapsed = window_time_precise() - start;
+
+    int ids[256];
+    double handler_time = 0.0;
+    for(int k = 0; k < 256; k++) {
+        ids[k] = k;
+        handler_time += network_packet_stats[k].handler_time;
+    }
+
+    struct network_packet_stat* transfer[] = {network_packet_stats + PACKET_MAPSTART_ID,
+                                              network_packet_stats + PACKET_MAPCHUNK_ID,
+                                              network_packet_stats + PACKET_STATEDATA_ID};
+    struct network_packet_stat* edits[] = {network_packet_stats + PACKET_BLOCKACTION_ID,
+                                           network_packet_stats + PACKET_BLOCKLINE_ID};
+
+    unsigned int transfer_count = 0;
+    double transfer_time = 0.0;
+    for(size_t k = 0; k < sizeof(transfer) / sizeof(*transfer); k++) {
+        transfer_count += transfer[k]->received;
+        transfer_time += transfer[k]->handler_time;
+    }
+
+    unsigned int edit_count = 0;
+    double edit_time = 0.0;
+    for(size_t k = 0; k < sizeof(edits) / sizeof(*edits); k++) {
+        edit_count += edits[k]->received;
+        edit_time += edits[k]->handler_time;
+    }
+
+    log_info("%zu packets (%zu KiB, %0.1fs of play) replayed in %0.2fs, %zu frames", count, bytes / 1024,
+             played * 0.000001, elapsed, replay.frames);
+    log_info("handlers: %0.1fms, %0.0f packets/s, %0.2f MiB/s", handler_time * 1000.0,
+             count / maxc(handler_time, 1e-9), bytes / maxc(handler_time, 1e-9) / (1024.0 * 1024.0));
+    log_info("map transfer: %u packets in %0.1fms", transfer_count, transfer_time * 1000.0);
+    log_info("map edits: %u packets in %0.1fms, %0.0f/s", edit_count, edit_time * 1000.0,
+             edit_count / maxc(edit_time, 1e-9));
+    log_info("collapse physics: %0.1fms, %0.1fus per frame, at most %zu structures falling",
+             replay.physics_time * 1000.0, replay.physics_time * 1000000.0 / replay.frames, replay.collapsing_max);
+    log_info("chunk meshing: %zu meshes, %zu quads in %0.1fms, %0.0f meshes/s (%0.3fms meshing per chunk)",
+             replay.meshing.meshes, replay.meshing.quads, replay.meshing_time * 1000.0,
+             replay.meshing.meshes / maxc(replay.meshing_time, 1e-9),
+             replay.meshing.meshes ? replay.meshing.mesh_time * 1000.0F / replay.meshing.meshes : 0.0F);
+
+    qsort(ids, 256, sizeof(int), network_replay_cmp);
+
+    for(int k = 0; k < 8 && network_packet_stats[ids[k]].received; k++) {
+        struct network_packet_stat* stat = network_packet_stats + ids[k];
+        log_info("%-16s %7u packets %8.2fms, %7.2fus avg, %7.3fms max",
+                 network_packet_names[ids[k]] ? network_packet_names[ids[k]] : "?", stat->received,
+                 stat->handler_time * 1000.0, stat->handler_time * 1000000.0 / stat->received,
+                 stat->handler_max * 1000.0F);
+    }
+
+    return true;
 }
@@ -30,7 +30,19 @@ int network_connect(char* ip, int port);
 int network_connect_string(char* addr);
 int network_update(void);
 int network_status(void);
+void network_deinit(void);
+
+enum network_state {
+    NETWORK_DISCONNECTED,
+    NETWORK_CONNECTING,
+    NETWORK_CONNECTED,
+    NETWORK_DISCONNECTING,
+};
+
+enum network_state network_connection_state(void);
 void network_init(void);
+void network_benchmark_join(void* data, size_t len);
+bool network_benchmark_replay(const char* name);
 
 void read_PacketMapChunk(void* data, int len);
 void read_PacketChatMessage(void* data, int len);
@@ -80,8 +92,6 @@ extern unsigned char network_tool_last;
 #define VERSION_075 3
 #define VERSION_076 4
 
-extern uintptr_t compressed_chunk_data;
-extern int compressed_chunk_data_size;
 extern int compressed_chunk_data_offset;
 extern int compressed_chunk_data_estimate;
 
@@ -89,10 +99,32 @@ extern struct network_stat {
     int outgoing;
     int ingoing;
     int avg_ping;
+    int dispatched;
+    int avg_dispatch; // us from arrival on the network thread to the packet handler
+    int max_dispatch;
+    int send_jitter; // us, variation of the delay between flushing a batch and handing its packets to ENet
+    int flushes;
+    int saved_packets; // superseded position and orientation updates that were never sent
+    int saved_bytes;
 } network_stats[40];
 
 extern float network_stats_last;
 
+#define NETWORK_HISTOGRAM_BUCKETS 16
+
+// totals per packet id since connecting
+extern struct network_packet_stat {
+    unsigned int received;
+    unsigned int received_bytes;
+    unsigned int sent;
+    unsigned int sent_bytes;
+    double handler_time; // seconds spent in its read_Packet* handler
+    float handler_max;
+    unsigned int handler_histogram[NETWORK_HISTOGRAM_BUCKETS]; // bucket k counts durations below 2^k us
+} network_packet_stats[256];
+
+extern const char* network_packet_names[256];
+
 #pragma pack(push, 1)
 
 #define PACKET_HANDSHAKEINIT_ID 31
@@ -0,0 +1,232 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <common.hpp>
+#include <occlusion.hpp>
+
+struct occlusion_vertex {
+    float x, y, w;
+};
+
+// corners of a box are numbered by the axes on which they take the maximum: x = 1, y = 2, z = 4. Faces are wound
+// counter-clockwise when seen from outside
+static const int occlusion_faces[6][4] = {
+    {0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6},
+};
+
+// returns false if any corner is too close to or behind the camera, the box can't be handled then
+static bool occlusion_project(struct occlusion_buffer* o, const float* min, const float* max,
+                              struct occlusion_vertex* out) {
+    for(int k = 0; k < 8; k++) {
+        float x = (k & 1) ? max[0] : min[0];
+        float y = (k & 2) ? max[1] : min[1];
+        float z = (k & 4) ? max[2] : min[2];
+
+        float w = o->mvp[0][3] * x + o->mvp[1][3] * y + o->mvp[2][3] * z + o->mvp[3][3];
+
+        if(w < OCCLUSION_NEAR)
+            return false;
+
+        out[k].x = ((o->mvp[0][0] * x + o->mvp[1][0] * y + o->mvp[2][0] * z + o->mvp[3][0]) / w * 0.5F + 0.5F)
+            * OCCLUSION_WIDTH;
+        out[k].y = ((o->mvp[0][1] * x + o->mvp[1][1] * y + o->mvp[2][1] * z + o->mvp[3][1]) / w * 0.5F + 0.5F)
+            * OCCLUSION_HEIGHT;
+        out[k].w = w;
+    }
+
+    return true;
+}
+
+// a pixel is covered if it lies completely inside the convex polygon, so that no occluder hides more than it really
+// covers. An edge from u to v passes on the pixel's inner side if the edge function at the pixel center exceeds what
+// it can change towards the pixel's corners
+static void occlusion_polygon(struct occlusion_buffer* o, struct occlusion_vertex* p, int count, float depth) {
+    float y_min = FLT_MAX, y_max = -FLT_MAX;
+
+    for(int k = 0; k < count; k++) {
+        y_min = fmin(y_min, p[k].y);
+        y_max = fmax(y_max, p[k].y);
+    }
+
+    int y0 = maxc((int)ceil(y_min), 0);
+    int y1 = minc((int)floor(y_max), OCCLUSION_HEIGHT) - 1;
+
+    for(int y = y0; y <= y1; y++) {
+        float py = y + 0.5F;
+        float x0 = 0.0F;
+        float x1 = OCCLUSION_WIDTH;
+
+        for(int k = 0; k < count && x0 < x1; k++) {
+            struct occlusion_vertex* u = p + k;
+            struct occlusion_vertex* v = p + (k + 1) % count;
+            float dx = v->x - u->x;
+            float dy = v->y - u->y;
+
+            // inside where dx * (py - u->y) - dy * (px - u->x) >= margin
+            float e = dx * (py - u->y) + dy * u->x - 0.5F * (fabs(dx) + fabs(dy));
+
+            if(dy < 0.0F)
+                x0 = fmax(x0, e / dy);
+            else if(dy > 0.0F)
+                x1 = fmin(x1, e / dy);
+            else if(e < 0.0F)
+                x1 = -1.0F;
+        }
+
+        // x0 and x1 bound the pixel centers
+        float* d = o->depth + y * OCCLUSION_WIDTH;
+        int end = minc((int)floor(x1 - 0.5F), OCCLUSION_WIDTH - 1);
+
+        for(int x = maxc((int)ceil(x0 - 0.5F), 0); x <= end; x++)
+            if(depth < d[x])
+                d[x] = depth;
+    }
+}
+
+static float occlusion_cross(struct occlusion_vertex* a, struct occlusion_vertex* b, struct occlusion_vertex* c) {
+    return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+}
+
+void occlusion_clear(struct occlusion_buffer* o, mat4 mvp) {
+    memcpy(o->mvp, mvp, sizeof(mat4));
+
+    for(int k = 0; k < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; k++)
+        o->depth[k] = FLT_MAX;
+
+    o->occluders = 0;
+}
+
+// the box has to be completely solid, everything behind it is hidden. Its outline is the convex hull of the
+// projected corners, covered at the farthest depth of any face turned towards the camera
+void occlusion_add_box(struct occlusion_buffer* o, const float* min, const float* max) {
+    struct occlusion_vertex v[8];
+
+    if(!occlusion_project(o, min, max, v))
+        return;
+
+    float depth = 0.0F;
+
+    for(int f = 0; f < 6; f++) {
+        const int* q = occlusion_faces[f];
+
+        if(occlusion_cross(v + q[0], v + q[1], v + q[2]) + occlusion_cross(v + q[0], v + q[2], v + q[3]) > 0.0F)
+            for(int k = 0; k < 4; k++)
+                depth = fmax(depth, v[q[k]].w);
+    }
+
+    if(depth == 0.0F)
+        return;
+
+    // monotone chain, sorted by x then y, the hull ends up counter-clockwise like the faces
+    struct occlusion_vertex sorted[8];
+    memcpy(sorted, v, sizeof(v));
+
+    for(int k = 1; k < 8; k++) {
+        struct occlusion_vertex key = sorted[k];
+        int j = k - 1;
+
+        for(; j >= 0 && (sorted[j].x > key.x || (sorted[j].x == key.x && sorted[j].y > key.y)); j--)
+            sorted[j + 1] = sorted[j];
+
+        sorted[j + 1] = key;
+    }
+
+    struct occlusion_vertex hull[16];
+    int count = 0;
+
+    for(int k = 0; k < 8; k++) {
+        while(count >= 2 && occlusion_cross(hull + count - 2, hull + count - 1, sorted + k) <= 0.0F)
+            count--;
+        hull[count++] = sorted[k];
+    }
+
+    for(int k = 6, lower = count + 1; k >= 0; k--) {
+        while(count >= lower && occlusion_cross(hull + count - 2, hull + count - 1, sorted + k) <= 0.0F)
+            count--;
+        hull[count++] = sorted[k];
+    }
+
+    // the first corner was added again at the end
+    if(count - 1 >= 3)
+        occlusion_polygon(o, hull, count - 1, depth);
+
+    o->occluders++;
+}
+
+// call after the last occluder was added and before testing boxes
+void occlusion_update_tiles(struct occlusion_buffer* o) {
+    for(int ty = 0; ty < OCCLUSION_TILES_Y; ty++) {
+        for(int tx = 0; tx < OCCLUSION_TILES_X; tx++) {
+            float farthest = 0.0F;
+
+            for(int y = ty * OCCLUSION_TILE; y < (ty + 1) * OCCLUSION_TILE; y++)
+                for(int x = tx * OCCLUSION_TILE; x < (tx + 1) * OCCLUSION_TILE; x++)
+                    farthest = fmax(farthest, o->depth[x + y * OCCLUSION_WIDTH]);
+
+            o->tiles[tx + ty * OCCLUSION_TILES_X] = farthest;
+        }
+    }
+}
+
+// a box is hidden if every pixel its bounding rectangle touches has an occluder in front of its nearest corner
+bool occlusion_box_visible(struct occlusion_buffer* o, const float* min, const float* max) {
+    struct occlusion_vertex v[8];
+
+    if(!occlusion_project(o, min, max, v))
+        return true;
+
+    float x_min = FLT_MAX, x_max = -FLT_MAX;
+    float y_min = FLT_MAX, y_max = -FLT_MAX;
+    float nearest = FLT_MAX;
+
+    for(int k = 0; k < 8; k++) {
+        x_min = fmin(x_min, v[k].x);
+        x_max = fmax(x_max, v[k].x);
+        y_min = fmin(y_min, v[k].y);
+        y_max = fmax(y_max, v[k].y);
+        nearest = fmin(nearest, v[k].w);
+    }
+
+    int x0 = floor(fmax(x_min, 0.0F));
+    int x1 = ceil(fmin(x_max, OCCLUSION_WIDTH));
+    int y0 = floor(fmax(y_min, 0.0F));
+    int y1 = ceil(fmin(y_max, OCCLUSION_HEIGHT));
+
+    // off screen, that is up to frustum culling
+    if(x0 >= x1 || y0 >= y1)
+        return true;
+
+    for(int ty = y0 / OCCLUSION_TILE; ty <= (y1 - 1) / OCCLUSION_TILE; ty++) {
+        for(int tx = x0 / OCCLUSION_TILE; tx <= (x1 - 1) / OCCLUSION_TILE; tx++) {
+            if(o->tiles[tx + ty * OCCLUSION_TILES_X] < nearest)
+                continue;
+
+            for(int y = maxc(y0, ty * OCCLUSION_TILE); y < minc(y1, (ty + 1) * OCCLUSION_TILE); y++)
+                for(int x = maxc(x0, tx * OCCLUSION_TILE); x < minc(x1, (tx + 1) * OCCLUSION_TILE); x++)
+                    if(o->depth[x + y * OCCLUSION_WIDTH] >= nearest)
+                        return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <matrix.hpp>
+
+// low resolution software depth buffer for occlusion culling, independent of any GL state. Depth is the clip space w,
+// the distance along the view direction
+#define OCCLUSION_WIDTH 128
+#define OCCLUSION_HEIGHT 64
+#define OCCLUSION_TILE 8
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE)
+
+// boxes reaching closer to the camera than this are never occluders and never occluded
+#define OCCLUSION_NEAR 0.5F
+
+struct occlusion_buffer {
+    mat4 mvp;
+    float depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT];
+    // farthest depth in each tile, so that most tests never look at single pixels
+    float tiles[OCCLUSION_TILES_X * OCCLUSION_TILES_Y];
+    size_t occluders;
+};
+
+struct occlusion_stats {
+    size_t tested;
+    size_t culled;
+    size_t occluders;
+    float time;
+};
+
+void occlusion_clear(struct occlusion_buffer* o, mat4 mvp);
+void occlusion_add_box(struct occlusion_buffer* o, const float* min, const float* max);
+void occlusion_update_tiles(struct occlusion_buffer* o);
+bool occlusion_box_visible(struct occlusion_buffer* o, const float* min, const float* max);
@@ -0,0 +1,80 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ringbuffer.hpp>
+
+bool ringbuffer_create(struct ringbuffer* rb, size_t object_size, size_t length) {
+    assert(rb != NULL && object_size > 0 && length > 0);
+    assert((length & (length - 1)) == 0);
+
+    rb->object_size = object_size;
+    rb->length = length;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->queue = malloc(object_size * length);
+
+    return rb->queue != NULL;
+}
+
+void ringbuffer_destroy(struct ringbuffer* rb) {
+    assert(rb != NULL);
+
+    free(rb->queue);
+}
+
+size_t ringbuffer_size(struct ringbuffer* rb) {
+    assert(rb != NULL);
+
+    return __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+}
+
+// returns false if the queue is full
+bool ringbuffer_push(struct ringbuffer* rb, void* object) {
+    assert(rb != NULL && object != NULL);
+
+    size_t head = __atomic_load_n(&rb->head, __ATOMIC_RELAXED);
+
+    if(head - __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE) == rb->length)
+        return false;
+
+    memcpy((uint8_t*)rb->queue + (head & (rb->length - 1)) * rb->object_size, object, rb->object_size);
+    __atomic_store_n(&rb->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// returns false if the queue is empty
+bool ringbuffer_pop(struct ringbuffer* rb, void* object) {
+    assert(rb != NULL && object != NULL);
+
+    size_t tail = __atomic_load_n(&rb->tail, __ATOMIC_RELAXED);
+
+    if(__atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) == tail)
+        return false;
+
+    memcpy(object, (uint8_t*)rb->queue + (tail & (rb->length - 1)) * rb->object_size, rb->object_size);
+    __atomic_store_n(&rb->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
@@ -127,6 +127,22 @@ void tesselator_draw(struct tesselator* t, int with_color) {
     }
 }
 
+// size of the vertex data as passed to the GPU by tesselator_glx() and tesselator_arena()
+size_t tesselator_bytes(struct tesselator* t) {
+#ifdef TESSELATE_QUADS
+    size_t vertices = t->quad_count * 4;
+#endif
+
+#ifdef TESSELATE_TRIANGLES
+    size_t vertices = t->quad_count * 6;
+#endif
+
+    size_t position = (t->vertex_type == VERTEX_INT) ? sizeof(int16_t) * 3 : sizeof(float) * 3;
+    size_t normal = t->has_normal ? sizeof(int8_t) * 3 : 0;
+
+    return vertices * (position + sizeof(uint32_t) + normal);
+}
+
 void tesselator_glx(struct tesselator* t, struct glx_displaylist* x) {
 #ifdef TESSELATE_QUADS
     switch(t->vertex_type) {
@@ -151,6 +167,17 @@ void tesselator_glx(struct tesselator* t, struct glx_displaylist* x) {
 #endif
 }
 
+// arena ranges only hold integer vertices with colors, as used by chunk meshes
+void tesselator_arena(struct tesselator* t, struct glx_arena_range* r) {
+#ifdef TESSELATE_QUADS
+    glx_arena_update(r, t->quad_count * 4, t->colors, t->vertices);
+#endif
+
+#ifdef TESSELATE_TRIANGLES
+    glx_arena_update(r, t->quad_count * 6, t->colors, t->vertices);
+#endif
+}
+
 void tesselator_set_color(struct tesselator* t, uint32_t color) {
     t->color = color;
 }
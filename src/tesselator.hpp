@@ -55,7 +55,9 @@ void tesselator_create(struct tesselator* t, enum tesselator_vertex_type type, i
 void tesselator_clear(struct tesselator* t);
 void tesselator_free(struct tesselator* t);
 void tesselator_draw(struct tesselator* t, int with_color);
+size_t tesselator_bytes(struct tesselator* t);
 void tesselator_glx(struct tesselator* t, struct glx_displaylist* x);
+void tesselator_arena(struct tesselator* t, struct glx_arena_range* r);
 void tesselator_set_color(struct tesselator* t, uint32_t color);
 void tesselator_set_normal(struct tesselator* t, int8_t x, int8_t y, int8_t z);
 void tesselator_addi(struct tesselator* t, int16_t* coords, uint32_t* colors, int8_t* normals);
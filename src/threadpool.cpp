@@ -0,0 +1,272 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common.hpp>
+#include <window.hpp>
+#include <log.hpp>
+#include <threadpool.hpp>
+
+// one double ended queue of tasks per priority, the owning worker takes from the back, others steal from the front
+struct threadpool_deque {
+    struct threadpool_task* tasks;
+    size_t length;
+    size_t first;
+    size_t count;
+};
+
+struct threadpool_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct threadpool_deque queues[THREADPOOL_PRIORITIES];
+    size_t executed;
+    size_t steals;
+};
+
+static struct threadpool_worker threadpool_workers[THREADPOOL_WORKERS_MAX];
+static size_t threadpool_worker_count = 0;
+
+// number of tasks in all queues, a thread decrements it before searching for a task so it is sure to find one
+static size_t threadpool_pending = 0;
+static pthread_mutex_t threadpool_lock;
+static pthread_cond_t threadpool_signal;
+
+static size_t threadpool_next_worker = 0;
+static size_t threadpool_helper_executed = 0;
+static size_t threadpool_helper_steals = 0;
+
+static __thread int threadpool_self = -1;
+
+static void threadpool_deque_push(struct threadpool_deque* q, struct threadpool_task* task) {
+    if(q->count == q->length) {
+        size_t length = q->length ? q->length * 2 : 64;
+        struct threadpool_task* tasks = (struct threadpool_task*)malloc(length * sizeof(struct threadpool_task));
+        CHECK_ALLOCATION_ERROR(tasks)
+
+        for(size_t k = 0; k < q->count; k++)
+            tasks[k] = q->tasks[(q->first + k) % q->length];
+
+        free(q->tasks);
+        q->tasks = tasks;
+        q->length = length;
+        q->first = 0;
+    }
+
+    q->tasks[(q->first + q->count++) % q->length] = *task;
+}
+
+static bool threadpool_deque_pop(struct threadpool_deque* q, struct threadpool_task* task, bool back) {
+    if(!q->count)
+        return false;
+
+    if(back) {
+        *task = q->tasks[(q->first + --q->count) % q->length];
+    } else {
+        *task = q->tasks[q->first];
+        q->first = (q->first + 1) % q->length;
+        q->count--;
+    }
+
+    return true;
+}
+
+static bool threadpool_take_from(struct threadpool_worker* w, struct threadpool_task* task, bool own) {
+    pthread_mutex_lock(&w->lock);
+
+    bool found = false;
+    for(int p = 0; p < THREADPOOL_PRIORITIES && !found; p++)
+        found = threadpool_deque_pop(w->queues + p, task, own);
+
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+static void threadpool_count(bool stolen) {
+    size_t* executed = &threadpool_helper_executed;
+    size_t* steals = &threadpool_helper_steals;
+
+    if(threadpool_self >= 0) {
+        executed = &threadpool_workers[threadpool_self].executed;
+        steals = &threadpool_workers[threadpool_self].steals;
+    }
+
+    __atomic_fetch_add(executed, 1, __ATOMIC_RELAXED);
+    if(stolen)
+        __atomic_fetch_add(steals, 1, __ATOMIC_RELAXED);
+}
+
+// caller must have reserved a task by decrementing threadpool_pending
+static void threadpool_take(struct threadpool_task* task) {
+    while(1) {
+        if(threadpool_self >= 0 && threadpool_take_from(threadpool_workers + threadpool_self, task, true)) {
+            threadpool_count(false);
+            return;
+        }
+
+        for(size_t k = 0; k < threadpool_worker_count; k++) {
+            size_t victim = (threadpool_self + 1 + k) % threadpool_worker_count;
+
+            if((int)victim != threadpool_self && threadpool_take_from(threadpool_workers + victim, task, false)) {
+                threadpool_count(true);
+                return;
+            }
+        }
+    }
+}
+
+static void threadpool_run(struct threadpool_task* task) {
+    task->run(task->data);
+
+    if(task->group) {
+        pthread_mutex_lock(&task->group->lock);
+        if(--task->group->pending == 0)
+            pthread_cond_broadcast(&task->group->signal);
+        pthread_mutex_unlock(&task->group->lock);
+    }
+}
+
+static void* threadpool_worker_main(void* user) {
+    pthread_detach(pthread_self());
+    threadpool_self = (int)(size_t)user;
+
+    while(1) {
+        pthread_mutex_lock(&threadpool_lock);
+        while(!threadpool_pending)
+            pthread_cond_wait(&threadpool_signal, &threadpool_lock);
+        threadpool_pending--;
+        pthread_mutex_unlock(&threadpool_lock);
+
+        struct threadpool_task task;
+        threadpool_take(&task);
+        threadpool_run(&task);
+    }
+
+    return NULL;
+}
+
+void threadpool_init() {
+    pthread_mutex_init(&threadpool_lock, NULL);
+    pthread_cond_init(&threadpool_signal, NULL);
+
+    // leave one core for the main thread
+    threadpool_worker_count = minc(maxc(window_cpucores() - 1, 1), THREADPOOL_WORKERS_MAX);
+    log_info("%i worker threads in thread pool", (int)threadpool_worker_count);
+
+    for(size_t k = 0; k < threadpool_worker_count; k++) {
+        struct threadpool_worker* w = threadpool_workers + k;
+        memset(w, 0, sizeof(struct threadpool_worker));
+        pthread_mutex_init(&w->lock, NULL);
+    }
+
+    for(size_t k = 0; k < threadpool_worker_count; k++)
+        pthread_create(&threadpool_workers[k].thread, NULL, threadpool_worker_main, (void*)k);
+}
+
+void threadpool_submit(enum threadpool_priority priority, void (*run)(void* data), void* data, size_t size,
+                       struct threadpool_group* group) {
+    assert(run != NULL && size <= THREADPOOL_DATA_SIZE && priority < THREADPOOL_PRIORITIES);
+
+    struct threadpool_task task;
+    task.run = run;
+    task.group = group;
+    if(size)
+        memcpy(task.data, data, size);
+
+    if(group) {
+        pthread_mutex_lock(&group->lock);
+        group->pending++;
+        pthread_mutex_unlock(&group->lock);
+    }
+
+    // workers keep their own tasks, everybody else spreads them round robin
+    struct threadpool_worker* w;
+    if(threadpool_self >= 0) {
+        w = threadpool_workers + threadpool_self;
+    } else {
+        w = threadpool_workers
+            + __atomic_fetch_add(&threadpool_next_worker, 1, __ATOMIC_RELAXED) % threadpool_worker_count;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    threadpool_deque_push(w->queues + priority, &task);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&threadpool_lock);
+    threadpool_pending++;
+    pthread_cond_signal(&threadpool_signal);
+    pthread_mutex_unlock(&threadpool_lock);
+}
+
+void threadpool_group_create(struct threadpool_group* g) {
+    g->pending = 0;
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->signal, NULL);
+}
+
+void threadpool_group_destroy(struct threadpool_group* g) {
+    pthread_mutex_destroy(&g->lock);
+    pthread_cond_destroy(&g->signal);
+}
+
+// runs queued tasks on the calling thread until all tasks of the group are done
+void threadpool_wait(struct threadpool_group* g) {
+    while(1) {
+        pthread_mutex_lock(&g->lock);
+        bool done = !g->pending;
+        pthread_mutex_unlock(&g->lock);
+
+        if(done)
+            return;
+
+        pthread_mutex_lock(&threadpool_lock);
+        bool reserved = threadpool_pending > 0;
+        if(reserved)
+            threadpool_pending--;
+        pthread_mutex_unlock(&threadpool_lock);
+
+        if(reserved) {
+            struct threadpool_task task;
+            threadpool_take(&task);
+            threadpool_run(&task);
+        } else {
+            pthread_mutex_lock(&g->lock);
+            while(g->pending)
+                pthread_cond_wait(&g->signal, &g->lock);
+            pthread_mutex_unlock(&g->lock);
+        }
+    }
+}
+
+void threadpool_stats(struct threadpool_stats* stats) {
+    pthread_mutex_lock(&threadpool_lock);
+    stats->depth = threadpool_pending;
+    pthread_mutex_unlock(&threadpool_lock);
+
+    stats->workers = threadpool_worker_count;
+    stats->executed = __atomic_load_n(&threadpool_helper_executed, __ATOMIC_RELAXED);
+    stats->steals = __atomic_load_n(&threadpool_helper_steals, __ATOMIC_RELAXED);
+
+    for(size_t k = 0; k < threadpool_worker_count; k++) {
+        stats->executed += __atomic_load_n(&threadpool_workers[k].executed, __ATOMIC_RELAXED);
+        stats->steals += __atomic_load_n(&threadpool_workers[k].steals, __ATOMIC_RELAXED);
+    }
+}
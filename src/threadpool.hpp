@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define THREADPOOL_WORKERS_MAX 16
+#define THREADPOOL_DATA_SIZE 64
+
+enum threadpool_priority {
+    THREADPOOL_HIGH,
+    THREADPOOL_NORMAL,
+    THREADPOOL_LOW,
+    THREADPOOL_PRIORITIES,
+};
+
+// tasks submitted with a group can be waited on together
+struct threadpool_group {
+    size_t pending;
+    pthread_mutex_t lock;
+    pthread_cond_t signal;
+};
+
+struct threadpool_task {
+    void (*run)(void* data);
+    struct threadpool_group* group;
+    uint8_t data[THREADPOOL_DATA_SIZE];
+};
+
+struct threadpool_stats {
+    size_t workers;
+    size_t depth;
+    size_t executed;
+    size_t steals;
+};
+
+void threadpool_init(void);
+void threadpool_submit(enum threadpool_priority priority, void (*run)(void* data), void* data, size_t size,
+                       struct threadpool_group* group);
+void threadpool_group_create(struct threadpool_group* g);
+void threadpool_group_destroy(struct threadpool_group* g);
+void threadpool_wait(struct threadpool_group* g);
+void threadpool_stats(struct threadpool_stats* stats);
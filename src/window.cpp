@@ -17,8 +17,10 @@
     along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <common.hpp>
 #include <main.hpp>
@@ -188,7 +190,27 @@ void window_keyname(int keycode, char* output, size_t length) {
 #endif
 }
 
+// GLFW is not initialized without a window, its timer is replaced by the monotonic clock then
+static bool window_headless = false;
+static struct timespec window_headless_start;
+
+void window_init_headless() {
+    window_headless = true;
+    clock_gettime(CLOCK_MONOTONIC, &window_headless_start);
+}
+
 float window_time() {
+    return window_time_precise();
+}
+
+// for measuring short durations, a float only resolves milliseconds after a few hours
+double window_time_precise() {
+    if(window_headless) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - window_headless_start.tv_sec) + (now.tv_nsec - window_headless_start.tv_nsec) * 1e-9;
+    }
+
     return glfwGetTime();
 }
 
@@ -305,6 +327,22 @@ int window_closed() {
     return glfwWindowShouldClose((GLFWwindow*) hud_window->impl);
 }
 
+// bytes of memory the process has resident, 0 if unknown
+size_t window_memory_resident() {
+#ifdef OS_LINUX
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(!f)
+        return 0;
+
+    unsigned long pages_total, pages_resident;
+    int read = fscanf(f, "%lu %lu", &pages_total, &pages_resident);
+    fclose(f);
+
+    return (read == 2) ? pages_resident * sysconf(_SC_PAGESIZE) : 0;
+#endif
+    return 0;
+}
+
 int window_cpucores() {
 #ifdef OS_LINUX
     return get_nprocs();
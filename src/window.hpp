@@ -114,6 +114,7 @@ extern int window_pressed_keys[64];
 
 void window_textinput(int allow);
 float window_time(void);
+double window_time_precise(void);
 void window_keyname(int keycode, char* output, size_t length);
 const char* window_clipboard(void);
 int window_key_down(int key);
@@ -122,9 +123,11 @@ void window_mouseloc(double* x, double* y);
 void window_setmouseloc(double x, double y);
 void window_swapping(int value);
 void window_init(void);
+void window_init_headless(void);
 void window_fromsettings(void);
 void window_deinit(void);
 void window_update(void);
 int window_closed(void);
 int window_cpucores();
+size_t window_memory_resident(void);
 void window_title(char* suffix);